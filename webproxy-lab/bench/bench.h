@@ -0,0 +1,366 @@
+/*
+ * bench.h - 프록시 마이크로벤치마크 공용 헤더
+ *
+ * proxy.c 를 그대로 포함해 실제 캐시 / 파서 함수를 호출함. 여러 벤치가 비교하는
+ * baseline 의 캐시와 줄 읽기, 시간 측정, 난수, Zipf 분포, 자식 프록시 / 벤치 안의
+ * 서버 도우미를 모아 둠. 한 벤치에서만 쓰는 예전 코드는 그 벤치 파일에 둠.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#define main proxy_main
+#include "../proxy.c"
+#undef main
+
+#include <math.h>
+#include <sys/wait.h>
+#include <x86intrin.h>
+
+/// @brief 단조 시계 (초)
+static inline double now_sec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// @brief TSC 사이클 카운터
+static inline unsigned long long cycles(void)
+{
+  return __rdtsc();
+}
+
+/// @brief xorshift64 난수 -> 스레드마다 상태를 따로 가짐
+static inline unsigned long long rng_next(unsigned long long *s)
+{
+  unsigned long long x = *s;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return *s = x;
+}
+
+// Zipf(s) 분포 표본기 -> 누적 분포를 미리 만들어 이분 탐색
+typedef struct {
+  double *cdf;
+  size_t n;
+} zipf_t;
+
+/// @brief 1..n 순위의 Zipf 누적 분포 생성
+static inline void zipf_init(zipf_t *z, size_t n, double s)
+{
+  double sum = 0;
+
+  z->n = n;
+  z->cdf = Malloc(n * sizeof(double));
+  for (size_t i = 0; i < n; i++)
+    z->cdf[i] = (sum += 1.0 / pow((double)(i + 1), s));
+  for (size_t i = 0; i < n; i++)
+    z->cdf[i] /= sum;
+}
+
+/// @brief 0 부터 시작하는 순위 하나를 뽑음 (0 이 가장 인기)
+static inline size_t zipf_next(zipf_t *z, unsigned long long *s)
+{
+  double u = (rng_next(s) >> 11) * (1.0 / 9007199254740992.0);
+  size_t lo = 0, hi = z->n - 1;
+
+  while (lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (z->cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/// @brief 측정 하나를 새 자식 프로세스에서 실행 -> 전역 캐시를 설정마다 새로 초기화
+static inline void run_forked(void (*fn)(long), long arg)
+{
+  pid_t pid;
+
+  fflush(stdout);
+  if ((pid = Fork()) == 0)
+  {
+    fn(arg);
+    fflush(stdout);
+    _exit(0);
+  }
+  waitpid(pid, NULL, 0);
+}
+
+// baseline proxy.c 의 캐시 -> 블록마다 MAXLINE URI + MAX_OBJECT_SIZE 배열을 두면 100k 블록에
+// 10 GB 가 넘으므로 URI 와 본문은 벤치가 실제 길이만큼 할당함 (조회 / 갱신 / 축출 횟수는 같음)
+typedef struct {
+  char *uri;
+  char *buf;
+  size_t size;
+  int used;
+  int lru;
+} old_block;
+
+typedef struct {
+  old_block *blocks;
+  int nblocks;
+  pthread_rwlock_t lock;
+} old_cache_t;
+
+__attribute__((unused)) static old_cache_t old_cache;
+
+/// @brief 빈 블록 nblocks 개로 예전 캐시 초기화 -> 블록 내용은 호출한 벤치가 채움
+static inline void old_init(int nblocks)
+{
+  old_cache.blocks = Calloc(nblocks, sizeof(old_block));
+  old_cache.nblocks = nblocks;
+  pthread_rwlock_init(&old_cache.lock, NULL);
+}
+
+/// @brief 예전 LRU 갱신 -> 더 최근이던 블록들의 lru 를 하나씩 올리고 자신은 0
+static inline void old_update_lru(int index)
+{
+  int old = old_cache.blocks[index].lru;
+
+  for (int i = 0; i < old_cache.nblocks; i++)
+    if (old_cache.blocks[i].used && old_cache.blocks[i].lru < old)
+      old_cache.blocks[i].lru++;
+  old_cache.blocks[index].lru = 0;
+}
+
+/// @brief 예전 조회 -> 선형 strcmp, hit 면 본문 복사 후 LRU 갱신
+static inline int old_find(char *uri, char *buf, size_t *size)
+{
+  int found = -1;
+
+  pthread_rwlock_rdlock(&old_cache.lock);
+  for (int i = 0; i < old_cache.nblocks; i++)
+  {
+    if (old_cache.blocks[i].used && strcmp(old_cache.blocks[i].uri, uri) == 0)
+    {
+      memcpy(buf, old_cache.blocks[i].buf, old_cache.blocks[i].size);
+      *size = old_cache.blocks[i].size;
+      old_update_lru(i);
+      found = 0;
+      break;
+    }
+  }
+  pthread_rwlock_unlock(&old_cache.lock);
+  return found;
+}
+
+/// @brief 예전 삽입 -> 빈 블록이나 lru 가 가장 큰 블록을 덮어씀
+///        본문 버퍼는 size 이상으로 미리 할당되어 있고, URI 문자열은 벤치가 계속 들고 있음
+static inline void old_insert(char *uri, char *buf, size_t size)
+{
+  int evict_index = -1, max_lru = -1;
+
+  pthread_rwlock_wrlock(&old_cache.lock);
+  for (int i = 0; i < old_cache.nblocks; i++)
+  {
+    if (!old_cache.blocks[i].used)
+    {
+      evict_index = i;
+      break;
+    }
+    if (old_cache.blocks[i].lru > max_lru)
+    {
+      max_lru = old_cache.blocks[i].lru;
+      evict_index = i;
+    }
+  }
+  old_cache.blocks[evict_index].used = 1;
+  old_cache.blocks[evict_index].uri = uri;
+  memcpy(old_cache.blocks[evict_index].buf, buf, size);
+  old_cache.blocks[evict_index].size = size;
+  old_update_lru(evict_index);
+  pthread_rwlock_unlock(&old_cache.lock);
+}
+
+/// @brief 예전 csapp rio_read -> rio_readlineb 가 한 바이트씩 부르던 형태 그대로
+static inline ssize_t old_rio_read(rio_t *rp, char *usrbuf, size_t n)
+{
+  int cnt;
+
+  while (rp->rio_cnt <= 0)
+  {
+    rp->rio_cnt = read(rp->rio_fd, rp->rio_buf, sizeof(rp->rio_buf));
+    if (rp->rio_cnt < 0)
+    {
+      if (errno != EINTR)
+        return -1;
+    }
+    else if (rp->rio_cnt == 0)
+      return 0;
+    else
+      rp->rio_bufptr = rp->rio_buf;
+  }
+  cnt = n;
+  if (rp->rio_cnt < n)
+    cnt = rp->rio_cnt;
+  memcpy(usrbuf, rp->rio_bufptr, cnt);
+  rp->rio_bufptr += cnt;
+  rp->rio_cnt -= cnt;
+  return cnt;
+}
+
+/// @brief 예전 csapp rio_readlineb -> 한 바이트마다 old_rio_read 호출
+///        예전에는 csapp.o 안에 있었으므로 호출하는 루프에 인라인되지 않게 함
+__attribute__((noinline, unused)) static ssize_t old_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+{
+  int n, rc;
+  char c, *bufp = usrbuf;
+
+  for (n = 1; n < maxlen; n++)
+  {
+    if ((rc = old_rio_read(rp, &c, 1)) == 1)
+    {
+      *bufp++ = c;
+      if (c == '\n')
+      {
+        n++;
+        break;
+      }
+    }
+    else if (rc == 0)
+    {
+      if (n == 1)
+        return 0;
+      else
+        break;
+    }
+    else
+      return -1;
+  }
+  *bufp = 0;
+  return n - 1;
+}
+
+/// @brief 메모리의 바이트를 rio 버퍼에 미리 채움 -> 시스템 호출 없이 파싱 / 줄 읽기만 잼
+static inline void rio_preload(rio_t *rp, const char *data, size_t len)
+{
+  rp->rio_fd = -1; // 버퍼를 다 쓰면 read 가 EBADF -> 측정 중에는 일어나지 않음
+  rp->rio_cnt = len;
+  rp->rio_bufptr = rp->rio_buf;
+  memcpy(rp->rio_buf, data, len);
+}
+
+/// @brief 루프백의 빈 포트를 받아 리슨 소켓을 열거나 (listen_now = 1) 번호만 돌려줌
+static inline int open_port(int listen_now, int *port)
+{
+  struct sockaddr_in sa;
+  socklen_t len = sizeof(sa);
+  int fd = Socket(AF_INET, SOCK_STREAM, 0), one = 1;
+
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  Bind(fd, (SA *)&sa, sizeof(sa));
+  getsockname(fd, (SA *)&sa, &len);
+  *port = ntohs(sa.sin_port);
+  if (!listen_now)
+  {
+    Close(fd);
+    return -1;
+  }
+  Listen(fd, 1024);
+  return fd;
+}
+
+/// @brief ../proxy (환경 변수 PROXY 가 있으면 그 경로) 를 자식 프로세스로 띄우고 리슨할 때까지 기다림
+/// @param opts NULL 로 끝나는 프록시 옵션 목록
+/// @param port 프록시가 리슨하는 포트를 받을 곳
+/// @return 프록시 pid
+static inline pid_t proxy_start(char **opts, int *port)
+{
+  char portstr[16], *argv[32], *bin = getenv("PROXY") ? getenv("PROXY") : "../proxy";
+  int argc = 0;
+  pid_t pid;
+
+  open_port(0, port);
+  snprintf(portstr, sizeof(portstr), "%d", *port);
+  argv[argc++] = "proxy";
+  while (*opts && argc < 30)
+    argv[argc++] = *opts++;
+  argv[argc++] = portstr;
+  argv[argc] = NULL;
+
+  if ((pid = Fork()) == 0)
+  {
+    int devnull = Open("/dev/null", O_WRONLY, 0);
+    Dup2(devnull, STDOUT_FILENO); // 접근 로그는 버림 -> 로그 옵션이 없는 예전 빌드도 같은 방법으로 조용해짐
+    execv(bin, argv);
+    perror(bin);
+    _exit(1);
+  }
+  for (int tries = 0; tries < 100; tries++)
+  {
+    int fd = open_clientfd("127.0.0.1", portstr);
+    if (fd >= 0)
+    {
+      Close(fd);
+      break;
+    }
+    usleep(20000);
+  }
+  return pid;
+}
+
+/// @brief 프록시를 멈추고 기다림
+static inline void proxy_stop(pid_t pid)
+{
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+// 벤치 안의 서버 -> accept 한 연결마다 conn(fd) 를 분리된 쓰레드로 실행
+typedef struct {
+  int listenfd;
+  void *(*conn)(void *);
+} origin_t;
+
+/// @brief 서버 accept 루프
+static inline void *origin_main(void *vargp)
+{
+  origin_t *o = vargp;
+  pthread_t tid;
+
+  while (1)
+  {
+    int fd = accept(o->listenfd, NULL, NULL);
+    if (fd >= 0)
+      Pthread_create(&tid, NULL, o->conn, (void *)(long)fd);
+  }
+  return NULL;
+}
+
+/// @brief 루프백 빈 포트에서 서버를 띄움
+/// @param conn 연결 하나를 처리하는 쓰레드 함수 -> 인자는 (void *)(long)connfd, 스스로 detach / Close
+/// @param port 서버 포트를 받을 곳
+static inline void origin_start(void *(*conn)(void *), int *port)
+{
+  origin_t *o = Malloc(sizeof(origin_t));
+  pthread_t tid;
+
+  o->conn = conn;
+  o->listenfd = open_port(1, port);
+  Pthread_create(&tid, NULL, origin_main, o);
+}
+
+/// @brief 서버 쪽에서 요청 헤더를 빈 줄까지 읽음 -> NUL 로 끝나는 문자열
+static inline void origin_read_request(int fd, char *req, size_t size)
+{
+  size_t len = 0;
+  ssize_t n;
+
+  req[0] = '\0';
+  while (len < size - 1 && (n = read(fd, req + len, size - 1 - len)) > 0)
+  {
+    req[len += n] = '\0';
+    if (strstr(req, "\r\n\r\n"))
+      break;
+  }
+}
+
+#endif /* BENCH_H */
@@ -0,0 +1,108 @@
+/*
+ * cache_lookup.c - 캐시 조회 속도: 해시 + SIEVE 샤드 캐시 vs 예전 선형 탐색
+ *
+ * usage: ./cache_lookup [entries ...]   (기본 10 1000 100000)
+ *
+ * 예전 캐시 (bench.h 의 old_find) 는 블록을 strcmp 로 처음부터 훑고, hit 마다
+ * 모든 블록의 lru 값을 고치는 O(N) 갱신을 함.
+ */
+#include "bench.h"
+
+#define OBJ_SIZE 64 /* 조회 비용만 보도록 작은 객체 */
+#define NEW_OPS 2000000L /* 새 캐시 조회 횟수 */
+#define OLD_WORK 200000000L /* 예전 캐시는 조회당 O(N) -> 조회 수 x 항목 수 상한 */
+
+static char **uris;
+
+/// @brief 벤치용 URI 생성 -> 실제 요청처럼 호스트와 경로가 긴 공통 접두사를 가짐
+static void make_uris(long n)
+{
+  uris = Malloc(n * sizeof(char *));
+  for (long i = 0; i < n; i++)
+  {
+    char tmp[MAXLINE];
+    snprintf(tmp, sizeof(tmp), "http://www.example.com:8080/static/assets/img/object-%ld.png", i);
+    uris[i] = strdup(tmp);
+  }
+}
+
+/// @brief 새 캐시: n 개 삽입 후 임의 순서 hit 조회
+static void bench_new(long n)
+{
+  char body[OBJ_SIZE];
+  size_t budget = (size_t)n * 512 > 64 * 1024 * 1024 ? (size_t)n * 512 : 64 * 1024 * 1024;
+  unsigned long long seed = 88172645463325252ULL;
+  long hits = 0;
+  double t;
+
+  memset(body, 'x', sizeof(body));
+  make_uris(n);
+  cache_init(budget, CACHE_SHARDS);
+  for (long i = 0; i < n; i++)
+    cache_insert(uris[i], body, sizeof(body), 0, time(NULL) + 3600);
+
+  t = now_sec();
+  for (long i = 0; i < NEW_OPS; i++)
+  {
+    cache_block *b = cache_find(uris[rng_next(&seed) % n], NULL);
+    if (b)
+    {
+      hits++;
+      cache_release(b);
+    }
+  }
+  t = now_sec() - t;
+  printf("%-8s %10ld %12ld %14.0f %10.1f %7.1f%%\n", "new", n, (long)NEW_OPS, NEW_OPS / t,
+         t * 1e9 / NEW_OPS, 100.0 * hits / NEW_OPS);
+}
+
+/// @brief 예전 캐시: 같은 n 개를 채우고 같은 방식으로 조회
+static void bench_old(long n)
+{
+  char body[OBJ_SIZE], out[OBJ_SIZE];
+  size_t size;
+  long ops = OLD_WORK / n < NEW_OPS ? OLD_WORK / n : NEW_OPS;
+  unsigned long long seed = 88172645463325252ULL;
+  long hits = 0;
+  double t;
+
+  memset(body, 'x', sizeof(body));
+  make_uris(n);
+  old_init(n);
+  for (long i = 0; i < n; i++)
+  {
+    old_block *b = &old_cache.blocks[i];
+    b->uri = uris[i];
+    b->buf = Malloc(sizeof(body));
+    memcpy(b->buf, body, sizeof(body));
+    b->size = sizeof(body);
+    b->used = 1;
+    b->lru = n - 1 - i; // 나중에 넣은 것이 더 최근
+  }
+
+  t = now_sec();
+  for (long i = 0; i < ops; i++)
+    if (old_find(uris[rng_next(&seed) % n], out, &size) == 0)
+      hits++;
+  t = now_sec() - t;
+  printf("%-8s %10ld %12ld %14.0f %10.1f %7.1f%%\n", "old", n, ops, ops / t, t * 1e9 / ops,
+         100.0 * hits / ops);
+}
+
+int main(int argc, char **argv)
+{
+  long defaults[] = {10, 1000, 100000};
+  int nsizes = argc > 1 ? argc - 1 : 3;
+
+  printf("cache lookup, %d-byte objects, uniform random hits\n", OBJ_SIZE);
+  printf("%-8s %10s %12s %14s %10s %8s\n", "cache", "entries", "lookups", "lookups/s", "ns/op", "hit");
+  for (int i = 0; i < nsizes; i++)
+  {
+    long n = argc > 1 ? atol(argv[i + 1]) : defaults[i];
+    if (n <= 0)
+      continue;
+    run_forked(bench_old, n);
+    run_forked(bench_new, n);
+  }
+  return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * cache_threads.c - 캐시 락 경합: 스레드 수 1..64, 샤드 1개(전역 락) vs 여러 개
+ *
+ * usage: ./cache_threads [shards ...]   (기본 1 16)
+ *
+ * 스레드들이 같은 캐시에 Zipf 분포로 조회하고, WRITE_EVERY 번에 한 번은 같은 키를
+ * 다시 삽입해 쓰기 락도 잡음. 전체 작업량은 스레드 수와 관계없이 같으므로
+ * 코어가 충분하면 처리량이 늘고, 락이 병목이면 스레드를 늘려도 그대로거나 줄어듦.
+ */
+#include "bench.h"
+
+#define NOBJECTS 10000 /* 캐시에 넣어 둘 객체 수 */
+#define OBJ_SIZE 1024
+#define TOTAL_OPS 4000000L /* 스레드 전체가 나눠 수행할 연산 수 */
+#define WRITE_EVERY 64 /* 이 횟수마다 한 번은 삽입 (쓰기 락) */
+#define MAX_THREADS 64
+
+static char *uris[NOBJECTS];
+static char body[OBJ_SIZE];
+static zipf_t zipf;
+static long ops_per_thread;
+
+/// @brief 스레드 하나의 조회 / 삽입 루프
+static void *worker(void *vargp)
+{
+  unsigned long long seed = 0x9E3779B97F4A7C15ULL * ((long)vargp + 1);
+  long hits = 0;
+
+  for (long i = 0; i < ops_per_thread; i++)
+  {
+    char *uri = uris[zipf_next(&zipf, &seed)];
+    if (i % WRITE_EVERY == WRITE_EVERY - 1)
+    {
+      cache_insert(uri, body, sizeof(body), 0, time(NULL) + 3600);
+      continue;
+    }
+    cache_block *b = cache_find(uri, NULL);
+    if (b)
+    {
+      hits++;
+      cache_release(b);
+    }
+  }
+  return (void *)hits;
+}
+
+/// @brief 샤드 수 하나로 스레드 수를 늘려 가며 측정
+static void bench_shards(long nshards)
+{
+  pthread_t tids[MAX_THREADS];
+
+  cache_init(64 * 1024 * 1024, nshards);
+  for (int i = 0; i < NOBJECTS; i++)
+    cache_insert(uris[i], body, sizeof(body), 0, time(NULL) + 3600);
+
+  for (int nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2)
+  {
+    long hits = 0;
+    double t;
+
+    ops_per_thread = TOTAL_OPS / nthreads;
+    t = now_sec();
+    for (long i = 0; i < nthreads; i++)
+      Pthread_create(&tids[i], NULL, worker, (void *)i);
+    for (int i = 0; i < nthreads; i++)
+    {
+      void *h;
+      Pthread_join(tids[i], &h);
+      hits += (long)h;
+    }
+    t = now_sec() - t;
+    printf("%7d %8d %14.0f %10.1f %8ld\n", cache_nshards, nthreads, ops_per_thread * nthreads / t,
+           t * 1e9 / (ops_per_thread * nthreads), hits);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  long defaults[] = {1, 16};
+  int nconf = argc > 1 ? argc - 1 : 2;
+
+  memset(body, 'x', sizeof(body));
+  for (int i = 0; i < NOBJECTS; i++)
+  {
+    char tmp[MAXLINE];
+    snprintf(tmp, sizeof(tmp), "http://www.example.com/static/object-%d.html", i);
+    uris[i] = strdup(tmp);
+  }
+  zipf_init(&zipf, NOBJECTS, 0.99);
+
+  printf("cache contention, %d objects, zipf 0.99, 1 insert per %d ops, %ld ops total, %ld cpus\n",
+         NOBJECTS, WRITE_EVERY, TOTAL_OPS, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%7s %8s %14s %10s %8s\n", "shards", "threads", "ops/s", "ns/op", "hits");
+  for (int i = 0; i < nconf; i++)
+    run_forked(bench_shards, argc > 1 ? atol(argv[i + 1]) : defaults[i]);
+  return 0;
+}
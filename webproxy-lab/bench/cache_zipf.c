@@ -0,0 +1,138 @@
+/*
+ * cache_zipf.c - Zipf 작업량에서 SIEVE 캐시 vs 예전 카운터 LRU 의 hit 비율과 처리량
+ *
+ * usage: ./cache_zipf [alpha [capacity ...]]   (기본 0.99, 100 500 1000 2000)
+ *
+ * KEYS 개의 키에서 Zipf(alpha) 로 요청을 뽑고, miss 면 그 객체를 삽입함.
+ * 두 캐시는 같은 수(capacity)의 객체를 담음: 예전 캐시는 블록 배열 크기로,
+ * SIEVE 캐시는 샤드 1개에 객체 capacity 개만큼의 바이트 예산으로 맞춤.
+ * 예전 캐시는 bench.h 에 옮긴 baseline proxy.c 의 cache_find / cache_update_lru /
+ * cache_insert (hit 마다 O(N) 갱신). 예전 코드는 빈 블록의 lru 가 0 에서 시작해
+ * cache_update_lru 가 아무것도 늙히지 못하고 항상 0번 블록만 축출하므로, 빈 블록을
+ * INT_MAX 에서 시작하게 고친 카운터 LRU (counter-lru*) 도 함께 잼.
+ */
+#include "bench.h"
+#include <limits.h>
+
+#define KEYS 100000
+#define OBJ_SIZE 1024
+#define WARMUP_OPS 200000L
+#define MEASURE_OPS 1000000L
+
+static int old_fixed; // 1 이면 빈 블록 lru 를 INT_MAX 로 시작 (제대로 동작하는 카운터 LRU)
+
+static char *uris[KEYS];
+static char body[OBJ_SIZE];
+static double alpha = 0.99;
+static zipf_t zipf;
+
+/// @brief 예전 캐시로 워밍업 후 측정
+static void bench_old(long capacity)
+{
+  char out[OBJ_SIZE];
+  size_t size;
+  unsigned long long seed = 2463534242ULL;
+  long hits = 0;
+  double t;
+
+  old_init(capacity);
+  for (long i = 0; i < capacity; i++)
+  {
+    old_cache.blocks[i].buf = Malloc(OBJ_SIZE);
+    old_cache.blocks[i].lru = old_fixed ? INT_MAX : 0;
+  }
+
+  for (long i = 0; i < WARMUP_OPS; i++)
+  {
+    char *uri = uris[zipf_next(&zipf, &seed)];
+    if (old_find(uri, out, &size) < 0)
+      old_insert(uri, body, sizeof(body));
+  }
+  t = now_sec();
+  for (long i = 0; i < MEASURE_OPS; i++)
+  {
+    char *uri = uris[zipf_next(&zipf, &seed)];
+    if (old_find(uri, out, &size) == 0)
+      hits++;
+    else
+      old_insert(uri, body, sizeof(body));
+  }
+  t = now_sec() - t;
+  printf("%-12s %9ld %9.2f%% %12.0f %9.1f\n", old_fixed ? "counter-lru*" : "counter-lru", capacity, 100.0 * hits / MEASURE_OPS,
+         MEASURE_OPS / t, t * 1e9 / MEASURE_OPS);
+}
+
+/// @brief 고친 카운터 LRU 로 측정
+static void bench_old_fixed(long capacity)
+{
+  old_fixed = 1;
+  bench_old(capacity);
+}
+
+/// @brief SIEVE 캐시로 워밍업 후 측정 -> 샤드 1개, 객체 capacity 개가 딱 들어가는 예산
+static void bench_sieve(long capacity)
+{
+  size_t need = ((size_t)1 << (SLAB_MIN_SHIFT + slab_class(OBJ_SIZE))) + strlen(uris[0]) + 1 + sizeof(cache_block);
+  time_t expires = time(NULL) + 3600;
+  unsigned long long seed = 2463534242ULL;
+  long hits = 0;
+  double t;
+
+  cache_init(need * capacity, 1);
+  for (long i = 0; i < WARMUP_OPS; i++)
+  {
+    char *uri = uris[zipf_next(&zipf, &seed)];
+    cache_block *b = cache_find(uri, NULL);
+    if (b)
+      cache_release(b);
+    else
+      cache_insert(uri, body, sizeof(body), 0, expires);
+  }
+  t = now_sec();
+  for (long i = 0; i < MEASURE_OPS; i++)
+  {
+    char *uri = uris[zipf_next(&zipf, &seed)];
+    cache_block *b = cache_find(uri, NULL);
+    if (b)
+    {
+      hits++;
+      cache_release(b);
+    }
+    else
+      cache_insert(uri, body, sizeof(body), 0, expires);
+  }
+  t = now_sec() - t;
+  printf("%-12s %9ld %9.2f%% %12.0f %9.1f\n", "sieve", capacity, 100.0 * hits / MEASURE_OPS,
+         MEASURE_OPS / t, t * 1e9 / MEASURE_OPS);
+}
+
+int main(int argc, char **argv)
+{
+  long defaults[] = {100, 500, 1000, 2000};
+  int nconf = argc > 2 ? argc - 2 : 4;
+
+  if (argc > 1)
+    alpha = atof(argv[1]);
+  memset(body, 'x', sizeof(body));
+  for (int i = 0; i < KEYS; i++)
+  {
+    char tmp[MAXLINE];
+    snprintf(tmp, sizeof(tmp), "http://www.example.com/static/object-%08d.html", i); // 길이가 같아야 예산이 정확히 맞음
+    uris[i] = strdup(tmp);
+  }
+  zipf_init(&zipf, KEYS, alpha);
+
+  printf("zipf %.2f over %d keys, %d-byte objects, %ld warmup + %ld measured requests\n", alpha, KEYS,
+         OBJ_SIZE, WARMUP_OPS, MEASURE_OPS);
+  printf("%-12s %9s %10s %12s %9s\n", "policy", "capacity", "hit", "req/s", "ns/req");
+  for (int i = 0; i < nconf; i++)
+  {
+    long capacity = argc > 2 ? atol(argv[i + 2]) : defaults[i];
+    if (capacity <= 0)
+      continue;
+    run_forked(bench_old, capacity);
+    run_forked(bench_old_fixed, capacity);
+    run_forked(bench_sieve, capacity);
+  }
+  return 0;
+}
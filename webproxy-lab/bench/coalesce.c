@@ -0,0 +1,172 @@
+/*
+ * coalesce.c - 같은 URI 에 대한 동시 miss 폭주에서 서버로 간 요청 수
+ *
+ * usage: ./coalesce [burst ...]   (기본 1 10 50 100, ../proxy 를 먼저 빌드)
+ *
+ * 벤치 안의 느린 서버 쓰레드가 요청 수를 세고, ../proxy 를 자식 프로세스로 띄워
+ * 같은 URI 에 burst 개의 요청을 한꺼번에 보냄. 저장 가능한 응답은 리더 하나만
+ * 서버에 가야 하고, no-store 응답은 합칠 수 없으므로 burst 개가 그대로 감
+ * (합치기가 없던 예전 동작과 같은 기준선). no-store 폭주 앞에는 같은 URI 로 요청을
+ * 하나 먼저 보냄 -> 프록시가 저장할 수 없는 URI 로 기억하면 (hit-for-pass) 폭주가
+ * 리더의 응답을 기다리지 않고 바로 서버로 가서 max_s 가 서버 지연 한 번에 가까워짐.
+ * 두 모드(threads, epoll)를 모두 잼.
+ */
+#include "bench.h"
+
+#define ORIGIN_DELAY_MS 300 /* 서버 응답 지연 -> 폭주가 모두 리더의 miss 와 겹치도록 */
+#define BODY_SIZE 16384
+#define MAX_BURST 1024
+
+static atomic_long origin_requests;
+static int origin_port, proxy_port;
+
+/// @brief 서버 연결 하나 -> 요청 헤더를 읽고 지연 후 응답
+static void *origin_conn(void *vargp)
+{
+  int fd = (int)(long)vargp;
+  char req[MAXLINE], hdr[MAXLINE], *body;
+  ssize_t n;
+
+  Pthread_detach(pthread_self());
+  origin_read_request(fd, req, sizeof(req));
+  atomic_fetch_add(&origin_requests, 1);
+  usleep(ORIGIN_DELAY_MS * 1000);
+
+  body = Malloc(BODY_SIZE);
+  memset(body, 'c', BODY_SIZE);
+  n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Length: %d\r\nCache-Control: %s\r\n\r\n", BODY_SIZE,
+               strstr(req, "/nostore") ? "no-store" : "max-age=300");
+  if (rio_writen(fd, hdr, n) == n)
+    rio_writen(fd, body, BODY_SIZE);
+  Free(body);
+  Close(fd);
+  return NULL;
+}
+
+// 한 폭주의 클라이언트 요청
+typedef struct {
+  const char *path;
+  pthread_barrier_t *start;
+  double latency;
+  int ok;
+} client_arg;
+
+/// @brief 프록시에 요청 하나를 보내고 응답 본문 길이를 확인
+static void *client(void *vargp)
+{
+  client_arg *a = vargp;
+  char buf[MAXBUF];
+  struct sockaddr_in sa;
+  size_t total = 0;
+  ssize_t n;
+  int fd = Socket(AF_INET, SOCK_STREAM, 0), status = 0;
+  double t;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  sa.sin_port = htons(proxy_port);
+  pthread_barrier_wait(a->start);
+  t = now_sec();
+  if (connect(fd, (SA *)&sa, sizeof(sa)) == 0)
+  {
+    n = snprintf(buf, sizeof(buf), "GET http://127.0.0.1:%d%s HTTP/1.0\r\nHost: 127.0.0.1:%d\r\n\r\n", origin_port,
+                 a->path, origin_port);
+    if (rio_writen(fd, buf, n) == n)
+      while ((n = read(fd, buf, sizeof(buf))) > 0)
+      {
+        if (total == 0 && n > 12)
+          status = atoi(buf + 9); // "HTTP/1.x 200"
+        total += n;
+      }
+  }
+  a->latency = now_sec() - t;
+  a->ok = status == 200 && total > BODY_SIZE;
+  Close(fd);
+  return NULL;
+}
+
+/// @brief 경로로 요청 하나를 보내고 끝날 때까지 기다림 (결과는 출력하지 않음)
+static void prime(const char *path)
+{
+  pthread_barrier_t start;
+  client_arg a = { path, &start, 0, 0 };
+
+  pthread_barrier_init(&start, NULL, 1);
+  client(&a);
+  pthread_barrier_destroy(&start);
+}
+
+/// @brief 같은 경로로 burst 개 요청을 동시에 보내고 서버 요청 수를 출력
+static void burst(const char *mode, const char *kind, const char *path, int nclients)
+{
+  static client_arg args[MAX_BURST];
+  static pthread_t tids[MAX_BURST];
+  pthread_barrier_t start;
+  long before = atomic_load(&origin_requests), origin;
+  double wall = now_sec(), worst = 0;
+  int ok = 0;
+
+  pthread_barrier_init(&start, NULL, nclients);
+  for (int i = 0; i < nclients; i++)
+  {
+    args[i].path = path;
+    args[i].start = &start;
+    Pthread_create(&tids[i], NULL, client, &args[i]);
+  }
+  for (int i = 0; i < nclients; i++)
+  {
+    Pthread_join(tids[i], NULL);
+    ok += args[i].ok;
+    if (args[i].latency > worst)
+      worst = args[i].latency;
+  }
+  wall = now_sec() - wall;
+  pthread_barrier_destroy(&start);
+  origin = atomic_load(&origin_requests) - before;
+  printf("%-8s %-9s %6d %8d %8ld %8ld %9.3f %9.3f\n", mode, kind, nclients, ok, origin, nclients - origin, worst, wall);
+}
+
+/// @brief 프록시를 한 모드로 띄워 폭주 크기마다 측정
+static void run_mode(const char *mode, int *sizes, int nsizes)
+{
+  char modearg[32];
+  char *opts[] = {modearg, "--threads=64", "--queue=1024", NULL};
+  pid_t pid;
+  int round = 0;
+
+  snprintf(modearg, sizeof(modearg), "--mode=%s", mode);
+  pid = proxy_start(opts, &proxy_port);
+
+  for (int i = 0; i < nsizes; i++)
+  {
+    char path[64];
+    snprintf(path, sizeof(path), "/obj?r=%d", round++); // 폭주마다 새 URI -> 처음에는 모두 miss
+    burst(mode, "cacheable", path, sizes[i]);
+    snprintf(path, sizeof(path), "/nostore?r=%d", round++);
+    prime(path); // 서버 요청 수에는 넣지 않음
+    burst(mode, "no-store", path, sizes[i]);
+  }
+  proxy_stop(pid);
+}
+
+int main(int argc, char **argv)
+{
+  int sizes[16] = {1, 10, 50, 100}, nsizes = 4;
+
+  if (argc > 1)
+  {
+    nsizes = 0;
+    for (int i = 1; i < argc && nsizes < 16; i++)
+      if (atoi(argv[i]) > 0 && atoi(argv[i]) <= MAX_BURST)
+        sizes[nsizes++] = atoi(argv[i]);
+  }
+  Signal(SIGPIPE, SIG_IGN);
+  origin_start(origin_conn, &origin_port);
+
+  printf("burst of identical requests, origin delay %d ms, %d-byte body\n", ORIGIN_DELAY_MS, BODY_SIZE);
+  printf("%-8s %-9s %6s %8s %8s %8s %9s %9s\n", "mode", "response", "burst", "ok", "origin", "saved", "max_s", "wall_s");
+  run_mode("threads", sizes, nsizes);
+  run_mode("epoll", sizes, nsizes);
+  return 0;
+}
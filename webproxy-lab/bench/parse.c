@@ -0,0 +1,206 @@
+/*
+ * parse.c - 요청 해석 + 서버 요청 생성 처리량: 구간 파서 vs 예전 sscanf / strcat
+ *
+ * usage: ./parse [iterations]   (기본 200000)
+ *
+ * 브라우저가 실제로 보내는 모양의 헤더 묶음을 rio 버퍼에 미리 채워 두고 (시스템 호출 없음)
+ *   old: 한 바이트씩 읽는 예전 rio_readlineb + sscanf("%s %s %s") + sprintf/strcat 로 만드는
+ *        baseline proxy.c 의 build_http_request
+ *   new: request_read (request_parse) + span_cstr + 지금의 build_http_request (헤더 줄은 iovec 으로 가리킴)
+ * 둘 다 parse_uri 까지 거침. 요청 하나에 걸린 시간과 헤더 바이트 처리량을 출력.
+ */
+#include "bench.h"
+
+// 헤더 묶음 하나 -> 요청 라인 + 헤더 + 빈 줄
+typedef struct {
+  const char *name;
+  char req[RIO_BUFSIZE];
+  size_t len;
+} header_set;
+
+static const char *chrome_nav =
+    "GET http://www.example.com/news/2024/article-12345.html?ref=home HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8,application/signed-exchange;v=b3;q=0.7\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Referer: http://www.example.com/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: ko-KR,ko;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+    "Cookie: _ga=GA1.1.123456789.1700000000; _ga_ABCDEF=GS1.1.1700000000.1.1.1700000100.0.0.0; session=8f14e45fceea167a5a36dedd4bea2543\r\n"
+    "\r\n";
+
+static const char *firefox_img =
+    "GET http://static.example.com:8080/img/thumbs/photo-0042.webp HTTP/1.1\r\n"
+    "Host: static.example.com:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: image/avif,image/webp,*/*\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://www.example.com/news/2024/article-12345.html\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Site: same-site\r\n"
+    "If-Modified-Since: Tue, 14 May 2024 08:12:31 GMT\r\n"
+    "If-None-Match: \"5f3a-61873e2a4b1c0\"\r\n"
+    "\r\n";
+
+static const char *curl_min =
+    "GET http://localhost:15213/home.html HTTP/1.0\r\n"
+    "Host: localhost:15213\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+/// @brief 큰 쿠키를 단 XHR 요청 (약 3 KB)
+static void make_xhr(header_set *s)
+{
+  size_t len = snprintf(s->req, sizeof(s->req),
+                        "GET http://api.example.com/v2/feed?cursor=eyJpZCI6MTIzNDU2fQ&limit=50 HTTP/1.1\r\n"
+                        "Host: api.example.com\r\n"
+                        "Connection: keep-alive\r\n"
+                        "Accept: application/json, text/plain, */*\r\n"
+                        "X-Requested-With: XMLHttpRequest\r\n"
+                        "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 10_15_7) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4 Safari/605.1.15\r\n"
+                        "Origin: http://www.example.com\r\n"
+                        "Referer: http://www.example.com/feed\r\n"
+                        "Accept-Encoding: gzip, deflate\r\n"
+                        "Accept-Language: en-GB,en;q=0.9\r\n"
+                        "Cookie: ");
+  for (int i = 0; i < 60; i++)
+    len += snprintf(s->req + len, sizeof(s->req) - len, "pref_%02d=%032x; ", i, i * 2654435761U);
+  len += snprintf(s->req + len, sizeof(s->req) - len, "end=1\r\n\r\n");
+  s->len = len;
+}
+
+/// @brief 헤더가 아주 많은 요청 -> 예전 strcat 의 헤더 수에 대한 제곱 비용이 드러남
+static void make_many(header_set *s, int n)
+{
+  size_t len = snprintf(s->req, sizeof(s->req), "GET http://www.example.com/many HTTP/1.1\r\nHost: www.example.com\r\n");
+  for (int i = 0; i < n; i++)
+    len += snprintf(s->req + len, sizeof(s->req) - len, "X-Trace-Header-%02d: value-%08d\r\n", i, i);
+  len += snprintf(s->req + len, sizeof(s->req) - len, "\r\n");
+  s->len = len;
+}
+
+/// @brief baseline proxy.c 의 build_http_request -> 헤더마다 strlen / strcat 으로 처음부터 끝을 찾음
+static void old_build_http_request(char *http_request, char *hostname, char *path, rio_t *client_rio)
+{
+  char buf[MAXLINE];
+
+  sprintf(http_request, "GET %s HTTP/1.0\r\n", path);
+  sprintf(http_request + strlen(http_request), "Host: %s\r\n", hostname);
+  sprintf(http_request + strlen(http_request), "%s", user_agent_hdr);
+  sprintf(http_request + strlen(http_request), "Connection: close\r\n");
+  sprintf(http_request + strlen(http_request), "Proxy-Connection: close\r\n");
+
+  while (old_readlineb(client_rio, buf, MAXLINE) > 0)
+  {
+    if (strcmp(buf, "\r\n") == 0)
+      break;
+    if (!strncasecmp(buf, "Host:", 5) || !strncasecmp(buf, "User-Agent:", 11) ||
+        !strncasecmp(buf, "Connection:", 11) || !strncasecmp(buf, "Proxy-Connection:", 17))
+      continue;
+    strcat(http_request, buf);
+  }
+  strcat(http_request, "\r\n");
+}
+
+/// @brief 예전 경로로 요청 하나 처리
+static size_t old_handle(rio_t *rp)
+{
+  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+  char hostname[MAXLINE], path[MAXLINE], port[MAXLINE] = "80";
+  char http_request[MAXLINE];
+
+  old_readlineb(rp, buf, MAXLINE);
+  sscanf(buf, "%s %s %s", method, uri, version);
+  if (strcasecmp(method, "GET") || parse_uri(uri, hostname, path, port) < 0)
+    return 0;
+  old_build_http_request(http_request, hostname, path, rp);
+  return strlen(http_request);
+}
+
+/// @brief 지금의 경로로 요청 하나 처리
+static size_t new_handle(rio_t *rp)
+{
+  static http_request_view view;
+  char hostname[MAXLINE], path[MAXLINE], port[MAXLINE] = "80";
+  char http_request[MAXLINE], range[MAXLINE], *req, *method, *uri;
+  upstream_request request;
+  size_t len = 0;
+  int keep_alive;
+
+  if (request_read(rp, &view, &req) <= 0)
+    return 0;
+  method = span_cstr(req, view.method);
+  uri = span_cstr(req, view.uri);
+  keep_alive = !strcasecmp(span_cstr(req, view.version), "HTTP/1.1");
+  if ((strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) || parse_uri(uri, hostname, path, port) < 0)
+    return 0;
+  build_http_request(&request, http_request, hostname, path, req, &view, &keep_alive, range);
+  for (int i = 0; i < request.iovcnt; i++)
+    len += request.iov[i].iov_len;
+  return len;
+}
+
+/// @brief 한 헤더 묶음을 iters 번 처리 -> 매번 rio 버퍼를 다시 채우는 비용은 두 경로가 같음
+static double run(header_set *s, size_t (*handle)(rio_t *), long iters, size_t *out)
+{
+  static rio_t rio;
+  double t = now_sec();
+
+  for (long i = 0; i < iters; i++)
+  {
+    rio_preload(&rio, s->req, s->len);
+    *out = handle(&rio);
+  }
+  return (now_sec() - t) * 1e9 / iters;
+}
+
+int main(int argc, char **argv)
+{
+  static header_set sets[5];
+  long iters = argc > 1 ? atol(argv[1]) : 200000;
+  const char *fixed[] = {chrome_nav, firefox_img, curl_min};
+  const char *names[] = {"chrome-nav", "firefox-img", "curl", "xhr-cookie", "80-headers"};
+
+  for (int i = 0; i < 3; i++)
+    sets[i].len = strlen(strcpy(sets[i].req, fixed[i]));
+  make_xhr(&sets[3]);
+  make_many(&sets[4], 80);
+
+  printf("request parse + upstream request build, %ld iterations per set, preloaded rio buffer\n", iters);
+  printf("%-12s %7s %8s %10s %10s %9s %9s %8s\n", "headers", "bytes", "lines", "old_ns", "new_ns", "old_MB/s",
+         "new_MB/s", "speedup");
+  for (int i = 0; i < 5; i++)
+  {
+    header_set *s = &sets[i];
+    size_t old_out, new_out;
+    int lines = 0;
+    double old_ns, new_ns;
+
+    s->name = names[i];
+    for (size_t j = 0; j < s->len; j++)
+      lines += s->req[j] == '\n';
+    old_ns = run(s, old_handle, iters, &old_out);
+    new_ns = run(s, new_handle, iters, &new_out);
+    if (!old_out || !new_out)
+    {
+      fprintf(stderr, "%s: request rejected\n", s->name);
+      exit(1);
+    }
+    printf("%-12s %7zu %8d %10.1f %10.1f %9.0f %9.0f %7.2fx\n", s->name, s->len, lines, old_ns, new_ns,
+           s->len / old_ns * 1e3, s->len / new_ns * 1e3, old_ns / new_ns);
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+/*
+ * relay_cpu.c - 캐시하지 않는 큰 본문을 중계할 때 프록시 CPU 시간 (GB 당)
+ *
+ * usage: ./relay_cpu [MB per fetch [fetches]]   (기본 256 MB x 4)
+ *
+ * 벤치 안의 서버 쓰레드가 같은 크기의 본문을 두 방식으로 보냄:
+ *   /len/   Content-Length 가 MAX_OBJECT_SIZE 보다 큼 -> threads 모드는 splice 로 중계
+ *   /close/ 길이 없이 연결을 닫아 끝냄 -> 예전처럼 rio 로 읽고 rio_writen 으로 복사
+ * 프록시 프로세스의 utime + stime 을 /proc/<pid>/stat 에서 읽어 GB 당 CPU 초로 출력.
+ * 본문은 no-store 이고 큰 객체 캐시 예산의 절반보다 커서 캐시 경로로 새지 않음.
+ * splice 이전 빌드와 비교하려면 PROXY=<그 빌드의 proxy> 로 같은 벤치를 다시 실행.
+ */
+#include "bench.h"
+
+#define CHUNK (1024 * 1024) /* 서버가 한 번에 쓰는 바이트 */
+
+static char *chunk;
+static int origin_port, proxy_port;
+
+/// @brief 서버 연결 하나 -> /len/<bytes> 또는 /close/<bytes> 를 보냄
+static void *origin_conn(void *vargp)
+{
+  int fd = (int)(long)vargp;
+  char req[MAXLINE], hdr[MAXLINE], *p;
+  ssize_t n;
+  long size;
+
+  Pthread_detach(pthread_self());
+  origin_read_request(fd, req, sizeof(req));
+  if ((p = strstr(req, "/len/")) != NULL)
+    n = snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n",
+                 size = atol(p + 5));
+  else if ((p = strstr(req, "/close/")) != NULL)
+    n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nCache-Control: no-store\r\n\r\n"), size = atol(p + 7);
+  else
+    n = snprintf(hdr, sizeof(hdr), "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n"), size = 0;
+
+  if (rio_writen(fd, hdr, n) == n)
+    while (size > 0 && rio_writen(fd, chunk, size < CHUNK ? size : CHUNK) > 0)
+      size -= size < CHUNK ? size : CHUNK;
+  Close(fd);
+  return NULL;
+}
+
+/// @brief 프로세스의 누적 사용자 / 커널 CPU 시간 (초)
+static void proc_cpu(pid_t pid, double *user, double *sys)
+{
+  char path[64], buf[1024], *p;
+  unsigned long ut = 0, st = 0;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+  *user = *sys = 0;
+  if ((f = fopen(path, "r")) == NULL)
+    return;
+  if (fgets(buf, sizeof(buf), f) && (p = strrchr(buf, ')')) != NULL)
+    sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ut, &st); // 14, 15번째 필드
+  fclose(f);
+  *user = (double)ut / sysconf(_SC_CLK_TCK);
+  *sys = (double)st / sysconf(_SC_CLK_TCK);
+}
+
+/// @brief 프록시를 통해 경로 하나를 받아 버림
+/// @return 받은 바이트 수 (헤더 포함)
+static long fetch(const char *path)
+{
+  char buf[CHUNK], port[16];
+  long total = 0;
+  ssize_t n;
+  int fd;
+
+  snprintf(port, sizeof(port), "%d", proxy_port);
+  if ((fd = open_clientfd("127.0.0.1", port)) < 0)
+    return -1;
+  n = snprintf(buf, sizeof(buf), "GET http://127.0.0.1:%d%s HTTP/1.0\r\nHost: 127.0.0.1:%d\r\n\r\n", origin_port, path,
+               origin_port);
+  if (rio_writen(fd, buf, n) == n)
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+      total += n;
+  Close(fd);
+  return total;
+}
+
+/// @brief 한 모드 / 한 본문 방식으로 fetches 번 받아 GB 당 CPU 시간 출력
+static void run(const char *mode, const char *kind, long size, int fetches)
+{
+  char modearg[32], path[64];
+  char *opts[] = {modearg, NULL};
+  double u0, s0, u1, s1, t, gb = (double)size * fetches / (1 << 30);
+  long got = 0;
+  pid_t pid;
+
+  snprintf(modearg, sizeof(modearg), "--mode=%s", mode);
+  snprintf(path, sizeof(path), "/%s/%ld", kind, size);
+  pid = proxy_start(opts, &proxy_port);
+
+  proc_cpu(pid, &u0, &s0);
+  t = now_sec();
+  for (int i = 0; i < fetches; i++)
+    got += fetch(path);
+  t = now_sec() - t;
+  proc_cpu(pid, &u1, &s1);
+  proxy_stop(pid);
+
+  printf("%-8s %-6s %8.2f %8.2f %8.2f %10.3f %8.0f %s\n", mode, kind, gb, u1 - u0, s1 - s0, (u1 - u0 + s1 - s0) / gb,
+         gb * 1024 / t, got >= size * fetches ? "" : "(short)");
+}
+
+int main(int argc, char **argv)
+{
+  long size = (argc > 1 ? atol(argv[1]) : 256) * 1024 * 1024;
+  int fetches = argc > 2 ? atoi(argv[2]) : 4;
+
+  if (size <= MAX_OBJECT_SIZE || fetches <= 0)
+  {
+    fprintf(stderr, "usage: %s [MB per fetch [fetches]]\n", argv[0]);
+    exit(1);
+  }
+  Signal(SIGPIPE, SIG_IGN);
+  chunk = Malloc(CHUNK);
+  memset(chunk, 'r', CHUNK);
+  origin_start(origin_conn, &origin_port);
+
+  printf("uncacheable body relay, %ld MB x %d fetches, proxy CPU from /proc\n", size >> 20, fetches);
+  printf("%-8s %-6s %8s %8s %8s %10s %8s\n", "mode", "body", "GB", "user_s", "sys_s", "cpu_s/GB", "MB/s");
+  run("threads", "len", size, fetches);   // splice
+  run("threads", "close", size, fetches); // rio 복사
+  run("epoll", "len", size, fetches);     // 이벤트 루프의 read / write
+  return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * snapshot.c - 캐시 스냅숏 저장 / 다시 읽기 시간
+ *
+ * usage: ./snapshot [MB [object KB [file]]]   (기본 900 MB, 100 KB, /tmp/proxy-snapshot.bench)
+ *
+ * 한 자식 프로세스가 캐시를 MB 만큼의 응답으로 채우고 snapshot_save 로 파일에 씀.
+ * 새 자식 프로세스가 빈 캐시에서 snapshot_load 를 재며, 파일이 페이지 캐시에 있는
+ * 경우 (warm) 와 posix_fadvise 로 내보낸 뒤 (cold) 를 따로 잼. 파일은 끝나면 지움.
+ */
+#include "bench.h"
+
+static long fill_mb = 900, object_kb = 100;
+static char *snap_path = "/tmp/proxy-snapshot.bench";
+
+/// @brief 객체 수에 맞는 캐시 예산 -> 모두 축출 없이 들어가도록 청크 크기 기준
+static size_t budget_for(long count, size_t size)
+{
+  return count * (((size_t)1 << (SLAB_MIN_SHIFT + slab_class(size))) + MAXLINE + sizeof(cache_block)) + (64 << 20);
+}
+
+/// @brief 캐시를 채우고 스냅숏 저장
+static void fill_and_save(long count)
+{
+  size_t size = object_kb * 1024, hdr_len;
+  char *buf = Malloc(size), uri[MAXLINE], hdr[MAXLINE];
+  time_t expires = time(NULL) + 3600;
+  double t;
+
+  // 상태 줄 + 헤더 + 본문이 딱 size 가 되도록 -> 두 번째에는 본문 길이 자릿수가 같음
+  hdr_len = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Length: %zu\r\nCache-Control: max-age=3600\r\n\r\n", size);
+  hdr_len = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Length: %zu\r\nCache-Control: max-age=3600\r\n\r\n",
+                     size - hdr_len);
+  memset(buf, 's', size);
+  memcpy(buf, hdr, hdr_len);
+
+  cache_init(budget_for(count, size), CACHE_SHARDS);
+  for (long i = 0; i < count; i++)
+  {
+    snprintf(uri, sizeof(uri), "http://www.example.com/media/chunk-%ld.bin", i);
+    cache_insert(uri, buf, size, hdr_len, expires);
+  }
+
+  t = now_sec();
+  if (snapshot_save(snap_path) < 0)
+    exit(1);
+  t = now_sec() - t;
+  printf("%-10s %8ld %10.0f %9.3f\n", "save", count, (double)count * size / (1 << 20), t);
+}
+
+/// @brief 빈 캐시에 스냅숏을 다시 읽음 -> arg 가 0 이 아니면 먼저 페이지 캐시에서 내보냄
+static void load(long cold)
+{
+  long count = fill_mb * 1024 / object_kb;
+  double t;
+
+  if (cold)
+  {
+    int fd = Open(snap_path, O_RDONLY, 0);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED); // fsync 된 파일이라 깨끗한 페이지 -> 바로 내보내짐
+    Close(fd);
+  }
+  cache_init(budget_for(count, object_kb * 1024), CACHE_SHARDS);
+  t = now_sec();
+  snapshot_load(snap_path);
+  t = now_sec() - t;
+  printf("%-10s %8ld %10.0f %9.3f\n", cold ? "load cold" : "load warm", atomic_load(&snapshot.loaded),
+         (double)atomic_load(&snapshot.loaded) * object_kb / 1024, t);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc > 1)
+    fill_mb = atol(argv[1]);
+  if (argc > 2)
+    object_kb = atol(argv[2]);
+  if (argc > 3)
+    snap_path = argv[3];
+  if (fill_mb <= 0 || object_kb <= 0 || object_kb * 1024 > MAX_OBJECT_SIZE)
+  {
+    fprintf(stderr, "usage: %s [MB [object KB (<= %d) [file]]]\n", argv[0], MAX_OBJECT_SIZE / 1024);
+    exit(1);
+  }
+
+  printf("cache snapshot, %ld MB of %ld KB objects, %s\n", fill_mb, object_kb, snap_path);
+  printf("%-10s %8s %10s %9s\n", "step", "objects", "MB", "seconds");
+  run_forked(fill_and_save, fill_mb * 1024 / object_kb);
+  run_forked(load, 0);
+  run_forked(load, 1);
+  unlink(snap_path);
+  return 0;
+}
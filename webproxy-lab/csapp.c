@@ -792,6 +792,44 @@ ssize_t rio_writen(int fd, void *usrbuf, size_t n)
 }
 /* $end rio_writen */
 
+/*
+ * rio_writev - Robustly write the gather list iov[0..iovcnt-1] with
+ *    writev (unbuffered), so separate pieces go out in one syscall
+ *    without being copied together. Partial writes are retried from
+ *    where they stopped by adjusting iov in place; on error iov holds
+ *    the unwritten rest, so a non-blocking caller can resume after
+ *    EAGAIN by calling again with the same list.
+ */
+/* $begin rio_writev */
+ssize_t rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    ssize_t nwritten;
+
+    while (iovcnt > 0) {
+	if ((nwritten = writev(fd, iov, iovcnt < IOV_MAX ? iovcnt : IOV_MAX)) < 0) {
+	    if (errno == EINTR)  /* Interrupted by sig handler return */
+		continue;        /* and call writev() again */
+	    return -1;           /* errno set by writev() */
+	}
+	total += nwritten;
+
+	/* Skip the pieces that went out whole, trim the one cut short */
+	while (iovcnt > 0 && (size_t)nwritten >= iov->iov_len) {
+	    nwritten -= iov->iov_len;
+	    iov->iov_len = 0;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *)iov->iov_base + nwritten;
+	    iov->iov_len -= nwritten;
+	}
+    }
+    return total;
+}
+/* $end rio_writev */
+
 
 /* 
  * rio_read - This is a wrapper for the Unix read() function that
@@ -864,35 +902,105 @@ ssize_t rio_readnb(rio_t *rp, void *usrbuf, size_t n)
 }
 /* $end rio_readnb */
 
+/*
+ * rio_fillb - Move any unread bytes to the front of the internal buffer
+ *    and read more after them, so callers can parse in place from
+ *    rp->rio_bufptr. Returns bytes read, 0 on EOF, -1 on error or when
+ *    the buffer is already full (errno = ENOBUFS).
+ */
+/* $begin rio_fillb */
+ssize_t rio_fillb(rio_t *rp)
+{
+    ssize_t n;
+
+    if (rp->rio_cnt < 0)  /* rio_read leaves -1 behind after an error */
+	rp->rio_cnt = 0;
+    if (rp->rio_bufptr != rp->rio_buf) {
+	memmove(rp->rio_buf, rp->rio_bufptr, rp->rio_cnt);
+	rp->rio_bufptr = rp->rio_buf;
+    }
+    if (rp->rio_cnt == sizeof(rp->rio_buf)) {
+	errno = ENOBUFS;
+	return -1;
+    }
+    while ((n = read(rp->rio_fd, rp->rio_buf + rp->rio_cnt,
+		     sizeof(rp->rio_buf) - rp->rio_cnt)) < 0)
+	if (errno != EINTR)  /* Interrupted by sig handler return */
+	    return -1;
+    rp->rio_cnt += n;
+    return n;
+}
+/* $end rio_fillb */
+
 /* 
- * rio_readlineb - Robustly read a text line (buffered)
+ * rio_readlineb - Robustly read a text line (buffered). Scans the
+ *    internal buffer with memchr and copies whole runs instead of
+ *    calling rio_read once per byte.
  */
 /* $begin rio_readlineb */
 ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) 
 {
-    int n, rc;
-    char c, *bufp = usrbuf;
-
-    for (n = 1; n < maxlen; n++) { 
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-	    *bufp++ = c;
-	    if (c == '\n') {
-                n++;
-     		break;
-            }
-	} else if (rc == 0) {
-	    if (n == 1)
-		return 0; /* EOF, no data read */
-	    else
-		break;    /* EOF, some data was read */
-	} else
-	    return -1;	  /* Error */
+    ssize_t rc;
+    size_t n = 0, cnt;
+    char *bufp = usrbuf, *nl = NULL;
+
+    while (!nl && n + 1 < maxlen) {
+	if (rp->rio_cnt <= 0 && (rc = rio_fillb(rp)) <= 0) {
+	    if (rc < 0)
+		return -1;  /* Error */
+	    break;          /* EOF, maybe some data was read */
+	}
+
+	/* Copy up to and including the next newline in one go */
+	cnt = maxlen - 1 - n;
+	if (rp->rio_cnt < cnt)
+	    cnt = rp->rio_cnt;
+	if ((nl = memchr(rp->rio_bufptr, '\n', cnt)) != NULL)
+	    cnt = nl + 1 - rp->rio_bufptr;
+	memcpy(bufp + n, rp->rio_bufptr, cnt);
+	rp->rio_bufptr += cnt;
+	rp->rio_cnt -= cnt;
+	n += cnt;
     }
-    *bufp = 0;
-    return n-1;
+    if (maxlen > 0)
+	bufp[n] = 0;
+    return n;
 }
 /* $end rio_readlineb */
 
+/*
+ * rio_getlineb - Return the next text line as a view into the internal
+ *    buffer, without copying. The line includes its newline unless it
+ *    is the last one before EOF or longer than RIO_BUFSIZE (then the
+ *    rest follows on the next call). *linep stays valid until the next
+ *    read from rp. Returns the line length, 0 on EOF, -1 on error.
+ */
+/* $begin rio_getlineb */
+ssize_t rio_getlineb(rio_t *rp, char **linep)
+{
+    ssize_t rc;
+    size_t scanned = 0, cnt;
+    char *nl;
+
+    /* Read more after the unread bytes until a whole line is buffered */
+    while ((nl = memchr(rp->rio_bufptr + scanned, '\n', rp->rio_cnt - scanned)) == NULL) {
+	scanned = rp->rio_cnt;
+	if (rp->rio_cnt == sizeof(rp->rio_buf))
+	    break;  /* Line longer than the buffer */
+	if ((rc = rio_fillb(rp)) < 0)
+	    return -1;
+	if (rc == 0)
+	    break;  /* EOF */
+    }
+
+    cnt = nl ? (size_t)(nl + 1 - rp->rio_bufptr) : (size_t)rp->rio_cnt;
+    *linep = rp->rio_bufptr;
+    rp->rio_bufptr += cnt;
+    rp->rio_cnt -= cnt;
+    return cnt;
+}
+/* $end rio_getlineb */
+
 /**********************************
  * Wrappers for robust I/O routines
  **********************************/
@@ -911,6 +1019,12 @@ void Rio_writen(int fd, void *usrbuf, size_t n)
 	unix_error("Rio_writen error");
 }
 
+void Rio_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    if (rio_writev(fd, iov, iovcnt) < 0)
+	unix_error("Rio_writev error");
+}
+
 void Rio_readinitb(rio_t *rp, int fd)
 {
     rio_readinitb(rp, fd);
@@ -1,41 +1,657 @@
 #include "csapp.h"
+#include <sys/epoll.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/eventfd.h>
 
 /* Recommended max cache and object sizes */
 #define MAX_CACHE_SIZE 1049000
 #define MAX_OBJECT_SIZE 102400
-#define MAX_CACHE_BLOCK 10
+#define CACHE_SHARDS 16 /* 기본 캐시 샤드 수 */
+#define CACHE_HASH_SIZE 1024 /* 초기 URI 해시 버킷 수 (2의 거듭제곱, 객체 수에 따라 늘어남) */
+
+/* Slab size classes for cached object bodies: 64 B .. 128 KB (powers of two) */
+#define SLAB_MIN_SHIFT 6
+#define SLAB_NCLASSES 12
+
+/* Objects over MAX_OBJECT_SIZE are cached as chains of fixed-size segments under their own budget */
+#define LARGE_CACHE_SIZE (32 * 1024 * 1024) /* 기본 큰 객체 캐시 예산 (--large-cache-size, 0 이면 끔) */
+#define LARGE_SEG_SIZE 65536
+#define LARGE_HASH_SIZE 256
+
+/* Default disk cache budget (--disk-cache-size); the tier is off unless --disk-cache=DIR is given */
+#define DISK_CACHE_SIZE (1024L * 1024 * 1024)
+/* Upper bound on one append-only disk segment file (smaller budgets use budget / 4) */
+#define DISK_SEG_SIZE (64 * 1024 * 1024)
+/* Buckets of the in-memory disk cache index */
+#define DISK_HASH_SIZE 4096
+/* Disk hits after which an object is promoted back into the memory cache */
+#define DISK_PROMOTE_HITS 2
+/* Evicted bytes allowed to wait for the disk writer before demotions are skipped */
+#define DISK_QUEUE_MAX (16 * 1024 * 1024)
+/* Marks the start of every record in a disk segment file */
+#define DISK_MAGIC 0x4c32434bU
+
+/* Cache snapshot file (--snapshot) written on SIGTERM / SIGINT and loaded at startup */
+#define SNAPSHOT_MAGIC "PXYSNAP"
+#define SNAPSHOT_VERSION 1
+
+/* Header lines parsed per client request; requests with more are rejected */
+#define REQUEST_MAX_HEADERS 100
+
+/* Upper bound (seconds) of the 10%-of-Last-Modified-age heuristic lifetime */
+#define HEURISTIC_MAX_TTL 86400
+
+/* The proxy answers this origin-form path itself with a plain-text stats dump */
+#define STATS_PATH "/proxy-stats"
+
+/* Idle persistent origin connections kept per (host, port), and how long (seconds) */
+#define UPSTREAM_MAX_IDLE 8
+#define UPSTREAM_IDLE_TIMEOUT 30
+#define UPSTREAM_HASH_SIZE 64
+
+/* Resolved-address cache: positive / negative TTL and refresh lead time (seconds) */
+#define DNS_TTL 60
+#define DNS_NEGATIVE_TTL 5
+#define DNS_REFRESH_AHEAD 10
+#define DNS_MAX_ADDRS 4
+#define DNS_HASH_SIZE 64
+
+/* Background revalidation threads started when --stale-grace is positive */
+#define REFRESH_THREADS 2
+/* Buckets of the pending background revalidation table (one job per URI) */
+#define REFRESH_HASH_SIZE 64
+
+/* Threads that resolve uncached names and read the disk tier for the epoll event loops */
+#define LOOKUP_THREADS 2
+
+/* Pipe capacity requested for splice() relays of uncacheable bodies */
+#define SPLICE_PIPE_SIZE (1024 * 1024)
+
+/* Buckets of the in-flight miss table used for request coalescing */
+#define INFLIGHT_HASH_SIZE 256
+/* In-flight bodies are buffered in segments of this size while followers tail them */
+#define INFLIGHT_SEG_SIZE 65536
+/* Past this many buffered bytes no new followers join an in-flight response, and
+   followers lagging the leader by more than this are cut off */
+#define INFLIGHT_MAX_BUFFER (64 * 1024 * 1024)
+/* Seconds a URI whose response could not be stored (no-store, private, Set-Cookie, Vary)
+   bypasses coalescing, so its misses go straight to the origin instead of queueing behind a leader */
+#define HIT_FOR_PASS_TTL 30
+/* Hit-for-pass markers kept at once; past this, uncacheable URIs are not remembered */
+#define HIT_FOR_PASS_MAX 4096
+
+/* Seconds a persistent client connection may sit idle between requests */
+#define CLIENT_IDLE_TIMEOUT 15
+/* An idle persistent connection re-checks the connection queue this often and
+   gives its worker up as soon as other clients are waiting */
+#define CLIENT_IDLE_POLL_MS 1000
+
+/* Lines buffered per thread before new log lines are dropped (power of two) */
+#define LOG_RING_SIZE 256
+/* Longest log line; longer lines are truncated */
+#define LOG_LINE_MAX 256
+/* How long the log writer sleeps when every ring is empty */
+#define LOG_FLUSH_MS 50
+
+/* Default worker pool size and connection queue depth (threads mode) */
+#define NTHREADS 16
+#define SBUFSIZE 64
 
 /* You won't lose style points for including this long line in your code */
 static const char *user_agent_hdr =
     "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 "
     "Firefox/10.0.3\r\n";
 
+struct inflight;
+struct large_object;
+
+// 서버 응답의 상태 줄과 헤더에서 뽑은 정보 -> 본문 길이 판단, 연결 재사용, 캐시 저장 여부에 사용
+typedef struct {
+  int major, minor, status;
+  long content_length; // 없으면 -1
+  int chunked, conn_close, keep_alive;
+  int no_store, no_cache, private; // Cache-Control
+  long max_age, s_maxage; // Cache-Control, 없으면 -1
+  time_t date, expires, last_modified; // 없으면 -1, 해석할 수 없으면 0
+  long age; // Age 헤더 (초)
+  int set_cookie, vary;
+} http_response;
+
+// stale 항목 재검증 -> relay_response 가 304 를 클라이언트에 넘기지 않고 여기에 결과를 남김
+typedef struct {
+  char *hdr; // 저장된 응답 헤더 (신선도를 다시 계산할 기준)
+  size_t hdr_len;
+  int not_modified; // 서버가 304 로 답했으면 1
+  time_t expires; // 304 이후의 새 신선도 끝, 저장하면 안 되면 0
+  int fallback; // 서버 오류 / 연결 실패면 클라이언트에 알리지 않고 저장된 본문으로 대신하려면 1
+  int failed; // fallback 이고 서버가 실패했으면 1
+} revalidation;
+
+// 요청 메시지 안의 한 구간 -> 버퍼 기준 위치와 길이 (복사하지 않음)
+typedef struct {
+  unsigned int off, len;
+} http_span;
+
+// 요청 헤더 한 줄
+typedef struct {
+  http_span line; // 줄 끝 (CRLF) 포함 한 줄 -> 서버로 그대로 전달
+  http_span name; // 콜론 앞
+  http_span value; // 콜론 뒤, 앞뒤 공백 제외
+} http_header;
+
+// 클라이언트 요청 해석 결과 -> 부분 읽기 사이에 상태를 들고 있다가 새로 온 바이트만 이어서 해석
+typedef struct {
+  size_t pos; // 다음에 해석할 줄의 시작
+  size_t hdr_off; // 요청 라인 다음 (첫 헤더 줄) 위치, 요청 라인을 아직 못 봤으면 0
+  size_t len; // 빈 줄까지의 요청 헤더 길이 (다 왔을 때)
+  http_span method, uri, version;
+  http_header headers[REQUEST_MAX_HEADERS];
+  int nheaders;
+} http_request_view;
+
+// 서버로 보낼 요청 메시지 -> 프록시가 쓴 부분과 클라이언트 요청 버퍼 안의 헤더 줄들을 복사 없이 가리켜 한 번의 writev 로
+typedef struct {
+  struct iovec iov[REQUEST_MAX_HEADERS + 4]; // 메서드, 요청 라인 나머지와 필수 헤더, 전달할 헤더 줄들, 덧붙인 헤더 한 줄, 빈 줄
+  int iovcnt;
+} upstream_request;
+
+// 디스크 캐시 hit -> 세그먼트 참조를 잡은 동안 data 는 매핑된 영역을 가리킴
+typedef struct {
+  struct disk_segment *seg;
+  char *data; // 저장된 응답 (상태 줄 + 헤더 + 본문)
+  size_t size, hdr_len;
+  time_t expires;
+  int promote; // 메모리 캐시로 올려야 하면 1 (색인에서는 이미 빠짐)
+} disk_hit;
+
 void proxy(int fd);
-void build_http_request(char *http_request, char *hostname, char *path, rio_t *client_rio);
+int client_wait_next(int fd, rio_t *rp);
+int proxy_request(int fd, rio_t *client_rio);
+void build_http_request(upstream_request *out, char *http_request, char *hostname, char *path, char *req, http_request_view *r, int *keep_alive, char *range);
+void request_wrap(upstream_request *out, char *request);
+size_t request_flatten(upstream_request *r, char *dst, size_t size);
+void request_add_header(upstream_request *r, char *line);
+int request_has(upstream_request *r, char *name);
+void request_view_init(http_request_view *r);
+int request_parse(http_request_view *r, const char *buf, size_t len);
+int request_read(rio_t *rp, http_request_view *r, char **base);
+http_header *request_header(http_request_view *r, const char *buf, const char *name);
+int span_is(const char *buf, http_span s, const char *str);
+int span_has(const char *buf, http_span s, const char *token);
+char *span_cstr(char *buf, http_span s);
+void add_request_header(char *dst, char *request, char *line);
+int response_status(char *hdr);
+int parse_range(char *spec, size_t total, size_t *start, size_t *stop);
+int send_range_headers(int fd, char *hdr, size_t hdr_len, int satisfiable, size_t start, size_t stop, size_t total,
+                       char *tail, char *body);
+int write_slice(int fd, char *data, size_t n, size_t pos, size_t start, size_t stop);
 int parse_uri(const char *uri, char *hostname, char *path, char *port);
 void *thread(void *vargp);
-void cache_insert(char *uri, char *buf, size_t size);
-void cache_update_lru(int index);
-int cache_find(char *uri, char *buf, size_t * size);
-void cache_init();
+void cache_insert(char *uri, char *buf, size_t size, size_t hdr_len, time_t expires);
+struct cache_block *cache_find(char *uri, int *stale);
+void cache_refresh(struct cache_block *b, time_t expires);
+void cache_release(struct cache_block *b);
+void cache_init(size_t budget, int nshards);
+int proxy_stats(char *buf, size_t maxlen);
+int skip_request_header(const char *line);
+void response_init(http_response *r);
+int response_status_line(http_response *r, char *line);
+void response_header(http_response *r, char *line);
+int response_hop_by_hop(char *line);
+size_t response_normalize(char *buf, size_t len, size_t *hdr_len, int has_length);
+ssize_t response_getline(rio_t *rp, char **linep);
+time_t response_cache_until(http_response *r, char *uri, time_t now);
+int response_parse(http_response *r, char *buf, size_t hdr_len);
+int header_value(char *msg, size_t len, char *name, char *value);
+int client_not_modified(char *request, size_t request_len, char *hdr, size_t hdr_len);
+size_t build_not_modified(char *dst, size_t size, char *hdr, size_t hdr_len, int keep_alive);
+int send_cached_headers(int fd, char *request, size_t request_len, char *hdr, size_t hdr_len, int head, int keep_alive);
+int relay_response(int clientfd, int serverfd, upstream_request *request, char *uri, struct inflight *f, char *range, int client_http11, int *keep_client, int *reusable, revalidation *rv);
+int send_cached(int fd, char *buf, size_t size, size_t hdr_len, int keep_alive, char *range);
+int fetch_origin(int fd, char *hostname, char *port, upstream_request *request, char *uri, struct inflight *f, char *range, int http11, int keep_alive, revalidation *rv);
+int fetch_range(int fd, char *hostname, char *port, upstream_request *request, char *uri, char *range, int http11, int keep_alive);
+int revalidate(int fd, char *hostname, char *port, upstream_request *request, char *uri, char *hdr, size_t hdr_len, time_t stale_since, char *range, int http11, int keep_alive, time_t *expires);
+void refresh_init(void);
+void refresh_schedule(char *hostname, char *port, upstream_request *request, char *uri, char *hdr, size_t hdr_len);
+int conditional_request(char *dst, char *request, char *hdr, size_t hdr_len);
+struct inflight *inflight_join(char *uri, int follow, int *leader);
+void inflight_headers(struct inflight *f, char *hdr, size_t hdr_len, long content_length);
+void inflight_unshared(struct inflight *f, int pass);
+void inflight_append(struct inflight *f, char *data, size_t n);
+void inflight_complete(struct inflight *f);
+int inflight_detach(struct inflight *f);
+int inflight_stream(int fd, struct inflight *f, int http11, int keep_alive);
+void inflight_finish(struct inflight *f);
+void inflight_release(struct inflight *f);
+void large_init(size_t budget);
+int large_admits(long content_length);
+struct large_object *large_begin(char *uri, char *hdr, size_t hdr_len, long content_length, time_t expires);
+void large_append(struct large_object *lo, char *data, size_t n);
+void disk_init(char *dir, size_t budget);
+void disk_demote(struct cache_block *b);
+int disk_find(char *uri, disk_hit *h, int promote);
+void disk_release(disk_hit *h);
+int disk_promote(char *uri);
+int disk_has(char *uri);
+static void *disk_writer(void *vargp);
+void snapshot_init(char *path);
+void snapshot_start(void);
+void snapshot_load(char *path);
+int snapshot_save(char *path);
+void large_abort(struct large_object *lo);
+void large_publish(struct large_object *lo);
+struct large_object *large_find(char *uri, int *stale);
+void large_refresh(struct large_object *lo, time_t expires);
+void large_release(struct large_object *lo);
+int send_large(int fd, struct large_object *lo, int keep_alive, char *range, size_t *sent, size_t *stop);
+int large_refetch(int fd, char *hostname, char *port, upstream_request *request, struct large_object *lo, size_t offset, size_t stop, int keep_alive);
+int upstream_acquire(char *hostname, char *port, int *reused);
+void upstream_release(char *hostname, char *port, int fd);
+void upstream_sweep(time_t now);
+static unsigned int cache_hash(const char *uri);
+void dns_init(void);
+int dns_connect(char *hostname, char *port, int nonblock, int *in_progress);
+void epoll_main(int listenfd);
+void lookup_init(void);
+void log_init(int level);
+int log_parse_level(const char *name);
+void log_printf(int level, const char *fmt, ...);
+int stats_request(int fd, const char *uri);
+void *event_loop(void *vargp);
 
-// 개별 캐시 블록을 나타내는 구조채
-typedef struct {
-  char uri[MAXLINE]; // 요청된 객체의 URI
-  char buf[MAX_OBJECT_SIZE]; // 캐시된 실제 객체 데이터 
+// 개별 캐시 블록을 나타내는 구조채 -> 삽입 후에는 내용을 바꾸지 않고 참조 카운트로 수명 관리
+typedef struct cache_block {
+  char *uri; // 요청된 객체의 URI (실제 길이만큼만 할당)
+  char *buf; // 캐시된 실제 객체 데이터 (slab 청크)
   size_t size; // 객체의 크기
-  int used; // 해당 캐시 블록이 현재 사용중인 여부 (1 사용, 0 사용 안함)
-  int lru; // LRU (least Recenyly Used) 번호 -> 작을 수록 최근에 사용
+  size_t hdr_len; // 본문 시작 위치 (상태 줄 + 헤더 + 빈 줄 길이), 모르면 0
+  _Atomic time_t expires; // 이 시각부터 stale -> 서버에 다시 확인하기 전에는 보내지 않음 (재검증이 락 밖의 hit 와 겹쳐서 갱신)
+  size_t chunk; // buf로 예약된 slab 청크 크기
+  atomic_int refcnt; // 캐시 자신의 참조 1 + 이 블록을 전송 중인 hit 수
+  struct cache_shard_s *shard; // 블록이 속한 샤드 (마지막 참조 해제 시 청크 반납용)
+  unsigned int hash; // 미리 계산해 둔 URI 해시 -> 해시가 같을 때만 strcmp
+  struct cache_block *hnext; // 같은 해시 버킷의 다음 블록
+  struct cache_block *prev; // SIEVE 큐에서 더 나중에 들어온 블록
+  struct cache_block *next; // SIEVE 큐에서 더 먼저 들어온 블록
+  atomic_int visited; // SIEVE 참조 비트 -> hit는 이 비트만 relaxed store로 세움
 } cache_block;
 
-// 전체 캐시를 나타내는 구조체
-typedef struct {
-  cache_block blocks[MAX_CACHE_BLOCK]; // 여러 개의 캐시 블록 배열
-  size_t total_size; // 현재 캐시에 저장된 총 객체 크기
+// 크기 클래스별 빈 청크 리스트 -> 객체 크기를 2의 거듭제곱으로 올림해 재사용
+typedef struct slab_chunk {
+  struct slab_chunk *next;
+} slab_chunk;
+
+// 캐시 샤드 하나를 나타내는 구조체
+typedef struct cache_shard_s {
+  cache_block **table; // URI 해시 -> 블록 체인
+  size_t nbuckets; // 해시 버킷 수
+  size_t count; // 캐시된 객체 수
+  cache_block *head; // 가장 최근에 들어온 블록
+  cache_block *tail; // 가장 먼저 들어온 블록
+  cache_block *hand; // SIEVE 축출 포인터 -> tail 에서 head 방향으로 이동 (NULL 이면 tail 부터)
+  slab_chunk *slab_free[SLAB_NCLASSES]; // 크기 클래스별 빈 청크
+  size_t slab_free_bytes; // 빈 청크로 들고 있는 바이트
+  size_t budget; // 캐시가 쓸 수 있는 최대 바이트 (--cache-size)
+  size_t total_size; // 현재 캐시에 저장된 총 객체 크기 (URI 포함, 실제 사용 바이트)
+  size_t reserved; // 객체들이 예약한 바이트 (청크 크기 + URI + 블록 헤더)
   pthread_rwlock_t lock; // 캐시 접근을 위한 읽기-쓰기 락 (동시성 제어)
 } cache_t;
 
-cache_t cache;
+// 캐시는 URI 해시로 나눈 샤드들로 구성 -> 샤드마다 락, SIEVE 큐, 바이트 예산을 따로 가짐
+cache_t *cache_shards;
+int cache_nshards;
+
+// 응답 저장 정책 통계
+typedef struct {
+  atomic_long stored; // 저장 정책을 통과한 응답 수
+  atomic_long refused; // no-store / private / Set-Cookie / 신선도 없음 등으로 저장하지 않은 응답 수
+  atomic_long stale; // 찾았지만 신선도가 지난 항목 수
+  atomic_long revalidations; // stale 항목을 검증자로 서버에 다시 확인한 수
+  atomic_long not_modified; // 그중 304 로 저장된 본문을 그대로 쓴 수
+  atomic_long client_304; // 클라이언트 검증자가 맞아 본문 없이 304 로 답한 hit 수
+  atomic_long head_hits; // 저장된 헤더만 보낸 HEAD hit 수
+} admission_stats_t;
+
+admission_stats_t admission;
+
+// 백그라운드 재검증 작업 하나 -> 같은 URI 는 끝날 때까지 하나만 대기열에 둠
+typedef struct refresh_job {
+  char *uri, *hostname, *port;
+  char *request; // 서버로 보낼 요청 메시지 (검증자가 있으면 조건부)
+  char *hdr; // stale 항목의 저장된 응답 헤더 복사본 (304 후 신선도 계산 기준)
+  size_t hdr_len;
+  struct refresh_job *hnext; // 같은 버킷의 대기 / 진행 중 작업
+  struct refresh_job *next; // 대기열의 다음 작업
+} refresh_job;
+
+// stale-while-revalidate -> 유예 시간 안의 stale hit 은 바로 보내고 재검증은 백그라운드 쓰레드가 맡음
+typedef struct {
+  refresh_job *table[REFRESH_HASH_SIZE]; // 대기 중이거나 진행 중인 작업 (URI 별 중복 제거)
+  refresh_job *head, *tail; // 대기열
+  pthread_mutex_t lock;
+  pthread_cond_t cond; // 새 작업 알림
+  int devnull; // 백그라운드로 받은 응답을 클라이언트 대신 써 버릴 곳
+  atomic_long served; // 기다리지 않고 stale 본문을 보낸 hit 수
+  atomic_long scheduled; // 대기열에 넣은 재검증 수
+  atomic_long deduped; // 같은 URI 재검증이 이미 있어 합친 수
+  atomic_long on_error; // 서버 오류 / 연결 실패로 stale 본문을 대신 보낸 수
+} refresh_queue_t;
+
+refresh_queue_t refresh = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+// 신선도가 지난 뒤 이 시간 (초) 안의 hit 은 stale 본문을 바로 보내고 백그라운드에서 재검증 (--stale-grace, 0 이면 끔)
+int stale_grace = 0;
+// 신선도가 지난 뒤 이 시간 (초) 안이면 재검증이 서버 오류 / 연결 실패로 끝나도 stale 본문을 보냄 (--stale-if-error)
+int stale_if_error = 0;
+
+// Range 요청이 miss 면 서버에서 전체 객체를 받아 캐시를 채우면서 요청 구간만 보냄 (--range-fill=off 면 구간만 전달)
+int range_fill = 1;
+
+// 큰 객체의 본문 조각 하나 -> 객체 단위가 아니라 조각 단위로 SIEVE 축출
+typedef struct large_seg {
+  struct large_object *obj; // 조각이 속한 객체
+  size_t index; // 객체 안에서 몇 번째 조각인지
+  size_t len; // 조각 길이 (마지막 조각만 LARGE_SEG_SIZE 보다 짧음)
+  atomic_int refcnt; // 객체 슬롯의 참조 1 + 이 조각을 전송 중인 hit 수
+  atomic_int visited; // SIEVE 참조 비트
+  struct large_seg *prev; // SIEVE 큐에서 더 나중에 들어온 조각
+  struct large_seg *next; // SIEVE 큐에서 더 먼저 들어온 조각
+  char data[];
+} large_seg;
+
+// MAX_OBJECT_SIZE 보다 큰 객체 -> 헤더와 조각 슬롯 배열, 축출된 조각 자리는 NULL
+typedef struct large_object {
+  char *uri;
+  unsigned int hash;
+  char *hdr; // 상태 줄 + 헤더 + 빈 줄 (Content-Length 포함)
+  size_t hdr_len;
+  size_t body_len; // 본문 전체 길이
+  char *etag, *last_modified; // 저장된 응답의 검증자 값 (없으면 NULL) -> 이어 받을 때 If-Range 로 같은 객체인지 확인
+  _Atomic time_t expires; // 이 시각부터 stale (재검증이 락 밖의 hit 와 겹쳐서 갱신)
+  size_t filled; // 모으는 중에 채운 본문 바이트 수
+  size_t nsegs; // 조각 슬롯 수
+  size_t resident; // 메모리에 남아 있는 조각 수 -> 0 이 되면 객체도 제거
+  large_seg **segs;
+  int linked; // 해시 테이블에 걸려 있으면 1
+  atomic_int refcnt; // 캐시 자신의 참조 1 + hit 수
+  struct large_object *hnext;
+} large_object;
+
+// 큰 객체 캐시 -> 작은 객체 캐시와 별도의 바이트 예산, 조각들이 하나의 SIEVE 큐를 공유
+typedef struct {
+  large_object *table[LARGE_HASH_SIZE];
+  large_seg *head, *tail, *hand; // 조각 SIEVE 큐
+  size_t budget; // --large-cache-size
+  size_t used; // 메모리에 있는 조각 바이트 합
+  size_t count; // 객체 수
+  size_t nsegs; // 메모리에 있는 조각 수
+  pthread_mutex_t lock;
+  atomic_long hits; // 모든 조각이 남아 있던 hit
+  atomic_long partial_hits; // 축출된 조각부터 서버에서 다시 받은 hit
+  atomic_long refills; // 다시 받아 채운 조각 수
+} large_cache_t;
+
+large_cache_t large = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// 디스크 세그먼트 파일 안의 기록 하나의 머리 -> 뒤에 URI 와 저장된 응답이 이어짐
+typedef struct {
+  unsigned int magic; // DISK_MAGIC
+  unsigned int uri_len;
+  size_t size; // 저장된 응답 길이
+  size_t hdr_len; // 본문 시작 위치
+  time_t expires;
+} disk_record;
+
+// 덧붙이기만 하는 디스크 세그먼트 파일 하나 -> 파일 전체를 읽기 전용으로 매핑
+typedef struct disk_segment {
+  unsigned int id; // 파일 이름 seg-<id>
+  int fd;
+  char *map; // 파일 전체 매핑 (seg_size)
+  size_t used; // 기록된 바이트 (쓰기 쓰레드만 바꿈)
+  int refcnt; // 세그먼트 목록의 참조 1 + 이 세그먼트에서 전송 중인 hit 수 (디스크 락)
+  struct disk_segment *next; // 더 나중에 만든 세그먼트
+} disk_segment;
+
+// 디스크에 있는 객체 하나의 색인 항목 (메모리에는 이것만 둠)
+typedef struct disk_entry {
+  char *uri;
+  unsigned int hash;
+  disk_segment *seg;
+  size_t off; // 세그먼트 안에서 저장된 응답의 시작 위치
+  size_t size, hdr_len;
+  time_t expires;
+  int hits; // DISK_PROMOTE_HITS 에 이르면 메모리 캐시로 올림
+  struct disk_entry *hnext;
+} disk_entry;
+
+// 디스크 쓰기 대기열 항목 -> 축출된 블록의 참조를 잡고 있음
+typedef struct disk_job {
+  struct cache_block *b;
+  struct disk_job *next;
+} disk_job;
+
+// 2 단계 디스크 캐시 -> 메모리 캐시에서 축출된 객체를 세그먼트 파일에 덧붙이고, 오래된 세그먼트부터 통째로 버림
+typedef struct {
+  char *dir; // --disk-cache, NULL 이면 사용하지 않음
+  size_t budget; // --disk-cache-size
+  size_t seg_size; // 세그먼트 파일 하나의 크기
+  disk_entry *table[DISK_HASH_SIZE];
+  disk_segment *oldest, *current; // 세그먼트 목록 (current 에 덧붙임)
+  unsigned int next_id;
+  size_t nsegs, count, live; // 세그먼트 수, 색인 항목 수, 색인이 가리키는 바이트
+  pthread_mutex_t lock; // 색인과 세그먼트 목록
+  disk_job *qhead, *qtail; // 쓰기 대기열
+  size_t qbytes;
+  pthread_mutex_t qlock;
+  pthread_cond_t qcond;
+  atomic_long demoted; // 디스크에 기록한 객체 수
+  atomic_long skipped; // 쓰기 대기열이 차서 버린 객체 수
+  atomic_long hits; // 매핑된 영역에서 바로 보낸 hit 수
+  atomic_long promoted; // 메모리 캐시로 올린 hit 수
+  atomic_long dropped; // 예산을 넘어 버린 세그먼트 수
+} disk_cache_t;
+
+disk_cache_t disk = { .lock = PTHREAD_MUTEX_INITIALIZER, .qlock = PTHREAD_MUTEX_INITIALIZER, .qcond = PTHREAD_COND_INITIALIZER };
+
+// 스냅숏 파일의 머리 -> 버전이나 색인 항목 크기가 다르면 파일 전체를 무시
+typedef struct {
+  char magic[8]; // SNAPSHOT_MAGIC
+  unsigned int version; // SNAPSHOT_VERSION
+  unsigned int entry_size; // sizeof(snapshot_entry)
+  size_t count; // 색인 항목 수
+  size_t index_off; // 색인 시작 위치 (= 기록 영역 끝)
+  time_t saved; // 기록한 시각
+} snapshot_header;
+
+// 스냅숏 색인 항목 하나 -> 위치는 모두 파일 시작 기준
+typedef struct {
+  size_t uri_off, uri_len; // NUL 로 끝나는 URI
+  size_t off, size; // 저장된 응답 (상태 줄 + 헤더 + 본문)
+  size_t hdr_len;
+  time_t expires;
+} snapshot_entry;
+
+// 재시작 사이에 메모리 캐시를 보존하는 스냅숏
+typedef struct {
+  char *path; // --snapshot, NULL 이면 사용하지 않음
+  sigset_t sigs; // 기록을 시작하는 종료 시그널
+  atomic_long loaded; // 시작할 때 다시 넣은 객체 수
+  atomic_long expired; // 신선도가 지나 버린 객체 수
+} snapshot_t;
+
+snapshot_t snapshot;
+
+// 메인 쓰레드(생산자)와 워커 쓰레드(소비자)가 공유하는 연결 큐 (CS:APP sbuf)
+typedef struct {
+  int *buf;    // 연결 디스크립터 배열
+  int n;       // 최대 슬롯 수
+  int front;   // buf[(front+1)%n] 이 첫 항목
+  int rear;    // buf[rear%n] 이 마지막 항목
+  sem_t mutex; // buf 접근 보호
+  sem_t slots; // 빈 슬롯 수
+  sem_t items; // 대기 중인 연결 수
+} sbuf_t;
+
+sbuf_t sbuf;
+atomic_long idle_yielded; // 대기 중인 클라이언트에게 워커를 넘기려고 닫은 유휴 keep-alive 연결 수
+
+// (host, port) 하나에 대한 유휴 persistent 서버 연결 목록
+typedef struct upstream_host {
+  char *key; // "host:port"
+  int fds[UPSTREAM_MAX_IDLE]; // 유휴 연결 (뒤쪽이 가장 최근에 반납된 연결)
+  time_t idle_since[UPSTREAM_MAX_IDLE]; // 각 연결이 반납된 시각
+  int nidle;
+  struct upstream_host *next;
+} upstream_host;
+
+// 서버 연결 풀 -> 같은 서버로 가는 miss 마다 TCP 핸드셰이크와 이름 해석을 반복하지 않도록
+typedef struct {
+  upstream_host *table[UPSTREAM_HASH_SIZE];
+  pthread_mutex_t lock;
+  atomic_long requests; // 서버로 보낸 요청 수
+  atomic_long reused; // 그 중 유휴 연결을 재사용한 수
+  atomic_long spliced; // 캐시하지 않는 본문을 splice 로 바로 넘긴 바이트 수
+} upstream_pool_t;
+
+upstream_pool_t upstream = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// 해석된 서버 주소 하나 (getaddrinfo 결과에서 connect 에 필요한 부분만 복사)
+typedef struct {
+  int family, socktype, protocol;
+  socklen_t addrlen;
+  struct sockaddr_storage addr;
+} dns_addr;
+
+// (hostname, port) 에 대한 이름 해석 결과 -> 실패도 잠깐 기억 (negative caching)
+typedef struct dns_entry {
+  char *key; // "host:port"
+  char *host, *port;
+  dns_addr addrs[DNS_MAX_ADDRS];
+  int naddrs; // 0 이면 해석 실패 결과
+  time_t expires; // 이 시각이 지나면 다시 해석
+  time_t last_used; // 최근에 쓰인 항목만 백그라운드에서 미리 갱신
+  struct dns_entry *next;
+} dns_entry;
+
+// 이름 해석 캐시 -> 정상 상태에서는 connect 경로에서 getaddrinfo 를 부르지 않도록
+typedef struct {
+  dns_entry *table[DNS_HASH_SIZE];
+  pthread_mutex_t lock;
+  atomic_long hits; // 캐시된 결과로 바로 응답 (실패 결과 포함)
+  atomic_long misses; // 요청 경로에서 getaddrinfo 를 부른 수
+  atomic_long refreshes; // 백그라운드에서 미리 다시 해석한 수
+} dns_cache_t;
+
+dns_cache_t dns = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static int dns_cached(char *host, char *port, dns_addr *addrs);
+static int dns_lookup(char *host, char *port, dns_addr *addrs);
+static int dns_open(dns_addr *addrs, int n, int nonblock, int *in_progress);
+
+// epoll 모드에서 이벤트 루프 대신 블로킹 작업을 하는 조회 쓰레드들이 나눠 가져가는 대기열 (작업은 struct lookup_job)
+typedef struct {
+  struct lookup_job *head, *tail;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  atomic_long jobs; // 이벤트 루프가 조회 쓰레드에 맡긴 작업 수
+} lookup_queue_t;
+
+lookup_queue_t lookups = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+// 서버에서 받는 중인 본문 조각 (앞에서부터 채워지고 모든 팔로워가 지나가면 해제)
+typedef struct inflight_seg {
+  struct inflight_seg *next;
+  size_t len; // 채워진 바이트 수
+  int pins; // 이 조각을 락 밖에서 전송 중인 팔로워 수
+  int orphan; // 전송 중에 목록에서 빠짐 -> 마지막으로 전송을 마친 팔로워가 해제
+  char data[INFLIGHT_SEG_SIZE];
+} inflight_seg;
+
+// 리더의 응답을 따라 읽는 팔로워 하나의 진행 위치
+typedef struct inflight_reader {
+  size_t pos; // 다음에 보낼 본문 위치
+  int cut; // 너무 뒤처져 끊겼으면 1
+  struct inflight_reader *next;
+} inflight_reader;
+
+// 서버에서 가져오는 중인 URI 하나 -> 첫 요청(리더)만 서버에 가고
+// 나머지(팔로워)는 리더가 받는 대로 쌓이는 응답을 각자 속도로 따라 읽음
+typedef struct inflight {
+  char *uri;
+  unsigned int hash;
+  int linked; // 테이블에 걸려 있어 새 팔로워가 합류할 수 있으면 1
+  int done; // 리더가 끝났으면 1
+  int complete; // 응답을 끝까지 받았으면 1 (done 인데 0 이면 실패)
+  int refcnt; // 리더 + 팔로워 수
+  pthread_cond_t cond; // 헤더 도착, 본문 추가, 완료 알림
+  char *hdr; // 상태 라인 + hop-by-hop 을 뺀 헤더 (빈 줄 제외), 도착 전에는 NULL
+  size_t hdr_len;
+  long content_length; // 본문 길이, 모르면 -1 (헤더에 Content-Length 가 있으면 그대로 전달됨)
+  size_t body_len; // 지금까지 받은 본문 바이트 수
+  size_t base; // head 조각의 본문 위치 (앞쪽 조각은 모든 팔로워가 지나가면 해제)
+  inflight_seg *head, *tail;
+  inflight_reader *readers; // 따라 읽는 중인 팔로워들
+  int nreaders;
+  time_t pass_until; // 0 이 아니면 리더 없는 hit-for-pass 표시 -> 이 시각까지 같은 URI 의 miss 는 합치지 않음
+  struct inflight *next;
+} inflight_t;
+
+// 진행 중인 miss 테이블 (request coalescing)
+typedef struct {
+  inflight_t *table[INFLIGHT_HASH_SIZE];
+  pthread_mutex_t lock;
+  atomic_long leaders; // 서버에 간 miss 수
+  atomic_long followers; // 진행 중인 miss 에 합류한 요청 수
+  atomic_long coalesced; // 그 중 서버에 가지 않고 리더의 응답을 받은 수
+  atomic_long cut; // 리더보다 INFLIGHT_MAX_BUFFER 이상 뒤처져 끊긴 팔로워 수
+  atomic_long passed; // hit-for-pass 표시 때문에 합치지 않고 바로 서버로 간 miss 수
+  int markers; // 테이블에 걸린 hit-for-pass 표시 수
+} inflight_table_t;
+
+inflight_table_t inflight = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// 로그 수준 -> 이 값 이하인 줄만 기록
+enum { LOG_OFF, LOG_ERROR, LOG_INFO, LOG_DEBUG };
+
+// 쓰레드 하나의 로그 링 버퍼 -> 그 쓰레드만 쓰고 로그 쓰기 쓰레드만 읽음 (단일 생산자 / 단일 소비자)
+typedef struct log_ring {
+  atomic_size_t head; // 다음에 채울 줄 번호 (쓰레드만 증가)
+  atomic_size_t tail; // 다음에 내보낼 줄 번호 (쓰기 쓰레드만 증가)
+  struct log_ring *next; // 등록된 링 목록
+  atomic_int dead; // 쓰레드가 끝나 더 채우지 않음 -> 쓰기 쓰레드가 남은 줄을 내보낸 뒤 해제
+  unsigned short lens[LOG_RING_SIZE];
+  char lines[LOG_RING_SIZE][LOG_LINE_MAX];
+} log_ring;
+
+// 로거 -> 요청 경로는 자기 링에 줄을 채우기만 하고, 출력은 쓰기 쓰레드가 모아서 writev
+typedef struct {
+  atomic_int level; // 현재 로그 수준 (--log-level, 실행 중에는 /proxy-stats?log-level=)
+  int fd; // 출력 디스크립터
+  _Atomic(log_ring *) rings; // 쓰레드별 링 목록 (앞에 끼워 넣기만 하므로 락 없이 등록, 빼는 것은 쓰기 쓰레드만)
+  pthread_key_t key; // 쓰레드가 끝날 때 그 링을 dead 로 표시하는 소멸자
+  atomic_long written; // 내보낸 줄 수
+  atomic_long dropped; // 링이 가득 차 버린 줄 수
+} logger_t;
+
+logger_t logger = { .level = LOG_INFO, .fd = STDOUT_FILENO };
+static __thread log_ring *log_self; // 이 쓰레드의 링 (처음 기록할 때 만듦)
+static const char *log_level_names[] = { "off", "error", "info", "debug" };
+static char stats_forbidden[] = "HTTP/1.0 403 Forbidden\r\nContent-Length: 0\r\nCache-Control: no-store\r\nConnection: close\r\n\r\n"; // 다른 호스트의 통계 요청
+
+/// @brief 해당 수준의 로그를 기록할지 확인 -> 꺼져 있으면 줄을 만드는 비용도 들이지 않도록 호출자가 먼저 확인
+/// @param level 로그 수준
+/// @return 기록하면 1
+static inline int log_enabled(int level)
+{
+  return level <= atomic_load_explicit(&logger.level, memory_order_relaxed);
+}
+
+void sbuf_init(sbuf_t *sp, int n);
+int sbuf_tryinsert(sbuf_t *sp, int item);
+int sbuf_remove(sbuf_t *sp);
+int sbuf_pending(sbuf_t *sp);
 
 
 // /// @brief main 함수 서버 소켕 열고 클라이언트 연결을 받아 proxy 함수로 처리
@@ -72,355 +688,5092 @@ cache_t cache;
 
 int main(int argc, char **argv)
 {
-  int listenfd, *connfd;
+  int listenfd, connfd;
   char hostname[MAXLINE], port[MAXLINE];
   socklen_t clientlen;
   struct sockaddr_storage clientaddr;
   pthread_t tid; // 생성할 새 쓰레드 ID 저장할 변수
+  char *portarg = NULL; // 리슨할 포트 번호 인자
+  int use_epoll = 0; // 1 이면 epoll 이벤트 루프, 0 이면 워커 쓰레드 풀
+  int nthreads = NTHREADS; // 워커 쓰레드 수
+  int queue_depth = SBUFSIZE; // 연결 큐 깊이
+  size_t cache_size = MAX_CACHE_SIZE; // 캐시 바이트 예산
+  int cache_shards = CACHE_SHARDS; // 캐시 샤드 수
+  size_t large_cache_size = LARGE_CACHE_SIZE; // 큰 객체 캐시 바이트 예산
+  char *disk_dir = NULL; // 디스크 캐시 디렉터리, NULL 이면 디스크 캐시 끔
+  size_t disk_cache_size = DISK_CACHE_SIZE; // 디스크 캐시 바이트 예산
+  char *snapshot_path = NULL; // 캐시 스냅숏 파일, NULL 이면 재시작 때 빈 캐시로 시작
+  int log_level = LOG_INFO; // 로그 수준
+
 
+  // 인자 파싱 -> [--mode=epoll|threads] [--threads=N] [--queue=N] [--cache-size=BYTES] [--cache-shards=N] [--large-cache-size=BYTES] [--range-fill=on|off] [--disk-cache=DIR] [--disk-cache-size=BYTES] [--snapshot=FILE] [--stale-grace=SECONDS] [--stale-if-error=SECONDS] [--log-level=LEVEL] <port>
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--mode=epoll"))
+      use_epoll = 1;
+    else if (!strcmp(argv[i], "--mode=threads"))
+      use_epoll = 0;
+    else if (!strncmp(argv[i], "--threads=", 10) && atoi(argv[i] + 10) > 0)
+      nthreads = atoi(argv[i] + 10);
+    else if (!strncmp(argv[i], "--queue=", 8) && atoi(argv[i] + 8) > 0)
+      queue_depth = atoi(argv[i] + 8);
+    else if (!strncmp(argv[i], "--cache-size=", 13) && atoll(argv[i] + 13) > 0)
+      cache_size = atoll(argv[i] + 13);
+    else if (!strncmp(argv[i], "--cache-shards=", 15) && atoi(argv[i] + 15) > 0)
+      cache_shards = atoi(argv[i] + 15);
+    else if (!strncmp(argv[i], "--large-cache-size=", 19) && atoll(argv[i] + 19) >= 0)
+      large_cache_size = atoll(argv[i] + 19);
+    else if (!strcmp(argv[i], "--range-fill=on") || !strcmp(argv[i], "--range-fill=off"))
+      range_fill = !strcmp(argv[i] + 13, "on");
+    else if (!strncmp(argv[i], "--disk-cache=", 13) && argv[i][13])
+      disk_dir = argv[i] + 13;
+    else if (!strncmp(argv[i], "--disk-cache-size=", 18) && atoll(argv[i] + 18) > 0)
+      disk_cache_size = atoll(argv[i] + 18);
+    else if (!strncmp(argv[i], "--snapshot=", 11) && argv[i][11])
+      snapshot_path = argv[i] + 11;
+    else if (!strncmp(argv[i], "--stale-grace=", 14) && atoi(argv[i] + 14) >= 0)
+      stale_grace = atoi(argv[i] + 14);
+    else if (!strncmp(argv[i], "--stale-if-error=", 17) && atoi(argv[i] + 17) >= 0)
+      stale_if_error = atoi(argv[i] + 17);
+    else if (!strncmp(argv[i], "--log-level=", 12) && log_parse_level(argv[i] + 12) >= 0)
+      log_level = log_parse_level(argv[i] + 12);
+    else if (!portarg && argv[i][0] != '-')
+      portarg = argv[i];
+    else
+      portarg = NULL, i = argc; // 알 수 없는 인자 -> usage 출력
+  }
 
   // 인자 개수 확안
-  if (argc != 2)
+  if (!portarg)
   {
-    fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    fprintf(stderr, "usage: %s [--mode=epoll|threads] [--threads=N] [--queue=N] [--cache-size=BYTES] [--cache-shards=N] [--large-cache-size=BYTES] [--range-fill=on|off] [--disk-cache=DIR] [--disk-cache-size=BYTES] [--snapshot=FILE] [--stale-grace=SECONDS] [--stale-if-error=SECONDS] [--log-level=off|error|info|debug] <port>\n", argv[0]);
     exit(1);
   }
 
-  cache_init();
+  // 끊어진 소켓에 쓸 때 SIGPIPE로 프로세스가 죽지 않도록 무시
+  Signal(SIGPIPE, SIG_IGN);
+  if (snapshot_path)
+    snapshot_init(snapshot_path); // 종료 시그널은 전용 쓰레드만 받도록 쓰레드를 만들기 전에 막음
+  log_init(log_level); // 요청 경로 대신 로그를 내보낼 쓰기 쓰레드
+
+  cache_init(cache_size, cache_shards);
+  large_init(large_cache_size);
+  if (disk_dir)
+    disk_init(disk_dir, disk_cache_size); // 메모리 캐시에서 축출된 객체를 받을 디스크 세그먼트와 쓰기 쓰레드
+  if (snapshot_path)
+    snapshot_start(); // 지난 실행의 캐시를 다시 채우고 종료 시그널 대기
+  dns_init(); // 이름 해석 캐시와 백그라운드 갱신 쓰레드
+  if (stale_grace > 0)
+    refresh_init(); // stale-while-revalidate 백그라운드 재검증 쓰레드
   // 지정 포트 번호로 리슨 소켓 생성 및 초기화
-  listenfd = Open_listenfd(argv[1]);
+  listenfd = Open_listenfd(portarg);
+
+  if (use_epoll)
+  {
+    epoll_main(listenfd); // 코어 당 하나의 이벤트 루프로 처리 (반환하지 않음)
+    return 0;
+  }
+
+  // 워커 쓰레드를 미리 만들어 두고 연결 큐에서 꺼내 처리하게 함
+  sbuf_init(&sbuf, queue_depth);
+  for (int i = 0; i < nthreads; i++)
+    Pthread_create(&tid, NULL, thread, NULL);
   
   while (1)
   {
     clientlen = sizeof(clientaddr); // 클라이언트 주소 초기화
-    connfd = malloc(sizeof(int)); // 파일 스크립터파일 동적 할당 ++
-    *connfd = Accept(listenfd, (SA*)&clientaddr, &clientlen); // 클라이언트 연결 대기 및 수락, 연결 소켓 생성
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0); // 연결된 클라이언트의 호스트명과 호스트번호 얻기
-    printf("Acceped connection form (%s, %s)\n", hostname, port);
+    connfd = Accept(listenfd, (SA*)&clientaddr, &clientlen); // 클라이언트 연결 대기 및 수락, 연결 소켓 생성
+    if (log_enabled(LOG_INFO)) // 숫자 주소만 -> 수락 쓰레드가 역방향 DNS 조회를 기다리지 않음
+    {
+      Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, NI_NUMERICHOST | NI_NUMERICSERV);
+      log_printf(LOG_INFO, "Accepted connection from (%s, %s)\n", hostname, port);
+    }
 
-    // &tid : 생성된 쓰레드 ID 저장할 변수 포인터
-    // NULL : 기본 속성
-    // thread : 새 스레드가 실행할 함수 포인터
-    // connfd : 함수에 넘겨줄 인자 (파일 디스크립터)
-    pthread_create(&tid, NULL, thread, connfd);
+    // 큐가 가득 찼으면 기다리지 않고 바로 거절 -> 쓰레드/메모리 폭증 대신 빠른 실패
+    if (sbuf_tryinsert(&sbuf, connfd) < 0)
+    {
+      static char busy[] = "HTTP/1.0 503 Service Unavailable\r\nConnection: close\r\n\r\n";
+      rio_writen(connfd, busy, sizeof(busy) - 1); // 실패해도 종료하지 않는 rio_writen 사용
+      Close(connfd);
+    }
   }
 }
 
-/// @brief proxy 함수 클라이언트로 요청을 받아 서버에 전달, 서버의 응답을 다시 클라이언트에게 전달
+/// @brief proxy 함수 클라이언트 연결 하나를 처리 -> keep-alive 면 같은 연결의 요청들을 차례로 처리
 /// @param fd 클라이언트와 연결된 파일 디스크럽터
 void proxy(int fd)
 {
-  char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE]; // 요청과 관련된 정보 저장 버퍼
-  char hostname[MAXLINE], path[MAXLINE], port[MAXLINE] = "80"; // 기본 포트 80
-  char http_request[MAXLINE]; // 서버에 보낼 HTTP 요청 메시지 저장할 버퍼
-  int serverfd; // 서버와 연결할 소켓 디스크립터
-  rio_t client_rio, server_rio; // 클라이언트, 서버 RIO
-  char cache_buf[MAX_OBJECT_SIZE];
-  size_t cache_size = 0;
+  rio_t client_rio; // 클라이언트 RIO -> 파이프라인된 다음 요청도 이 버퍼에 남아 있음
+  struct timeval idle = { CLIENT_IDLE_TIMEOUT, 0 };
 
+  // 다음 요청을 기다리는 시간 제한 -> 놀고 있는 연결이 워커를 계속 잡고 있지 않도록
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
 
-  Rio_readinitb(&client_rio, fd); // 클라이언트와의 연결을 RIO 버퍼로 초기화
-  Rio_readlineb(&client_rio, buf, MAXLINE); // 클라리언트로부터 요청 라인을 읽어옴
-  printf("Request header: \n");
-  printf("%s", buf);
-  sscanf(buf, "%s %s %s", method, uri, version); // 요청 라인 파싱
-
+  rio_readinitb(&client_rio, fd); // 클라이언트와의 연결을 RIO 버퍼로 초기화
+  while (proxy_request(fd, &client_rio) && client_wait_next(fd, &client_rio))
+    ;
+}
 
+/// @brief keep-alive 연결에서 다음 요청을 기다림 -> 연결 큐에 기다리는 클라이언트가 있으면 놀고 있는 연결을 닫고 워커를 넘김
+/// @param fd 클라이언트 소켓
+/// @param rp 클라이언트 RIO
+/// @return 다음 요청을 읽을 수 있으면 1, 연결을 닫아야 하면 0
+int client_wait_next(int fd, rio_t *rp)
+{
+  struct pollfd pfd = { fd, POLLIN, 0 };
 
-  if (strcasecmp(method, "GET")) // GET이 아니라면
+  if (rp->rio_cnt > 0) // 파이프라인된 다음 요청이 이미 버퍼에 있음
+    return 1;
+  for (int waited = 0; waited < CLIENT_IDLE_TIMEOUT * 1000; waited += CLIENT_IDLE_POLL_MS)
   {
-    sprintf(buf, "Proxy does not implement this method: %s\r\n", method);
-    Rio_writen(fd, buf, strlen(buf)); // 실패 시 에러
-    return;
+    int rc = poll(&pfd, 1, sbuf_pending(&sbuf) ? 0 : CLIENT_IDLE_POLL_MS);
+
+    if (rc > 0)
+      return 1; // 요청 바이트 또는 EOF -> proxy_request 가 처리
+    if (rc < 0 && errno != EINTR)
+      return 0;
+    if (sbuf_pending(&sbuf))
+    {
+      atomic_fetch_add(&idle_yielded, 1);
+      return 0;
+    }
   }
+  return 0;
+}
 
-  if (parse_uri(uri, hostname, path, port) < 0) // URI를 파싱
+/// @brief 클라이언트 요청 하나를 받아 서버에 전달, 서버의 응답을 다시 클라이언트에게 전달
+/// @param fd 클라이언트와 연결된 파일 디스크럽터
+/// @param client_rio 클라이언트 연결의 RIO
+/// @return 연결을 유지하고 다음 요청을 읽을 수 있으면 1, 닫아야 하면 0
+int proxy_request(int fd, rio_t *client_rio)
+{
+  char buf[MAXLINE]; // 에러 메시지 / 통계 응답 버퍼
+  char *req, *method, *uri, *version; // 요청 헤더와 요청 라인의 세 부분 -> 모두 rio 버퍼 안을 가리킴
+  http_request_view view; // 요청 헤더 해석 결과
+  char hostname[MAXLINE], path[MAXLINE], port[MAXLINE] = "80"; // 기본 포트 80
+  char http_request[MAXLINE]; // 서버에 보낼 요청 라인과 필수 헤더
+  upstream_request request; // 서버에 보낼 HTTP 요청 메시지 -> 나머지 헤더 줄은 rio 버퍼를 그대로 가리킴
+  char *client_hdrs; // 클라이언트 헤더 줄들 (요청 라인 다음부터) -> 클라이언트 검증자 확인용
+  size_t client_hdrs_len;
+  char range[MAXLINE]; // 클라이언트 Range 헤더 값
+  int rc, leader; // 결과, 이 요청이 서버에서 가져오는 담당인지
+  int http11, keep_alive; // 클라이언트가 HTTP/1.1 인지, 응답 후 연결을 유지할지
+  cache_block *hit; // 캐시 hit 블록 (참조를 잡고 있는 동안 축출되어도 안전)
+  struct inflight *f; // 같은 URI 에 대한 진행 중인 서버 요청
+  large_object *lo; // 큰 객체 캐시 hit
+  disk_hit dh; // 디스크 캐시 hit
+  size_t sent, stop; // 큰 객체 hit 에서 서버로부터 이어 받을 본문 구간
+  int head; // HEAD 요청이면 1 -> hit 은 저장된 헤더만, miss 는 서버에 HEAD 로 전달
+  int stale; // 찾은 항목의 신선도가 지났는지 -> 서버에 재검증
+  time_t expires = 0; // 재검증 후 새 신선도 끝
+
+
+  // 요청 헤더 전체를 rio 버퍼 안에서 해석 (EOF, 시간 초과 시 종료) -> 복사 없이 구간만 받음
+  if ((rc = request_read(client_rio, &view, &req)) <= 0)
   {
-    sprintf(buf, "Proxy could not parse URI: %s\r\n", uri);
-    Rio_writen(fd, buf, strlen(buf)); // 실패 시 에러
-    return;
+    if (rc < 0) // 요청 라인이 아니거나 헤더가 버퍼보다 큼
+    {
+      static char bad[] = "HTTP/1.0 400 Bad Request\r\nConnection: close\r\n\r\n";
+      rio_writen(fd, bad, sizeof(bad) - 1);
+    }
+    return 0;
   }
-  
-  if (cache_find(uri, cache_buf, &cache_size) == 0)
+  method = span_cstr(req, view.method);
+  uri = span_cstr(req, view.uri);
+  version = span_cstr(req, view.version);
+  log_printf(LOG_INFO, "Request: %s %s %s\n", method, uri, version);
+
+  if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) // GET, HEAD 가 아니라면
   {
-    Rio_writen(fd, cache_buf, cache_size);
-    return;
+    sprintf(buf, "Proxy does not implement this method: %s\r\n", method);
+    rio_writen(fd, buf, strlen(buf)); // 요청 본문을 읽지 않았으므로 연결 종료
+    return 0;
   }
 
-  // 서버에 보낼 HTTP 요청 메시지 생성
-  build_http_request(http_request, hostname, path, &client_rio);
+  // HTTP/1.1 은 기본이 keep-alive, HTTP/1.0 은 헤더로 명시해야 유지
+  http11 = !strcasecmp(version, "HTTP/1.1");
+  keep_alive = http11;
+  head = !strcasecmp(method, "HEAD");
 
-  if ((serverfd = Open_clientfd(hostname, port)) < 0) // 서버에 연결 시도
+  if ((rc = stats_request(fd, uri)) != 0) // 프록시 자신의 통계 요청
   {
-    sprintf(buf, "Connection failed to %s:%s\r\n", hostname, port);
-    Rio_writen(fd, buf, strlen(buf)); // 실패 시 에러
-    return;
+    if (rc < 0)
+      rio_writen(fd, stats_forbidden, sizeof(stats_forbidden) - 1);
+    else
+      rio_writen(fd, buf, proxy_stats(buf, sizeof(buf)));
+    return 0;
   }
 
-  Rio_readinitb(&server_rio, serverfd); // 서버와 연결을 위한 RIO 초기화
-  Rio_writen(serverfd, http_request, strlen(http_request)); // 생성한 요청 메시지를 서버에 전송
+  if (parse_uri(uri, hostname, path, port) < 0) // URI를 파싱
+  {
+    sprintf(buf, "Proxy could not parse URI: %s\r\n", uri);
+    rio_writen(fd, buf, strlen(buf));
+    return 0;
+  }
 
-  size_t n;
-  size_t object_len = 0;
-  char object_buf[MAX_OBJECT_SIZE];
+  // 서버에 보낼 HTTP 요청 메시지 생성
+  //   Range 헤더는 빼서 따로 둠 -> 부분 응답이 전체 URI 키로 캐시되지 않도록
+  build_http_request(&request, http_request, hostname, path, req, &view, &keep_alive, range);
+  client_hdrs = req + view.hdr_off;
+  client_hdrs_len = view.len - view.hdr_off;
 
-  // 서버로부터 한 줄씩 응답을 읽어 buf에 저장 클라이언트로 전달
-  while ((n = Rio_readnb(&server_rio, buf, MAXLINE)) > 0) 
+  // 메모리 캐시에 없으면 디스크 캐시 -> 매핑된 영역에서 바로 보내고, stale 이거나 자주 찾는 객체는 메모리로 올려 아래 경로로
+  if ((hit = cache_find(uri, &stale)) == NULL && disk_find(uri, &dh, 0))
   {
-    Rio_writen(fd, buf, n); // 응답의 각 줄을 클라이언트로 전달
-
-    if (object_len + n <= MAX_OBJECT_SIZE)
+    if (!dh.promote)
     {
-      memcpy(object_buf + object_len, buf, n);
-      object_len += n;
+      if ((rc = send_cached_headers(fd, client_hdrs, client_hdrs_len, dh.data, dh.hdr_len, head, keep_alive)) < 0)
+        rc = send_cached(fd, dh.data, dh.size, dh.hdr_len, keep_alive, range);
+      disk_release(&dh);
+      return rc;
     }
-    else
+    cache_insert(uri, dh.data, dh.size, dh.hdr_len, dh.expires);
+    disk_release(&dh);
+    hit = cache_find(uri, &stale);
+  }
+
+  if (hit != NULL)
+  {
+    rc = -1;
+    if (stale && time(NULL) < atomic_load(&hit->expires) + stale_grace) // 유예 시간 안 -> stale 본문을 바로 보내고 재검증은 백그라운드에서
+      refresh_schedule(hostname, port, &request, uri, hit->buf, hit->hdr_len);
+    else if (stale && head) // stale 항목의 HEAD 는 서버에 그대로 전달
+      rc = -2;
+    else if (stale) // 서버에 조건부 요청 -> 304 면 신선도만 갱신하고 저장된 본문을 보냄
+      rc = revalidate(fd, hostname, port, &request, uri, hit->buf, hit->hdr_len, atomic_load(&hit->expires), range, http11, keep_alive, &expires);
+    if (rc == -1)
     {
-      object_len = MAX_OBJECT_SIZE + 1;
+      if (expires)
+        cache_refresh(hit, expires);
+      // 클라이언트 검증자가 맞으면 304, HEAD 면 헤더만, 아니면 공유 버퍼에서 바로 전송 -> 복사 없음
+      if ((rc = send_cached_headers(fd, client_hdrs, client_hdrs_len, hit->buf, hit->hdr_len, head, keep_alive)) < 0)
+        rc = send_cached(fd, hit->buf, hit->size, hit->hdr_len, keep_alive, range);
     }
+    cache_release(hit);
+    if (rc != -2) // 검증자가 없는 stale 항목은 miss 처럼 서버에서 받음
+      return rc;
   }
 
-  if (object_len <= MAX_OBJECT_SIZE)
-    cache_insert(uri, object_buf, object_len);
-    
-  Close(serverfd);
-}
+  if ((lo = large_find(uri, &stale)) != NULL)
+  {
+    rc = -1;
+    if (stale && time(NULL) < atomic_load(&lo->expires) + stale_grace)
+      refresh_schedule(hostname, port, &request, uri, lo->hdr, lo->hdr_len);
+    else if (stale && head)
+      rc = -2;
+    else if (stale)
+      rc = revalidate(fd, hostname, port, &request, uri, lo->hdr, lo->hdr_len, atomic_load(&lo->expires), range, http11, keep_alive, &expires);
+    if (rc == -1)
+    {
+      if (expires)
+        large_refresh(lo, expires);
+      // 남아 있는 조각을 보내다가 축출된 조각을 만나면 그 뒤는 서버에서 받아 채움
+      if ((rc = send_cached_headers(fd, client_hdrs, client_hdrs_len, lo->hdr, lo->hdr_len, head, keep_alive)) < 0 &&
+          (rc = send_large(fd, lo, keep_alive, range, &sent, &stop)) < 0)
+        rc = large_refetch(fd, hostname, port, &request, lo, sent, stop, keep_alive);
+    }
+    large_release(lo);
+    if (rc != -2)
+      return rc;
+  }
 
-/// @brief 클라이언트 요청을 읽어 서버로 보낼 HTTP 요청 메시지 생성
-/// @param http_request 새로 만들 HTTP 요청 메시지 저장할 버퍼
-/// @param hostname 요청할 서버의 호스트 이름
-/// @param path 요청할 리소스 경로
-/// @param client_rio 클라이언트 연결의 RIO 
-void build_http_request(char *http_request, char *hostname, char *path, rio_t *client_rio)
-{
-  char buf[MAXLINE]; // 클라이언트 요청 헤더 한 줄을 읽어 저장할 버퍼
+  if (head) // HEAD miss 는 캐시를 채우지 않고 서버에 HEAD 로 전달
+  {
+    request.iov[0] = (struct iovec){ "HEAD", 4 };
+    return fetch_origin(fd, hostname, port, &request, uri, NULL, "", http11, keep_alive, NULL);
+  }
 
-  sprintf(http_request, "GET %s HTTP/1.0\r\n", path);                     // 요청 라인 생성 -> 명시적으로 1.1에서 1.0으로 변환 
-  // 필수 헤더 4개 명시적으로 포함
-  sprintf(http_request + strlen(http_request), "Host: %s\r\n", hostname); // 필수 Host 헤더 추가
-  sprintf(http_request + strlen(http_request), "%s", user_agent_hdr);     // user_agent_hdr 헤더 추가
-  sprintf(http_request + strlen(http_request), "Connection: close\r\n");  // Connection
-  sprintf(http_request + strlen(http_request), "Proxy-Connection: close\r\n"); // Proxy-connection 
+  if (*range && !range_fill) // 캐시를 채우지 않고 요청한 구간만 서버에서 받아 전달
+    return fetch_range(fd, hostname, port, &request, uri, range, http11, keep_alive);
 
-  // 클라이언트가 보낸 나머지 헤더들을 한 줄씩 읽기
-  while (Rio_readlineb(client_rio, buf, MAXLINE) > 0)
+  // 같은 URI를 이미 다른 요청이 서버에서 가져오는 중이면 리더가 받는 응답을 따라 읽음
+  //   Range 요청은 따라 읽지 않음 (구간 앞의 본문을 모두 기다려야 하므로) -> 요청한 구간만 서버에서 받음
+  //   최근 저장할 수 없던 URI (hit-for-pass) 는 리더를 기다리지 않고 바로 서버로
+  if ((f = inflight_join(uri, !*range, &leader)) == NULL)
   {
-    // 빈 줄이면 반복 종료
-    if (strcmp(buf, "\r\n") == 0)
-      break;
-    
-    // 이미 넣은 헤더들은 건너뜀 -> 클라이언트가 보낸 나머지 헤더는 그대로 전달
-        if (!strncasecmp(buf, "Host:", 5) ||
-            !strncasecmp(buf, "User-Agent:", 11) ||
-            !strncasecmp(buf, "Connection:", 11) ||
-            !strncasecmp(buf, "Proxy-Connection:", 17))
-            continue;
-        
-        // 나머지 헤더는 그대로 요청 메세지에 추가
-        strcat(http_request, buf);
+    if (*range)
+      return fetch_range(fd, hostname, port, &request, uri, range, http11, keep_alive);
+    return fetch_origin(fd, hostname, port, &request, uri, NULL, range, http11, keep_alive, NULL);
   }
-  
-  // 끝을 알리기 위해 빈 줄 추가
-  strcat(http_request, "\r\n");
+  if (!leader)
+  {
+    rc = inflight_stream(fd, f, http11, keep_alive);
+    inflight_release(f);
+    if (rc >= 0)
+      return rc;
+    // 리더가 헤더도 받기 전에 실패 -> 직접 가져옴
+    return fetch_origin(fd, hostname, port, &request, uri, NULL, range, http11, keep_alive, NULL);
+  }
+
+  rc = fetch_origin(fd, hostname, port, &request, uri, f, range, http11, keep_alive, NULL);
+  inflight_finish(f); // 실패했더라도 팔로워들을 깨워 끝냄
+  inflight_release(f);
+  return rc;
 }
 
-/// @brief URI 문자열 파싱하여 정보를 분리하는 함수
-/// @param uri 파싱할 uri 문자열
-/// @param hostname 파싱된 호스트명 저장 버퍼
-/// @param path 파싱된 경로 저장 버퍼
-/// @param port 파싱된 포트 저장 버퍼
-/// @return 성공 시 0, 실패 시 -1
-int parse_uri(const char *uri, char *hostname, char *path, char *port)
+/// @brief 서버 연결을 얻어 요청을 보내고 응답을 클라이언트로 중계
+/// @param fd 클라이언트 소켓
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param request 서버로 보낼 요청 메시지 (보내도 바뀌지 않음 -> 다시 시도할 때 그대로 씀)
+/// @param uri 캐시 키
+/// @param f 받는 응답을 팔로워에게 나눠 줄 진행 중 항목 (리더가 아니면 NULL)
+/// @param range 클라이언트 Range 헤더 값 -> 전체 응답 중 이 구간만 클라이언트에 보냄 (없으면 빈 문자열)
+/// @param http11 클라이언트가 HTTP/1.1 이면 1
+/// @param keep_alive 클라이언트가 연결 유지를 원하면 1
+/// @param rv stale 항목을 재검증하는 요청이면 결과를 남길 곳 (아니면 NULL)
+/// @return 클라이언트 연결을 유지할 수 있으면 1, 닫아야 하면 0 (304 면 클라이언트에 아무것도 보내지 않고 1)
+int fetch_origin(int fd, char *hostname, char *port, upstream_request *request, char *uri, inflight_t *f, char *range, int http11, int keep_alive, revalidation *rv)
 {
-    char uri_copy[MAXLINE];
-    strcpy(uri_copy, uri);
-
-    if (strncasecmp(uri_copy, "http://", 7) != 0)
-        return -1;
+  char buf[MAXLINE];
+  int serverfd, rc, reused, reusable;
 
-    char *hostbegin = uri_copy + 7;
-    char *pathbegin = strchr(hostbegin, '/');
-    char *portbegin = strchr(hostbegin, ':');
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    int keep_client = keep_alive;
 
-    if (pathbegin) 
-    {
-        strcpy(path, pathbegin);
-        *pathbegin = '\0';
-    } 
-    else 
+    if ((serverfd = upstream_acquire(hostname, port, &reused)) < 0) // 유휴 연결 재사용 또는 새 연결
     {
-        strcpy(path, "/");
+      if (rv && rv->fallback) // 저장된 본문으로 대신함
+      {
+        rv->failed = 1;
+        return keep_alive;
+      }
+      sprintf(buf, "Connection failed to %s:%s\r\n", hostname, port);
+      rio_writen(fd, buf, strlen(buf));
+      return 0;
     }
 
-    
-    if (portbegin) 
-    {
-        *portbegin = '\0';
-        strcpy(hostname, hostbegin);
-        strcpy(port, portbegin + 1);
-    } 
-    else 
-    {
-        strcpy(hostname, hostbegin);
-        strcpy(port, "80");
-    }
+    rc = relay_response(fd, serverfd, request, uri, f, range, http11, &keep_client, &reusable, rv);
+    if (rc == 0 && reusable)
+      upstream_release(hostname, port, serverfd); // 다음 요청을 위해 풀에 반납
+    else
+      Close(serverfd);
 
-    return 0;
-}
+    if (rc == 0)
+      return keep_client;
+    if (rc == -3) // 캐시에 넣지 못할 객체의 Range 요청 -> 본문은 읽지 않았으므로 Range 를 붙여 다시 요청
+      return fetch_range(fd, hostname, port, request, uri, range, http11, keep_alive);
 
-/// @brief 클라이언트 연결을 처리하는 스레드 함수
-/// @param vargp 파일 디스크립터 주소 
-/// @return NULL
-void *thread(void *vargp)
-{
-  int connfd = *((int *)vargp); // 인자로 받은 void*를 int*로 캐시팅 후 역참조하여 실제 connfd 값
-  // Pthread_detach() : 종료 시 자동으로 자원 해제
-  // pthread_self() : 현재 스레드 ID 반환
-  Pthread_detach(pthread_self()); // 현재 쓰레드를 종료시 자동 자원 해제 
-  Free(vargp); // 동적 할당된 connfd 포인터 메모리 해제
-  proxy(connfd); // 클라이언터 연결
-  Close(connfd); // 클라이언트와 연결된 소켓 닫기
-  return NULL;
+    // 재사용한 연결이 이미 서버 쪽에서 닫혀 있었다면 새 연결로 한 번만 다시 시도
+    if (rc != -1 || !reused)
+      break;
+  }
+  if (rc == -1 && rv && rv->fallback) // 클라이언트에 아무것도 보내지 않았으므로 저장된 본문으로 대신함
+  {
+    rv->failed = 1;
+    return keep_alive;
+  }
+  return 0;
 }
 
-/// @brief 캐시 초기화 함수
-void cache_init() 
+/// @brief 클라이언트 Range 헤더를 붙여 서버에 요청 -> 요청한 구간만 받아 그대로 전달 (206 은 캐시하지 않음)
+///        Range 를 모르는 서버가 200 으로 전체를 보내면 relay_response 가 구간만 잘라 보냄
+/// @param fd 클라이언트 소켓
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param request Range 를 뺀 요청 메시지
+/// @param uri 캐시 키
+/// @param range 클라이언트 Range 헤더 값
+/// @param http11 클라이언트가 HTTP/1.1 이면 1
+/// @param keep_alive 클라이언트가 연결 유지를 원하면 1
+/// @return 클라이언트 연결을 유지할 수 있으면 1, 닫아야 하면 0
+int fetch_range(int fd, char *hostname, char *port, upstream_request *request, char *uri, char *range, int http11, int keep_alive)
 {
-  cache.total_size = 0; // 전채 캐시 크기 0
-  pthread_rwlock_init(&cache.lock, NULL); // 읽기 쓰기 락 초기화
+  char range_hdr[MAXLINE + 16];
+  upstream_request ranged = *request; // 조각 목록만 복사 -> 헤더 줄들은 그대로 가리킴
 
-  for (int i = 0; i < MAX_CACHE_BLOCK; i++) //각 캐시 블록 초기화
-    cache.blocks[i].used = 0;
+  snprintf(range_hdr, sizeof(range_hdr), "Range: %s\r\n", range);
+  request_add_header(&ranged, range_hdr);
+  return fetch_origin(fd, hostname, port, &ranged, uri, NULL, range, http11, keep_alive, NULL);
 }
 
-/// @brief 캐시에 해당 URI 존재하는지 확인
-/// @param uri 요청된 URI
-/// @param buf 캐시된 객체 데이터 복사할 버퍼
-/// @param size 복사된 객체으 크기 저장 변수
-/// @return hit 0, miss -1
-int cache_find(char *uri, char *buf, size_t *size)
+/// @brief stale 항목의 검증자로 조건부 요청을 보내 저장된 본문을 계속 쓸 수 있는지 서버에 확인
+///        -> 바뀌었으면 서버의 새 응답을 그대로 클라이언트에 중계하고 캐시도 교체
+/// @param fd 클라이언트 소켓
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param request 서버로 보낼 요청 메시지
+/// @param uri 캐시 키
+/// @param hdr stale 항목의 저장된 응답 헤더
+/// @param hdr_len 헤더 길이
+/// @param stale_since stale 항목의 신선도가 끝난 시각 (stale-if-error 유예 기준)
+/// @param range 클라이언트 Range 헤더 값 (없으면 빈 문자열)
+/// @param http11 클라이언트가 HTTP/1.1 이면 1
+/// @param keep_alive 클라이언트가 연결 유지를 원하면 1
+/// @param expires 304 이면 새 신선도 끝 (저장하면 안 되거나 stale 본문으로 대신하면 0)
+/// @return 304 또는 stale-if-error 면 -1 (호출자가 저장된 본문을 보냄), 재검증할 수 없으면 -2 (일반 miss 로 처리),
+///         새 응답을 중계했으면 클라이언트 연결을 유지할 수 있을 때 1, 닫아야 하면 0
+int revalidate(int fd, char *hostname, char *port, upstream_request *request, char *uri, char *hdr, size_t hdr_len,
+               time_t stale_since, char *range, int http11, int keep_alive, time_t *expires)
 {
-  int found = -1; 
-  pthread_rwlock_rdlock(&cache.lock); // 읽기 락 획득 -> 여러 스레드가 동시에 캐시를 읽을 수 있도록 허용
-  
-  // 캐시 블록들을 순회하면서 URI가 일치하는 항목 탐색
-  for (int i = 0; i < MAX_CACHE_BLOCK; i++)
-  {
-    // 해당 블록이 사용중이며 URI가 일치하는 경우
-    if (cache.blocks[i].used && strcmp(cache.blocks[i].uri, uri) == 0)
-    {
-      // 캐시된 데이터를 요청한 버퍼로 복사
-      memcpy(buf, cache.blocks[i].buf, cache.blocks[i].size);
-      // 해당 개게의 크기를 반환할 포인터에 저장
-      *size = cache.blocks[i].size;
-      // LRU 갱신 -> 해당 블록이 최근에 사용되었음을 기록
-      cache_update_lru(i);
-      found = 0; // hit
-      break;
-    }
-  }
-
-  pthread_rwlock_unlock(&cache.lock); // -> 읽기 락 해제
-  return found; // hit 0, miss -1
-}
+  char http_request[MAXLINE], conditional[2 * MAXLINE];
+  upstream_request wrapped;
+  revalidation rv = { hdr, hdr_len, 0, 0, time(NULL) < stale_since + stale_if_error, 0 };
+  int rc;
 
-/// @brief LRU 정책을 기반으로 캐시 블록의 사용 순서 갱신
-/// @param index 최근에 접근한 캐시 블록의 인덱스
-void cache_update_lru(int index)
-{
-  // 현재 접근한 블록의 기존 LRU 값 저장
-  int old = cache.blocks[index].lru;
+  *expires = 0;
+  // 검증자 헤더를 덧붙일 틀 -> 여기서만 한 덩어리로 복사
+  request_flatten(request, http_request, sizeof(http_request));
+  // 클라이언트 자신의 조건부 요청은 서버에 그대로 전달 (검증자가 섞이지 않도록)
+  if (strcasestr(http_request, "\r\nIf-"))
+    return -2;
+  if (conditional_request(conditional, http_request, hdr, hdr_len) == 0)
+    atomic_fetch_add(&admission.revalidations, 1);
+  else if (rv.fallback)
+    strcpy(conditional, http_request); // 검증자가 없어도 서버가 실패하면 stale 본문으로 대신할 수 있도록 여기서 받음
+  else
+    return -2;
 
-  // 모든 캐시 블록을 순회
-  for (int i = 0; i < MAX_CACHE_BLOCK; i++)
+  request_wrap(&wrapped, conditional);
+  rc = fetch_origin(fd, hostname, port, &wrapped, uri, NULL, range, http11, keep_alive, &rv);
+  if (rv.failed)
   {
-    // 사용 중인 블록 중에서 접근한 블록보다 이전에 사용된 블록 (LRU 값이 더 작은 경우)
-    if (cache.blocks[i].used && cache.blocks[i].lru < old)
-      cache.blocks[i].lru++; // 이 블록의 LRU값을 증가시켜 덜 최근에 사용 되었음을 표시
+    atomic_fetch_add(&refresh.on_error, 1);
+    return -1;
   }
-  
-  // 접근한 블록의 LRU 값을 0으로 설정 -> 가장 최근에 사용된 블록
-  cache.blocks[index].lru = 0;
+  if (!rv.not_modified)
+    return rc;
+  atomic_fetch_add(&admission.not_modified, 1);
+  *expires = rv.expires;
+  return -1;
 }
 
-/// @brief 새로운 데이터를 캐시에 삽입
-/// @param uri 요청된 객체의 URI
-/// @param buf 객체 버퍼
-/// @param size 객체 데이터 크기
-void cache_insert(char *uri, char *buf, size_t size)
+/// @brief 백그라운드 재검증 작업 하나 실행 -> 응답은 클라이언트 대신 /dev/null 로 중계
+///        304 면 항목의 신선도를 갱신하고, 새 응답이면 relay_response 가 캐시를 교체
+/// @param j 실행할 작업
+static void refresh_run(refresh_job *j)
 {
-  // 객체 크기가 너무 크면 리턴 -> 예외처리
-  if (size > MAX_OBJECT_SIZE)
-    return;
-  
-  // 쓰기 락 획득 (다른 쓰기 / 읽기 차단)
-  pthread_rwlock_wrlock(&cache.lock);
+  revalidation rv = { j->hdr, j->hdr_len, 0, 0, 1, 0 }; // 실패는 알릴 클라이언트가 없음 -> stale 항목 유지
+  upstream_request request;
+  cache_block *b;
+  large_object *lo;
+  int stale;
 
-  int evict_index = -1; // 데이터를 삽입할 블록의 인덱스
-  int max_lru = -1; // 가장 오래된 블록을 찾기 위한 변수
-
-  // 캐시 블록 순회
-  for (int i = 0; i < MAX_CACHE_BLOCK; i++)
+  request_wrap(&request, j->request);
+  fetch_origin(refresh.devnull, j->hostname, j->port, &request, j->uri, NULL, "", 1, 1, &rv);
+  if (!rv.not_modified)
+    return;
+  atomic_fetch_add(&admission.not_modified, 1);
+  if (rv.expires == 0)
+    return;
+  if ((b = cache_find(j->uri, &stale)) != NULL)
   {
-    // 캐시 블록 중 사용되지 않은 블록을 찾기
-    if (!cache.blocks[i].used)
-    {
-      evict_index = i;
-      break;
-    }
-
-    // 사용 중인 블록 중 가장 오래된 블록 찾기 (LRU 값이 가장 큰 값)
-    if (cache.blocks[i].lru > max_lru)
-    {
-      max_lru = cache.blocks[i].lru;
-      evict_index = i;
-    }
+    cache_refresh(b, rv.expires);
+    cache_release(b);
   }
-
-  // 삽입할 블록을 찾지 못하면
-  if (evict_index == -1)
+  else if ((lo = large_find(j->uri, &stale)) != NULL)
   {
-    pthread_rwlock_unlock(&cache.lock); // 락 풀고 종료
-    return;
+    large_refresh(lo, rv.expires);
+    large_release(lo);
   }
+}
 
-  // 기존 사용 중인 블록이라면, 총 캐시 크기에서 제거
-  if (cache.blocks[evict_index].used)
-    cache.total_size -= cache.blocks[evict_index].size;
-
-  // 선택된 블록에 새 데이터 저장
-  cache.blocks[evict_index].used = 1;
-  strcpy(cache.blocks[evict_index].uri, uri);       // URI 저장
-  memcpy(cache.blocks[evict_index].buf, buf, size); // 데이터 복사
-  cache.blocks[evict_index].size = size;            // 크기 저장
-  cache_update_lru(evict_index);                    // LRU 갱신
-  cache.total_size += size;                         // 총 캐시 크기 증가
+/// @brief 백그라운드 재검증 쓰레드 -> 대기열의 작업을 하나씩 꺼내 실행
+static void *refresher(void *vargp)
+{
+  Pthread_detach(pthread_self());
 
-  // 총 캐시 크기가 허용 크기를 넘으면 오래된 블록부터 제거
-  while (cache.total_size > MAX_CACHE_SIZE)
+  while (1)
   {
-    int del_index = -1;
-    int max_lru = -1;
+    refresh_job *j, **pp;
 
-    // 가장 오래된 블록 찾기
-    for (int i = 0; i < MAX_CACHE_BLOCK; i++)
-    {
-      if (cache.blocks[i].used && cache.blocks[i].lru > max_lru)
+    pthread_mutex_lock(&refresh.lock);
+    while (refresh.head == NULL)
+      pthread_cond_wait(&refresh.cond, &refresh.lock);
+    j = refresh.head;
+    if ((refresh.head = j->next) == NULL)
+      refresh.tail = NULL;
+    pthread_mutex_unlock(&refresh.lock);
+
+    refresh_run(j);
+
+    // 끝난 뒤에야 테이블에서 뺌 -> 진행 중에 들어온 같은 URI 의 stale hit 은 새 작업을 만들지 않음
+    pthread_mutex_lock(&refresh.lock);
+    for (pp = &refresh.table[cache_hash(j->uri) % REFRESH_HASH_SIZE]; *pp != j; pp = &(*pp)->hnext)
+      ;
+    *pp = j->hnext;
+    pthread_mutex_unlock(&refresh.lock);
+
+    free(j->uri);
+    free(j->hostname);
+    free(j->port);
+    Free(j->request);
+    Free(j->hdr);
+    Free(j);
+  }
+  return NULL;
+}
+
+/// @brief stale-while-revalidate 용 백그라운드 재검증 쓰레드 시작
+void refresh_init(void)
+{
+  pthread_t tid;
+
+  refresh.devnull = Open("/dev/null", O_WRONLY, 0);
+  for (int i = 0; i < REFRESH_THREADS; i++)
+    Pthread_create(&tid, NULL, refresher, NULL);
+}
+
+/// @brief stale 항목의 백그라운드 재검증 예약 -> 같은 URI 의 작업이 대기 / 진행 중이면 합침
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param request 서버로 보낼 요청 메시지
+/// @param uri 캐시 키
+/// @param hdr stale 항목의 저장된 응답 헤더
+/// @param hdr_len 헤더 길이
+void refresh_schedule(char *hostname, char *port, upstream_request *request, char *uri, char *hdr, size_t hdr_len)
+{
+  unsigned int h = cache_hash(uri) % REFRESH_HASH_SIZE;
+  char http_request[MAXLINE];
+  refresh_job *j;
+
+  atomic_fetch_add(&refresh.served, 1);
+  request_flatten(request, http_request, sizeof(http_request)); // 작업이 클라이언트 버퍼보다 오래 살므로 복사
+  if (strcasestr(http_request, "\r\nIf-")) // 클라이언트의 검증자가 섞인 요청으로는 재검증하지 않음
+    return;
+
+  pthread_mutex_lock(&refresh.lock);
+  for (j = refresh.table[h]; j; j = j->hnext)
+    if (!strcmp(j->uri, uri))
+      break;
+  if (j)
+  {
+    pthread_mutex_unlock(&refresh.lock);
+    atomic_fetch_add(&refresh.deduped, 1);
+    return;
+  }
+
+  j = Calloc(1, sizeof(refresh_job));
+  j->uri = strdup(uri);
+  j->hostname = strdup(hostname);
+  j->port = strdup(port);
+  j->request = Malloc(2 * MAXLINE);
+  if (conditional_request(j->request, http_request, hdr, hdr_len) == 0)
+    atomic_fetch_add(&admission.revalidations, 1);
+  else
+    strcpy(j->request, http_request); // 검증자가 없으면 전체를 다시 받아 교체
+  j->hdr = Malloc(hdr_len + 1);
+  memcpy(j->hdr, hdr, hdr_len);
+  j->hdr_len = hdr_len;
+
+  j->hnext = refresh.table[h];
+  refresh.table[h] = j;
+  if (refresh.tail)
+    refresh.tail->next = j;
+  else
+    refresh.head = j;
+  refresh.tail = j;
+  pthread_cond_signal(&refresh.cond);
+  pthread_mutex_unlock(&refresh.lock);
+  atomic_fetch_add(&refresh.scheduled, 1);
+}
+
+/// @brief 캐시된 응답을 클라이언트로 전송 -> 저장된 헤더 끝에 연결 유지 여부만 붙임
+///        Range 요청이면 저장된 전체 응답에서 해당 구간만 206 으로
+/// @param fd 클라이언트 소켓
+/// @param buf 저장된 응답 (메모리 캐시 블록 또는 디스크 세그먼트 매핑)
+/// @param size 응답 길이
+/// @param hdr_len 본문 시작 위치, 모르면 0
+/// @param keep_alive 클라이언트 연결을 유지하려면 1
+/// @param range 클라이언트 Range 헤더 값 (없으면 빈 문자열)
+/// @return 연결을 유지할 수 있으면 1, 닫아야 하면 0
+int send_cached(int fd, char *buf, size_t size, size_t hdr_len, int keep_alive, char *range)
+{
+  char *conn_hdr = keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+  size_t start, stop, total = size - hdr_len;
+  int ranged;
+
+  if (hdr_len < 2) // 헤더 경계를 모르는 객체는 그대로 보내고 닫음
+  {
+    rio_writen(fd, buf, size);
+    return 0;
+  }
+
+  if (*range && response_status(buf) == 200 && (ranged = parse_range(range, total, &start, &stop)) >= 0)
+  {
+    if (send_range_headers(fd, buf, hdr_len - 2, ranged, start, stop, total, conn_hdr, buf + hdr_len) < 0)
+      return 0;
+    return keep_alive;
+  }
+
+  // 헤더 (마지막 빈 줄 제외) -> Connection 헤더와 빈 줄 -> 본문을 한 번의 writev 로
+  struct iovec iov[3] = {
+    { buf, hdr_len - 2 },
+    { conn_hdr, strlen(conn_hdr) },
+    { buf + hdr_len, size - hdr_len },
+  };
+  if (rio_writev(fd, iov, 3) < 0)
+    return 0;
+  return keep_alive;
+}
+
+/// @brief 해석한 클라이언트 요청으로 서버에 보낼 HTTP 요청 메시지 생성 -> 전달할 헤더 줄은 복사하지 않고 받은 버퍼를 가리킴
+///        (conn_dispatch 와 같은 방식, 조각들은 클라이언트 rio 버퍼를 다시 읽기 전까지만 유효)
+/// @param out 만든 요청 메시지의 조각 목록
+/// @param http_request 요청 라인 (메서드 뒤) 과 필수 헤더를 쓸 버퍼 (MAXLINE)
+/// @param hostname 요청할 서버의 호스트 이름
+/// @param path 요청할 리소스 경로
+/// @param req 클라이언트 요청 메시지 버퍼
+/// @param r 해석한 클라이언트 요청
+/// @param keep_alive 클라이언트의 Connection / Proxy-Connection 헤더에 따라 연결 유지 여부 갱신
+/// @param range 클라이언트 Range 헤더 값 (서버로는 보내지 않음, If-Range 가 있거나 없으면 빈 문자열)
+void build_http_request(upstream_request *out, char *http_request, char *hostname, char *path, char *req, http_request_view *r, int *keep_alive, char *range)
+{
+  size_t len;
+  int if_range = 0;
+
+  range[0] = '\0';
+
+  // 요청 라인과 필수 헤더 -> 서버와는 HTTP/1.1 persistent 연결 (응답 후에도 연결 유지 -> 연결 풀에서 재사용)
+  //   메서드는 따로 둠 -> HEAD 로 보낼 때 첫 조각만 바꿈
+  len = snprintf(http_request, MAXLINE, " %s HTTP/1.1\r\nHost: %s\r\n%sConnection: keep-alive\r\n",
+                 path, hostname, user_agent_hdr);
+  if (len > MAXLINE - 6) // 메서드와 빈 줄을 붙여도 MAXLINE 안 -> request_flatten 이 한 덩어리로 복사할 수 있게
+    len = MAXLINE - 6;
+  out->iov[0] = (struct iovec){ "GET", 3 };
+  out->iov[1] = (struct iovec){ http_request, len };
+  out->iovcnt = 2;
+
+  for (int i = 0; i < r->nheaders; i++)
+  {
+    http_header *h = &r->headers[i];
+
+    // 클라이언트와의 연결 유지 여부는 Connection / Proxy-Connection 헤더로 결정
+    if (span_is(req, h->name, "Connection") || span_is(req, h->name, "Proxy-Connection"))
+    {
+      if (span_has(req, h->value, "close"))
+        *keep_alive = 0;
+      else if (span_has(req, h->value, "keep-alive"))
+        *keep_alive = 1;
+    }
+
+    // 구간 요청은 프록시가 캐시에서 처리 -> 서버에는 전체 객체를 요청
+    if (span_is(req, h->name, "Range"))
+    {
+      size_t n = 0;
+      while (n < h->value.len && req[h->value.off + n] != ' ' && req[h->value.off + n] != '\t')
+        n++;
+      memcpy(range, req + h->value.off, n);
+      range[n] = '\0';
+      continue;
+    }
+    if (span_is(req, h->name, "If-Range")) // 검증자를 비교할 수 없으므로 Range 를 무시하고 전체 응답
+    {
+      if_range = 1;
+      continue;
+    }
+
+    // 이미 넣은 헤더들은 건너뜀 -> 클라이언트가 보낸 나머지 헤더는 줄 그대로 전달
+    if (!skip_request_header(req + h->line.off))
+      out->iov[out->iovcnt++] = (struct iovec){ req + h->line.off, h->line.len };
+  }
+
+  // 끝을 알리기 위해 빈 줄 추가
+  out->iov[out->iovcnt++] = (struct iovec){ "\r\n", 2 };
+  if (if_range)
+    range[0] = '\0';
+}
+
+/// @brief 한 덩어리로 된 요청 메시지를 조각 목록으로 감쌈 (마지막 빈 줄은 따로 -> 헤더를 덧붙일 수 있게)
+/// @param out 조각 목록
+/// @param request 빈 줄로 끝나는 요청 메시지 (out 을 쓰는 동안 살아 있어야 함)
+void request_wrap(upstream_request *out, char *request)
+{
+  out->iov[0] = (struct iovec){ request, strlen(request) - 2 };
+  out->iov[1] = (struct iovec){ "\r\n", 2 };
+  out->iovcnt = 2;
+}
+
+/// @brief 조각 목록을 한 덩어리의 요청 메시지로 복사 -> 검증자나 Range 를 덧붙일 틀이 필요한 경로에서만
+///        버퍼에 다 들어가지 않는 헤더 줄은 뺌
+/// @param r 조각 목록 (마지막 조각은 빈 줄)
+/// @param dst 복사할 버퍼
+/// @param size 버퍼 크기
+/// @return 복사한 길이
+size_t request_flatten(upstream_request *r, char *dst, size_t size)
+{
+  size_t len = 0;
+
+  for (int i = 0; i < r->iovcnt - 1; i++)
+  {
+    if (len + r->iov[i].iov_len + 3 > size)
+      continue;
+    memcpy(dst + len, r->iov[i].iov_base, r->iov[i].iov_len);
+    len += r->iov[i].iov_len;
+  }
+  memcpy(dst + len, "\r\n", 3);
+  return len + 2;
+}
+
+/// @brief 요청 메시지의 마지막 빈 줄 앞에 헤더 한 줄을 끼워 넣음 (조각 목록만 고침)
+/// @param r 조각 목록
+/// @param line CRLF 로 끝나는 헤더 한 줄 (r 을 쓰는 동안 살아 있어야 함)
+void request_add_header(upstream_request *r, char *line)
+{
+  r->iov[r->iovcnt] = r->iov[r->iovcnt - 1];
+  r->iov[r->iovcnt - 1] = (struct iovec){ line, strlen(line) };
+  r->iovcnt++;
+}
+
+/// @brief 요청 메시지에 헤더가 있는지 확인
+/// @param r 조각 목록
+/// @param name 콜론까지 포함한 헤더 이름 (예: "Range:")
+/// @return 있으면 1
+int request_has(upstream_request *r, char *name)
+{
+  char value[MAXLINE];
+
+  for (int i = 0; i < r->iovcnt; i++)
+    if (header_value(r->iov[i].iov_base, r->iov[i].iov_len, name, value))
+      return 1;
+  return 0;
+}
+
+/// @brief 요청 해석 상태 초기화
+/// @param r 해석 상태
+void request_view_init(http_request_view *r)
+{
+  r->pos = r->len = r->hdr_off = 0;
+  r->nheaders = 0;
+}
+
+/// @brief 받은 요청 헤더를 이어서 해석 -> 지난번에 멈춘 줄부터 새로 도착한 바이트만 훑음 (복사, 할당 없음)
+///        줄 끝은 CRLF 또는 LF, 요청 라인 앞의 빈 줄은 무시
+/// @param r 해석 상태 (처음에는 request_view_init, 구간은 buf 기준 위치)
+/// @param buf 요청 메시지 버퍼
+/// @param len 지금까지 받은 바이트 수
+/// @return 빈 줄까지 다 왔으면 1 (r->len), 더 받아야 하면 0, 요청이 아니거나 헤더가 너무 많으면 -1
+int request_parse(http_request_view *r, const char *buf, size_t len)
+{
+  const char *eol;
+
+  while (r->pos < len && (eol = memchr(buf + r->pos, '\n', len - r->pos)) != NULL)
+  {
+    size_t start = r->pos, stop = eol - buf;
+    const char *sp1, *sp2, *colon, *v, *e;
+    http_header *h;
+
+    if (stop > start && buf[stop - 1] == '\r')
+      stop--;
+    r->pos = eol - buf + 1;
+
+    if (r->hdr_off == 0) // 요청 라인 -> "메소드 URI 버전"
+    {
+      if (stop == start)
+        continue;
+      if ((sp1 = memchr(buf + start, ' ', stop - start)) == NULL ||
+          (sp2 = memchr(sp1 + 1, ' ', buf + stop - sp1 - 1)) == NULL)
+        return -1;
+      r->method = (http_span){ start, sp1 - buf - start };
+      r->uri = (http_span){ sp1 + 1 - buf, sp2 - sp1 - 1 };
+      r->version = (http_span){ sp2 + 1 - buf, buf + stop - sp2 - 1 };
+      if (!r->method.len || !r->uri.len || !r->version.len)
+        return -1;
+      r->hdr_off = r->pos;
+      continue;
+    }
+
+    if (stop == start) // 빈 줄 -> 헤더 끝
+    {
+      r->len = r->pos;
+      return 1;
+    }
+    if (r->nheaders == REQUEST_MAX_HEADERS)
+      return -1;
+
+    // 이름은 콜론 앞까지, 값은 앞뒤 공백을 뺀 나머지
+    h = &r->headers[r->nheaders++];
+    h->line = (http_span){ start, r->pos - start };
+    colon = memchr(buf + start, ':', stop - start);
+    v = colon ? colon + 1 : buf + stop;
+    e = buf + stop;
+    while (v < e && (*v == ' ' || *v == '\t'))
+      v++;
+    while (e > v && (e[-1] == ' ' || e[-1] == '\t'))
+      e--;
+    h->name = (http_span){ start, (colon ? colon : buf + stop) - buf - start };
+    h->value = (http_span){ v - buf, e - v };
+  }
+  return 0;
+}
+
+/// @brief 구간이 주어진 문자열과 같은지 확인 (대소문자 무시)
+/// @param buf 구간이 가리키는 버퍼
+/// @param s 구간
+/// @param str 비교할 문자열
+/// @return 같으면 1
+int span_is(const char *buf, http_span s, const char *str)
+{
+  return s.len == strlen(str) && !strncasecmp(buf + s.off, str, s.len);
+}
+
+/// @brief 구간 안에 토큰이 있는지 확인 (대소문자 무시) -> strcasestr 과 달리 구간 밖은 보지 않음
+/// @param buf 구간이 가리키는 버퍼
+/// @param s 구간
+/// @param token 찾을 토큰
+/// @return 있으면 1
+int span_has(const char *buf, http_span s, const char *token)
+{
+  size_t n = strlen(token);
+
+  for (size_t i = 0; i + n <= s.len; i++)
+    if (!strncasecmp(buf + s.off + i, token, n))
+      return 1;
+  return 0;
+}
+
+/// @brief 구간을 제자리에서 NUL 로 끝나는 문자열로 만듦 -> 뒤따르는 구분자 (공백, CR, LF) 자리를 덮어씀
+/// @param buf 구간이 가리키는 버퍼
+/// @param s 요청 라인의 구간 (헤더 구간에는 쓰지 않음)
+/// @return 구간의 시작
+char *span_cstr(char *buf, http_span s)
+{
+  buf[s.off + s.len] = '\0';
+  return buf + s.off;
+}
+
+/// @brief 이름이 같은 첫 요청 헤더 찾기
+/// @param r 해석한 요청
+/// @param buf 요청 메시지 버퍼
+/// @param name 콜론을 뺀 헤더 이름 (예: "Range")
+/// @return 찾은 헤더, 없으면 NULL
+http_header *request_header(http_request_view *r, const char *buf, const char *name)
+{
+  for (int i = 0; i < r->nheaders; i++)
+    if (span_is(buf, r->headers[i].name, name))
+      return &r->headers[i];
+  return NULL;
+}
+
+/// @brief 클라이언트 요청 헤더 하나를 rio 버퍼 안에서 바로 해석 -> 헤더 전체가 버퍼에 모일 때까지 읽고, 해석한 만큼 소비
+///        구간들은 *base 기준이며 이 rio 에서 다시 읽기 전까지만 유효 (파이프라인된 다음 요청은 버퍼에 남음)
+/// @param rp 클라이언트 연결의 RIO
+/// @param r 해석 결과
+/// @param base 구간들의 기준 위치를 받을 곳
+/// @return 성공 1, EOF / 시간 초과 0, 요청이 아니거나 헤더가 버퍼 (RIO_BUFSIZE) 보다 크면 -1
+int request_read(rio_t *rp, http_request_view *r, char **base)
+{
+  int rc;
+
+  request_view_init(r);
+  while ((rc = request_parse(r, rp->rio_bufptr, rp->rio_cnt)) == 0)
+  {
+    if (rp->rio_cnt == RIO_BUFSIZE)
+      return -1;
+    if (rio_fillb(rp) <= 0) // 남은 바이트를 앞으로 당기고 뒤에 이어 읽음 -> 구간 위치는 bufptr 기준이라 그대로
+      return 0;
+  }
+  if (rc < 0)
+    return -1;
+
+  *base = rp->rio_bufptr;
+  rp->rio_bufptr += r->len;
+  rp->rio_cnt -= r->len;
+  return 1;
+}
+
+/// @brief 요청 메시지의 마지막 빈 줄 앞에 헤더 한 줄을 끼워 넣음
+/// @param dst 새 요청 메시지를 쓸 버퍼 (2 * MAXLINE)
+/// @param request 빈 줄로 끝나는 요청 메시지
+/// @param line CRLF 로 끝나는 헤더 한 줄
+void add_request_header(char *dst, char *request, char *line)
+{
+  size_t len = strlen(request) - 2;
+
+  memcpy(dst, request, len);
+  sprintf(dst + len, "%s\r\n", line);
+}
+
+/// @brief 저장된 응답의 검증자 (ETag, Last-Modified) 로 조건부 요청 메시지 생성
+/// @param dst 새 요청 메시지를 쓸 버퍼 (2 * MAXLINE)
+/// @param request 빈 줄로 끝나는 요청 메시지
+/// @param hdr 저장된 응답 헤더
+/// @param hdr_len 헤더 길이
+/// @return 성공 0, 검증자가 없으면 -1
+int conditional_request(char *dst, char *request, char *hdr, size_t hdr_len)
+{
+  char lines[MAXLINE];
+  char *line = hdr, *eol, *end = hdr + hdr_len;
+  size_t len = 0;
+
+  while (line < end)
+  {
+    size_t n;
+
+    eol = memchr(line, '\n', end - line);
+    eol = eol ? eol + 1 : end;
+    n = eol - line;
+    if (!strncasecmp(line, "ETag:", 5) && len + n + 9 < sizeof(lines))
+      len += sprintf(lines + len, "If-None-Match:%.*s", (int)(n - 5), line + 5);
+    else if (!strncasecmp(line, "Last-Modified:", 14) && len + n + 5 < sizeof(lines))
+      len += sprintf(lines + len, "If-Modified-Since:%.*s", (int)(n - 14), line + 14);
+    line = eol;
+  }
+  if (len == 0 || strlen(request) + len >= 2 * MAXLINE - 2)
+    return -1;
+  add_request_header(dst, request, lines);
+  return 0;
+}
+
+/// @brief 응답 상태 코드
+/// @param hdr 상태 줄로 시작하는 응답 헤더
+/// @return 상태 코드, 알 수 없으면 0
+int response_status(char *hdr)
+{
+  int status = 0;
+
+  sscanf(hdr, "HTTP/%*d.%*d %d", &status);
+  return status;
+}
+
+/// @brief Range 헤더 값 해석 -> 단일 구간 "bytes=a-b", "bytes=a-", "bytes=-n" 만 지원
+/// @param spec Range 헤더 값
+/// @param total 본문 전체 길이
+/// @param start 구간 시작 위치
+/// @param stop 구간 끝 위치 (미포함)
+/// @return 보낼 수 있는 구간이면 1, 범위 밖이면 0 (416), 무시하고 전체를 보내야 하면 -1
+int parse_range(char *spec, size_t total, size_t *start, size_t *stop)
+{
+  char *p, *q;
+  unsigned long long a, b;
+
+  if (strncasecmp(spec, "bytes=", 6) || strchr(spec, ',')) // 여러 구간은 전체 응답으로 대신함
+    return -1;
+  p = spec + 6;
+
+  if (*p == '-') // 끝에서 n 바이트
+  {
+    b = strtoull(p + 1, &q, 10);
+    if (q == p + 1 || *q)
+      return -1;
+    if (b == 0 || total == 0)
+      return 0;
+    *start = b < total ? total - b : 0;
+    *stop = total;
+    return 1;
+  }
+
+  a = strtoull(p, &q, 10);
+  if (q == p || *q != '-')
+    return -1;
+  p = q + 1;
+  if (*p)
+  {
+    b = strtoull(p, &q, 10);
+    if (q == p || *q || b < a)
+      return -1;
+  }
+  else
+    b = total - 1;
+
+  if (a >= total)
+    return 0;
+  *start = a;
+  *stop = b < total ? b + 1 : total;
+  return 1;
+}
+
+/// @brief 저장된 응답 헤더를 206 (범위 밖이면 416) 응답 헤더로 바꿔 전송
+///        -> 바꾼 헤더, 호출자가 준 나머지 헤더 (빈 줄 포함), 본문 구간을 한 번의 writev 로
+/// @param fd 클라이언트 소켓
+/// @param hdr 200 응답의 상태 줄 + 헤더 (빈 줄 제외)
+/// @param hdr_len 헤더 길이
+/// @param satisfiable parse_range 결과 (1 이면 206, 0 이면 416)
+/// @param start 구간 시작 위치
+/// @param stop 구간 끝 위치 (미포함)
+/// @param total 본문 전체 길이
+/// @param tail 헤더 뒤에 붙일 줄들 (Connection 헤더와 빈 줄)
+/// @param body 본문 전체 (NULL 이면 본문은 호출자가 보냄)
+/// @return 성공 0, 실패 -1
+int send_range_headers(int fd, char *hdr, size_t hdr_len, int satisfiable, size_t start, size_t stop, size_t total,
+                       char *tail, char *body)
+{
+  char *out = Malloc(hdr_len + MAXLINE);
+  char *line, *eol, *end = hdr + hdr_len;
+  size_t len;
+  int rc;
+
+  if (!satisfiable)
+    len = sprintf(out, "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */%zu\r\nContent-Length: 0\r\n", total);
+  else
+  {
+    len = sprintf(out, "HTTP/1.1 206 Partial Content\r\n");
+
+    // 상태 줄 다음부터 본문 길이 관련 헤더만 빼고 그대로 옮김
+    line = memchr(hdr, '\n', hdr_len);
+    line = line ? line + 1 : end;
+    while (line < end)
+    {
+      eol = memchr(line, '\n', end - line);
+      eol = eol ? eol + 1 : end;
+      if (strncasecmp(line, "Content-Length:", 15) && strncasecmp(line, "Content-Range:", 14))
+      {
+        memcpy(out + len, line, eol - line);
+        len += eol - line;
+      }
+      line = eol;
+    }
+    len += sprintf(out + len, "Content-Range: bytes %zu-%zu/%zu\r\nContent-Length: %zu\r\n",
+                   start, stop - 1, total, stop - start);
+  }
+
+  struct iovec iov[3] = {
+    { out, len },
+    { tail, strlen(tail) },
+    { satisfiable && body ? body + start : NULL, satisfiable && body ? stop - start : 0 }, // 416 은 start 가 정해지지 않음
+  };
+  rc = rio_writev(fd, iov, 3) < 0 ? -1 : 0;
+  Free(out);
+  return rc;
+}
+
+/// @brief 본문 조각 [pos, pos + n) 중 클라이언트에게 보낼 [start, stop) 에 속하는 부분만 전송
+/// @param fd 클라이언트 소켓
+/// @param data 본문 조각
+/// @param n 조각 길이
+/// @param pos 조각의 본문 내 위치
+/// @param start 보낼 구간 시작
+/// @param stop 보낼 구간 끝 (미포함)
+/// @return 성공 0, 실패 -1
+int write_slice(int fd, char *data, size_t n, size_t pos, size_t start, size_t stop)
+{
+  size_t from = pos < start ? start - pos : 0;
+  size_t to = pos + n <= stop ? n : (stop > pos ? stop - pos : 0);
+
+  if (from >= to)
+    return 0;
+  return rio_writen(fd, data + from, to - from) < 0 ? -1 : 0;
+}
+
+/// @brief 응답 정보 초기화
+/// @param r 채울 응답 정보
+void response_init(http_response *r)
+{
+  memset(r, 0, sizeof(*r));
+  r->major = 1;
+  r->content_length = -1;
+  r->max_age = r->s_maxage = -1;
+  r->date = r->expires = r->last_modified = -1;
+}
+
+/// @brief HTTP-date (IMF-fixdate, 예: "Sun, 06 Nov 1994 08:49:37 GMT") 해석
+/// @param s 날짜 문자열
+/// @return time_t, 해석할 수 없으면 0
+static time_t http_date(char *s)
+{
+  struct tm tm;
+
+  memset(&tm, 0, sizeof(tm));
+  s += strspn(s, " \t");
+  if (strptime(s, "%a, %d %b %Y %H:%M:%S GMT", &tm) == NULL)
+    return 0;
+  return timegm(&tm);
+}
+
+/// @brief Cache-Control 지시어 목록 해석 -> 쉼표로 나뉜 토큰을 차례로 확인
+/// @param r 채울 응답 정보
+/// @param v 헤더 값
+static void response_cache_control(http_response *r, char *v)
+{
+  while (*v)
+  {
+    size_t len;
+
+    v += strspn(v, " \t,");
+    len = strcspn(v, ",\r\n");
+    if (!strncasecmp(v, "no-store", 8))
+      r->no_store = 1;
+    else if (!strncasecmp(v, "no-cache", 8))
+      r->no_cache = 1;
+    else if (!strncasecmp(v, "private", 7))
+      r->private = 1;
+    else if (!strncasecmp(v, "s-maxage=", 9))
+      r->s_maxage = atol(v + 9);
+    else if (!strncasecmp(v, "max-age=", 8))
+      r->max_age = atol(v + 8);
+    if (v[len] == '\r' || v[len] == '\n' || !v[len])
+      break;
+    v += len;
+  }
+}
+
+/// @brief 응답 상태 줄 해석
+/// @param r 채울 응답 정보
+/// @param line 상태 줄 (예: "HTTP/1.1 200 OK")
+/// @return 성공 0, 상태 줄이 아니면 -1
+int response_status_line(http_response *r, char *line)
+{
+  return sscanf(line, "HTTP/%d.%d %d", &r->major, &r->minor, &r->status) == 3 ? 0 : -1;
+}
+
+/// @brief 응답 헤더 한 줄을 해석해 본문 길이, 연결, 캐시 관련 정보 갱신
+/// @param r 채울 응답 정보
+/// @param line 헤더 한 줄
+void response_header(http_response *r, char *line)
+{
+  if (!strncasecmp(line, "Content-Length:", 15))
+    r->content_length = atol(line + 15);
+  else if (!strncasecmp(line, "Transfer-Encoding:", 18) && strcasestr(line + 18, "chunked"))
+    r->chunked = 1;
+  else if (!strncasecmp(line, "Connection:", 11))
+  {
+    r->conn_close = strcasestr(line + 11, "close") != NULL;
+    r->keep_alive = strcasestr(line + 11, "keep-alive") != NULL;
+  }
+  else if (!strncasecmp(line, "Cache-Control:", 14))
+    response_cache_control(r, line + 14);
+  else if (!strncasecmp(line, "Expires:", 8))
+    r->expires = http_date(line + 8); // 해석할 수 없는 Expires 는 이미 지난 것으로 봄 (0)
+  else if (!strncasecmp(line, "Date:", 5))
+    r->date = http_date(line + 5);
+  else if (!strncasecmp(line, "Last-Modified:", 14))
+    r->last_modified = http_date(line + 14);
+  else if (!strncasecmp(line, "Age:", 4))
+    r->age = atol(line + 4);
+  else if (!strncasecmp(line, "Set-Cookie:", 11))
+    r->set_cookie = 1;
+  else if (!strncasecmp(line, "Vary:", 5))
+    r->vary = 1;
+}
+
+/// @brief 서버 응답의 상태 줄이나 헤더 한 줄을 복사 없이 읽음 -> rio 버퍼 안의 줄바꿈을 NUL 로 바꿔 문자열 함수를 그대로 씀
+///        줄은 이 rio 에서 다시 읽기 전까지만 유효, 원래 줄이 필요하면 line[n - 1] 을 '\n' 으로 되돌림
+/// @param rp 서버 RIO
+/// @param linep 줄 시작 위치를 받을 곳
+/// @return 줄바꿈을 포함한 줄 길이, EOF / 오류 / 버퍼 (RIO_BUFSIZE) 보다 긴 줄이면 -1
+ssize_t response_getline(rio_t *rp, char **linep)
+{
+  ssize_t n = rio_getlineb(rp, linep);
+
+  if (n <= 0 || (*linep)[n - 1] != '\n')
+    return -1;
+  (*linep)[n - 1] = '\0';
+  return n;
+}
+
+/// @brief 서버와의 hop-by-hop 헤더인지 확인 -> 클라이언트에게 넘기지도, 캐시하지도 않음
+/// @param line 응답 헤더 한 줄
+/// @return hop-by-hop 헤더면 1
+int response_hop_by_hop(char *line)
+{
+  return !strncasecmp(line, "Transfer-Encoding:", 18) || !strncasecmp(line, "Connection:", 11) ||
+         !strncasecmp(line, "Keep-Alive:", 11) || !strncasecmp(line, "Proxy-Connection:", 17);
+}
+
+/// @brief 서버 응답 사본을 캐시에 넣을 모양으로 제자리에서 정리 -> hop-by-hop 헤더를 빼고, 없으면 Content-Length 를 넣음
+///        relay_response 가 저장하는 모양과 같으므로 어느 모드의 hit 도 저장된 헤더 뒤에 keep-alive 를 붙여 보낼 수 있음
+/// @param buf 상태 줄 + 헤더 + 빈 줄 + 본문 (뒤에 MAXLINE 여유)
+/// @param len 전체 길이
+/// @param hdr_len 빈 줄까지의 헤더 길이 -> 정리한 헤더 길이로 바뀜
+/// @param has_length 서버 응답에 Content-Length 가 있었으면 1
+/// @return 정리한 전체 길이
+size_t response_normalize(char *buf, size_t len, size_t *hdr_len, int has_length)
+{
+  size_t body_len = len - *hdr_len, kept, extra;
+  char *line = memchr(buf, '\n', *hdr_len) + 1; // 상태 줄은 그대로
+  char *end = buf + *hdr_len - 2; // 마지막 빈 줄
+  char tail[64];
+
+  // 헤더 줄을 앞으로 당기면서 hop-by-hop 헤더는 건너뜀 (빈 줄 앞까지)
+  kept = line - buf;
+  while (line < end)
+  {
+    char *next = memchr(line, '\n', end - line) + 1;
+    if (!response_hop_by_hop(line))
+    {
+      memmove(buf + kept, line, next - line);
+      kept += next - line;
+    }
+    line = next;
+  }
+
+  if (has_length)
+    extra = snprintf(tail, sizeof(tail), "\r\n");
+  else
+    extra = snprintf(tail, sizeof(tail), "Content-Length: %zu\r\n\r\n", body_len);
+  memmove(buf + kept + extra, buf + *hdr_len, body_len);
+  memcpy(buf + kept, tail, extra);
+  *hdr_len = kept + extra;
+  return kept + extra + body_len;
+}
+
+/// @brief 공유 캐시가 저장해도 되는 응답이면 신선도가 끝나는 시각 계산
+///        저장 불가: no-store, private, no-cache, Set-Cookie, Vary, 부분 응답, 이미 stale
+///        신선도: s-maxage -> max-age -> Expires - Date -> (휴리스틱 상태 코드만) Last-Modified 의 10%
+///        명시적인 신선도가 없으면 Last-Modified 가 있고 URI 에 질의 문자열이 없을 때만 저장 (CGI 출력 등 제외)
+/// @param r 해석한 응답 정보
+/// @param uri 요청 URI
+/// @param now 응답을 받은 시각
+/// @return 신선도가 끝나는 시각, 저장하면 안 되면 0
+time_t response_cache_until(http_response *r, char *uri, time_t now)
+{
+  time_t base = r->date > 0 && r->date <= now ? r->date : now;
+  long lifetime, age;
+  int heuristic;
+
+  if (r->no_store || r->private || r->no_cache || r->set_cookie || r->vary)
+    return 0;
+
+  // 명시적인 신선도 없이도 저장할 수 있는 상태 코드 (RFC 9110 15.1)
+  heuristic = r->status == 200 || r->status == 203 || r->status == 204 || r->status == 300 ||
+              r->status == 301 || r->status == 308 || r->status == 404 || r->status == 405 ||
+              r->status == 410 || r->status == 414 || r->status == 501;
+
+  if (r->s_maxage >= 0)
+    lifetime = r->s_maxage;
+  else if (r->max_age >= 0)
+    lifetime = r->max_age;
+  else if (r->expires >= 0)
+    lifetime = r->expires - base;
+  else if (!heuristic || strchr(uri, '?') || r->last_modified <= 0 || r->last_modified >= base)
+    return 0;
+  else
+    lifetime = (base - r->last_modified) / 10 < HEURISTIC_MAX_TTL ? (base - r->last_modified) / 10 : HEURISTIC_MAX_TTL;
+
+  if (r->status == 206 || r->status == 304 || r->status < 200) // 부분 / 검증 / 중간 응답은 객체가 아님
+    return 0;
+
+  // 서버와 중간 캐시에서 이미 지난 시간만큼 빼고 남은 신선도
+  age = r->date > 0 && now > r->date ? now - r->date : 0;
+  if (r->age > age)
+    age = r->age;
+  if (lifetime - age <= 0)
+    return 0;
+  return now + lifetime - age;
+}
+
+/// @brief 버퍼에 담긴 응답 헤더 전체 해석 (상태 줄 ~ 빈 줄)
+/// @param r 채울 응답 정보
+/// @param buf 응답 버퍼
+/// @param hdr_len 빈 줄까지의 헤더 길이
+/// @return 성공 0, 상태 줄이 아니면 -1
+int response_parse(http_response *r, char *buf, size_t hdr_len)
+{
+  char line[MAXLINE];
+  char *p = buf, *end = buf + hdr_len, *eol;
+
+  response_init(r);
+  for (int first = 1; p < end; first = 0, p = eol)
+  {
+    size_t len;
+
+    eol = memchr(p, '\n', end - p);
+    eol = eol ? eol + 1 : end;
+    len = eol - p < MAXLINE ? eol - p : MAXLINE - 1;
+    memcpy(line, p, len);
+    line[len] = '\0';
+
+    if (first && response_status_line(r, line) < 0)
+      return -1;
+    if (!first)
+      response_header(r, line);
+  }
+  return 0;
+}
+
+/// @brief 메시지 (요청 또는 저장된 응답 헤더) 에서 헤더 값 찾기
+/// @param msg 헤더들이 CRLF 로 나뉜 메시지
+/// @param len 메시지 길이
+/// @param name 콜론까지 포함한 헤더 이름 (예: "ETag:")
+/// @param value 앞뒤 공백을 뺀 값을 받을 버퍼 (MAXLINE)
+/// @return 찾으면 1, 없으면 0
+int header_value(char *msg, size_t len, char *name, char *value)
+{
+  char *line = msg, *eol, *end = msg + len;
+  size_t nlen = strlen(name);
+
+  while (line < end)
+  {
+    eol = memchr(line, '\n', end - line);
+    eol = eol ? eol + 1 : end;
+    if ((size_t)(eol - line) > nlen && !strncasecmp(line, name, nlen))
+    {
+      char *v = line + nlen, *e = eol;
+      v += strspn(v, " \t");
+      while (e > v && isspace((unsigned char)e[-1]))
+        e--;
+      if (e - v >= MAXLINE)
+        return 0;
+      memcpy(value, v, e - v);
+      value[e - v] = '\0';
+      return 1;
+    }
+    line = eol;
+  }
+  return 0;
+}
+
+/// @brief If-None-Match 목록에 저장된 ETag 가 있는지 확인 (약한 비교 -> W/ 접두어 무시)
+/// @param list If-None-Match 값 ("*" 또는 쉼표로 나뉜 태그들)
+/// @param etag 저장된 ETag 값
+/// @return 맞으면 1
+static int etag_match(char *list, char *etag)
+{
+  size_t len;
+
+  if (!strcmp(list, "*"))
+    return 1;
+  if (!strncmp(etag, "W/", 2))
+    etag += 2;
+  len = strlen(etag);
+
+  while (*list)
+  {
+    size_t n;
+
+    list += strspn(list, " \t,");
+    if (!strncmp(list, "W/", 2))
+      list += 2;
+    n = strcspn(list, " \t,");
+    if (n == len && !strncmp(list, etag, n))
+      return 1;
+    list += n;
+  }
+  return 0;
+}
+
+/// @brief 클라이언트의 조건부 요청을 저장된 응답의 검증자로 평가
+///        If-None-Match 가 있으면 그것만, 없으면 If-Modified-Since 를 Last-Modified 와 비교
+/// @param request 클라이언트 요청의 헤더 줄들
+/// @param request_len 헤더 줄들의 길이
+/// @param hdr 저장된 응답 헤더
+/// @param hdr_len 헤더 길이
+/// @return 클라이언트의 사본이 여전히 유효해 304 로 답하면 되면 1
+int client_not_modified(char *request, size_t request_len, char *hdr, size_t hdr_len)
+{
+  char value[MAXLINE], validator[MAXLINE];
+  time_t since, modified;
+
+  if (response_status(hdr) != 200)
+    return 0;
+  if (header_value(request, request_len, "If-None-Match:", value))
+    return header_value(hdr, hdr_len, "ETag:", validator) && etag_match(value, validator);
+  if (!header_value(request, request_len, "If-Modified-Since:", value) ||
+      !header_value(hdr, hdr_len, "Last-Modified:", validator))
+    return 0;
+  since = http_date(value);
+  modified = http_date(validator);
+  return since > 0 && modified > 0 && modified <= since;
+}
+
+/// @brief 저장된 응답 헤더로 304 응답 만들기 -> 검증자와 신선도 관련 헤더만 옮김
+/// @param dst 응답을 쓸 버퍼
+/// @param size 버퍼 크기
+/// @param hdr 저장된 응답 헤더
+/// @param hdr_len 헤더 길이
+/// @param keep_alive 클라이언트 연결을 유지하려면 1
+/// @return 응답 길이
+size_t build_not_modified(char *dst, size_t size, char *hdr, size_t hdr_len, int keep_alive)
+{
+  static const char *keep[] = { "ETag:", "Last-Modified:", "Cache-Control:", "Expires:", "Date:", "Vary:", "Content-Location:" };
+  char *line, *eol, *end = hdr + hdr_len;
+  size_t len = snprintf(dst, size, "HTTP/1.1 304 Not Modified\r\n");
+
+  line = memchr(hdr, '\n', hdr_len);
+  for (line = line ? line + 1 : end; line < end; line = eol)
+  {
+    eol = memchr(line, '\n', end - line);
+    eol = eol ? eol + 1 : end;
+    for (size_t i = 0; i < sizeof(keep) / sizeof(keep[0]); i++)
+    {
+      if (!strncasecmp(line, keep[i], strlen(keep[i])) && len + (eol - line) + MAXLINE / 16 < size)
+      {
+        memcpy(dst + len, line, eol - line);
+        len += eol - line;
+        break;
+      }
+    }
+  }
+  len += snprintf(dst + len, size - len, "%s", keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+  return len;
+}
+
+/// @brief 본문 없이 답할 수 있는 hit 처리 -> 클라이언트 검증자가 맞으면 304, HEAD 면 저장된 헤더만
+/// @param fd 클라이언트 소켓
+/// @param request 클라이언트 요청의 헤더 줄들
+/// @param request_len 헤더 줄들의 길이
+/// @param hdr 저장된 응답 헤더 (빈 줄 포함)
+/// @param hdr_len 헤더 길이
+/// @param head HEAD 요청이면 1
+/// @param keep_alive 클라이언트 연결을 유지하려면 1
+/// @return 보냈으면 연결 유지 여부 (1 / 0), 본문까지 보내야 하면 -1
+int send_cached_headers(int fd, char *request, size_t request_len, char *hdr, size_t hdr_len, int head, int keep_alive)
+{
+  char buf[MAXLINE];
+  char *conn_hdr = keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+
+  if (hdr_len < 2) // 헤더 경계를 모르는 객체
+    return -1;
+
+  if (client_not_modified(request, request_len, hdr, hdr_len))
+  {
+    atomic_fetch_add(&admission.client_304, 1);
+    if (rio_writen(fd, buf, build_not_modified(buf, sizeof(buf), hdr, hdr_len, keep_alive)) < 0)
+      return 0;
+    return keep_alive;
+  }
+  if (!head)
+    return -1;
+
+  // 저장된 헤더 (마지막 빈 줄 제외) -> Connection 헤더와 빈 줄
+  atomic_fetch_add(&admission.head_hits, 1);
+  struct iovec iov[2] = { { hdr, hdr_len - 2 }, { conn_hdr, strlen(conn_hdr) } };
+  if (rio_writev(fd, iov, 2) < 0)
+    return 0;
+  return keep_alive;
+}
+
+/// @brief 프록시가 직접 채우는 헤더인지 확인 (Host, User-Agent, 연결 관련 hop-by-hop 헤더)
+/// @param line 클라이언트가 보낸 헤더 한 줄
+/// @return 건너뛸 헤더면 1, 그대로 전달할 헤더면 0
+int skip_request_header(const char *line)
+{
+  return !strncasecmp(line, "Host:", 5) ||
+         !strncasecmp(line, "User-Agent:", 11) ||
+         !strncasecmp(line, "Connection:", 11) ||
+         !strncasecmp(line, "Proxy-Connection:", 17) ||
+         !strncasecmp(line, "Keep-Alive:", 11);
+}
+
+/// @brief URI 문자열 파싱하여 정보를 분리하는 함수
+/// @param uri 파싱할 uri 문자열
+/// @param hostname 파싱된 호스트명 저장 버퍼
+/// @param path 파싱된 경로 저장 버퍼
+/// @param port 파싱된 포트 저장 버퍼
+/// @return 성공 시 0, 실패 시 -1
+int parse_uri(const char *uri, char *hostname, char *path, char *port)
+{
+    char uri_copy[MAXLINE];
+    strcpy(uri_copy, uri);
+
+    if (strncasecmp(uri_copy, "http://", 7) != 0)
+        return -1;
+
+    char *hostbegin = uri_copy + 7;
+    char *pathbegin = strchr(hostbegin, '/');
+    char *portbegin = strchr(hostbegin, ':');
+
+    if (pathbegin) 
+    {
+        strcpy(path, pathbegin);
+        *pathbegin = '\0';
+    } 
+    else 
+    {
+        strcpy(path, "/");
+    }
+
+    
+    if (portbegin) 
+    {
+        *portbegin = '\0';
+        strcpy(hostname, hostbegin);
+        strcpy(port, portbegin + 1);
+    } 
+    else 
+    {
+        strcpy(hostname, hostbegin);
+        strcpy(port, "80");
+    }
+
+    return 0;
+}
+
+/// @brief 캐시에 넣을 응답 사본에 데이터를 덧붙임
+/// @param object_buf 캐시에 넣을 응답 사본
+/// @param object_len 사본 길이 (MAX_OBJECT_SIZE 초과 시 캐시 안함)
+/// @param data 덧붙일 데이터
+/// @param n 데이터 길이
+static void object_append(char *object_buf, size_t *object_len, char *data, size_t n)
+{
+  if (*object_len + n <= MAX_OBJECT_SIZE)
+  {
+    memcpy(object_buf + *object_len, data, n);
+    *object_len += n;
+  }
+  else
+  {
+    *object_len = MAX_OBJECT_SIZE + 1;
+  }
+}
+
+/// @brief 소켓에서 소켓으로 len 바이트를 splice 로 이동 -> 사용자 공간 복사 없음
+///        splice 를 쓸 수 없는 커널이면 rio 로 대신 복사
+/// @param from 읽을 소켓 (rio 버퍼는 비어 있어야 함)
+/// @param to 쓸 소켓
+/// @param len 옮길 바이트 수
+/// @return 성공 0, 실패 -1 (파이프에 남은 데이터는 버림)
+static int splice_body(int from, int to, long len)
+{
+  static __thread int pipefd[2] = {-1, -1}; // 워커 쓰레드마다 하나를 만들어 재사용
+  char buf[MAXLINE];
+  ssize_t n, m;
+
+  if (pipefd[0] < 0)
+  {
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+      pipefd[0] = pipefd[1] = -1;
+    else
+      fcntl(pipefd[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE); // 실패해도 기본 크기로 동작
+  }
+
+  while (len > 0)
+  {
+    if (pipefd[0] < 0 ||
+        (n = splice(from, NULL, pipefd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_MORE)) < 0)
+    {
+      if (pipefd[0] >= 0 && errno == EINTR)
+        continue;
+      if (pipefd[0] >= 0 && errno != EINVAL && errno != ENOSYS)
+        return -1;
+      // splice 미지원 -> 평소처럼 읽고 씀
+      if ((n = read(from, buf, len < MAXLINE ? len : MAXLINE)) <= 0 || rio_writen(to, buf, n) < 0)
+        return -1;
+      len -= n;
+      continue;
+    }
+    if (n == 0) // 서버가 본문 중간에 닫음
+      return -1;
+    len -= n;
+
+    // 파이프에 들어간 만큼 모두 클라이언트로
+    while (n > 0)
+    {
+      if ((m = splice(pipefd[0], NULL, to, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE)) <= 0)
+      {
+        if (m < 0 && errno == EINTR)
+          continue;
+        // 파이프에 남은 바이트가 다음 응답에 섞이지 않도록 새로 만듦
+        close(pipefd[0]);
+        close(pipefd[1]);
+        pipefd[0] = pipefd[1] = -1;
+        return -1;
+      }
+      n -= m;
+      atomic_fetch_add(&upstream.spliced, m);
+    }
+  }
+  return 0;
+}
+
+/// @brief 재검증 요청에 대한 304 의 헤더를 읽어 저장된 응답의 새 신선도 계산
+///        -> 신선도 관련 헤더 (Cache-Control, Expires, Date, Age) 는 304 의 값이 저장된 값을 대신함
+/// @param rp 상태 줄을 읽은 서버 RIO
+/// @param uri 요청 URI
+/// @param rv 재검증 정보 (결과를 채움)
+/// @param resp 상태 줄을 해석한 응답 정보
+/// @param reusable 서버 연결을 재사용할 수 있으면 1
+/// @return 성공 0, 헤더를 끝까지 읽지 못하면 -2
+static int relay_not_modified(rio_t *rp, char *uri, revalidation *rv, http_response *resp, int *reusable)
+{
+  char *line;
+  http_response stored;
+  ssize_t n;
+
+  response_parse(&stored, rv->hdr, rv->hdr_len);
+  stored.date = -1;
+  stored.age = 0;
+  while ((n = response_getline(rp, &line)) > 0 && strcmp(line, "\r"))
+  {
+    response_header(resp, line);
+    response_header(&stored, line);
+  }
+  if (n <= 0)
+    return -2;
+
+  rv->not_modified = 1;
+  rv->expires = response_cache_until(&stored, uri, time(NULL));
+  *reusable = !resp->conn_close && (resp->major > 1 || resp->minor >= 1 || resp->keep_alive) && rp->rio_cnt == 0;
+  return 0;
+}
+
+/// @brief 서버로 요청을 보내고 응답을 클라이언트로 중계 -> 응답 끝은 Content-Length / chunked 로 판단
+///        캐시에는 hop-by-hop 헤더를 뺀 헤더 + Content-Length + 본문을 저장
+/// @param clientfd 클라이언트 소켓
+/// @param serverfd 서버 소켓 (새 연결 또는 풀에서 꺼낸 연결)
+/// @param request 서버로 보낼 요청 메시지
+/// @param uri 캐시 키
+/// @param f 받는 응답을 팔로워에게 나눠 줄 진행 중 항목 (NULL 이면 나누지 않음)
+/// @param range 클라이언트 Range 헤더 값 -> 길이를 아는 200 응답이면 이 구간만 206 으로 보냄
+/// @param client_http11 클라이언트가 HTTP/1.1 이면 1 (chunked 로 다시 보낼 수 있음)
+/// @param keep_client 들어올 때는 클라이언트가 원하는 연결 유지 여부, 나갈 때는 실제로 유지할 수 있는지
+/// @param reusable 응답을 정확히 다 읽었고 서버가 연결을 유지하면 1
+/// @return 성공 0, 클라이언트에 아무것도 보내기 전 서버 쪽 실패 -1 (재시도 가능), 그 외 실패 -2,
+///         캐시에 넣지 못할 객체의 Range 요청이라 본문을 읽지 않고 멈췄으면 -3 (Range 를 붙여 다시 요청)
+int relay_response(int clientfd, int serverfd, upstream_request *request, char *uri, inflight_t *f, char *range, int client_http11, int *keep_client, int *reusable, revalidation *rv)
+{
+  struct iovec iov[REQUEST_MAX_HEADERS + 4]; // rio_writev 가 조각 목록을 고치므로 복사본으로 보냄 -> 다시 시도할 때 원본을 씀
+  char buf[MAXLINE], *line; // line -> server_rio 버퍼 안의 상태 줄 / 헤더 줄
+  char object_buf[MAX_OBJECT_SIZE + MAXLINE]; // 뒤쪽 여유는 Content-Length 헤더를 끼워 넣을 자리
+  size_t object_len = 0, hdr_len;
+  rio_t server_rio;
+  ssize_t n;
+  large_object *lo = NULL; // 큰 객체 캐시에 넣을 조각들
+  http_response resp; // 상태 줄과 헤더에서 뽑은 정보
+  time_t expires; // 캐시 항목의 신선도 끝, 저장하면 안 되는 응답이면 0
+  int rechunk = 0;
+  int head = !strncmp(request->iov[0].iov_base, "HEAD", 4); // HEAD 응답은 Content-Length 가 있어도 본문이 없음
+  size_t start = 0, stop = (size_t)-1; // 클라이언트에게 보낼 본문 구간
+  int ranged = -1; // parse_range 결과, Range 를 적용하지 않으면 -1
+
+  *reusable = 0;
+
+  // 생성한 요청 메시지를 서버에 전송 -> 클라이언트 헤더 줄들은 rio 버퍼에서 바로
+  memcpy(iov, request->iov, request->iovcnt * sizeof(struct iovec));
+  if (rio_writev(serverfd, iov, request->iovcnt) < 0)
+    return -1;
+
+  rio_readinitb(&server_rio, serverfd); // 서버와 연결을 위한 RIO 초기화
+  if ((n = response_getline(&server_rio, &line)) <= 0) // 상태 라인
+    return -1;
+  response_init(&resp);
+  response_status_line(&resp, line);
+  if (rv && resp.status == 304)
+    return relay_not_modified(&server_rio, uri, rv, &resp, reusable);
+  if (rv && rv->fallback && resp.status >= 500) // stale-if-error -> 오류 응답 대신 저장된 본문
+  {
+    rv->failed = 1;
+    return 0;
+  }
+  line[n - 1] = '\n';
+  object_append(object_buf, &object_len, line, n);
+
+  // 응답 헤더를 모두 읽어 본문 길이, 서버 연결 유지, 캐시 정책 정보 확인 -> 줄은 rio 버퍼에서 object_buf 로 한 번만 복사
+  while ((n = response_getline(&server_rio, &line)) > 0)
+  {
+    if (!strcmp(line, "\r"))
+      break;
+    response_header(&resp, line);
+
+    // 서버와의 hop-by-hop 헤더는 클라이언트에게 넘기지 않음
+    if (response_hop_by_hop(line))
+      continue;
+
+    line[n - 1] = '\n';
+    object_append(object_buf, &object_len, line, n);
+  }
+  if (n <= 0 || object_len > MAX_OBJECT_SIZE)
+    return -2;
+  hdr_len = object_len; // 빈 줄을 뺀 헤더 길이
+
+  // 저장 정책 -> 저장할 수 없는 응답 (private, Set-Cookie 등) 은 팔로워와도 나누지 않음
+  if (head) // HEAD 응답은 본문이 없으므로 저장하지 않음
+    expires = 0;
+  else if ((expires = response_cache_until(&resp, uri, time(NULL))) != 0)
+    atomic_fetch_add(&admission.stored, 1);
+  else
+    atomic_fetch_add(&admission.refused, 1);
+
+  if ((resp.status >= 100 && resp.status < 200) || resp.status == 204 || resp.status == 304 || head) // 본문 없는 응답
+  {
+    resp.content_length = 0;
+    resp.chunked = 0;
+  }
+  if (resp.chunked)
+    resp.content_length = -1;
+
+  // Range miss 의 전체 응답은 캐시를 채울 수 있을 때만 받음 -> 못 넣는 객체면 구간 앞의 본문까지 읽지 않도록 여기서 멈춤
+  if (*range && !rv && resp.status == 200 && !request_has(request, "Range:") &&
+      (!expires || resp.content_length < 0 || (resp.content_length > MAX_OBJECT_SIZE && !large_admits(resp.content_length))))
+  {
+    if (f)
+      inflight_unshared(f, 0); // 팔로워들은 각자 서버에서 받음
+    return -3;
+  }
+  if (f && expires)
+    inflight_headers(f, object_buf, hdr_len, resp.content_length); // 팔로워들이 헤더부터 보내기 시작
+  else if (f)
+  {
+    // 팔로워들은 각자 서버에서 받음 -> 저장을 금지한 응답이면 한동안 같은 URI 의 miss 를 합치지 않음
+    inflight_unshared(f, resp.no_store || resp.private || resp.set_cookie || resp.vary);
+    f = NULL;
+  }
+
+  // 본문 끝을 알릴 방법에 따라 클라이언트 연결 유지 여부 결정
+  //   Content-Length -> 유지 가능, chunked -> HTTP/1.1 클라이언트에게만 다시 chunked 로, 그 외 -> EOF 로 알림
+  if (resp.chunked && *keep_client && client_http11)
+    rechunk = 1;
+  else if (resp.content_length < 0)
+    *keep_client = 0;
+
+  if (*range && resp.status == 200 && resp.content_length >= 0 && (ranged = parse_range(range, resp.content_length, &start, &stop)) == 0)
+    start = stop = 0; // 416 -> 본문은 캐시만 채우고 보내지 않음
+
+  sprintf(buf, "%s%s\r\n", rechunk ? "Transfer-Encoding: chunked\r\n" : "",
+          *keep_client ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+  if (ranged >= 0)
+  {
+    if (send_range_headers(clientfd, object_buf, hdr_len, ranged, start, stop, resp.content_length, buf, NULL) < 0)
+      return -2;
+  }
+  else
+  {
+    struct iovec iov[2] = { { object_buf, hdr_len }, { buf, strlen(buf) } };
+    if (rio_writev(clientfd, iov, 2) < 0)
+      return -2;
+  }
+
+  if (resp.content_length > MAX_OBJECT_SIZE && expires) // 길이를 아는 큰 응답 -> 큰 객체 캐시 예산에 들어가면 조각으로 모음
+    lo = large_begin(uri, object_buf, hdr_len, resp.content_length, expires);
+
+  if (resp.chunked)
+  {
+    // 조각 크기 줄 -> 조각 데이터 -> CRLF 반복, 크기 0 이면 트레일러 후 끝
+    while (1)
+    {
+      char size_line[32];
+      long remaining;
+
+      if (rio_readlineb(&server_rio, buf, MAXLINE) <= 0)
+        return -2;
+      if ((remaining = strtol(buf, NULL, 16)) <= 0)
+        break;
+
+      sprintf(size_line, "%lx\r\n", remaining);
+      if (rechunk && rio_writen(clientfd, size_line, strlen(size_line)) < 0)
+        return -2;
+
+      while (remaining > 0)
+      {
+        n = rio_readnb(&server_rio, buf, remaining < MAXLINE ? remaining : MAXLINE);
+        if (n <= 0)
+          return -2;
+        if (f)
+          inflight_append(f, buf, n);
+        if (rio_writen(clientfd, buf, n) < 0)
+          return -2;
+        object_append(object_buf, &object_len, buf, n);
+        remaining -= n;
+      }
+      if (rio_readlineb(&server_rio, buf, MAXLINE) <= 0) // 조각 뒤 CRLF
+        return -2;
+      if (rechunk && rio_writen(clientfd, "\r\n", 2) < 0)
+        return -2;
+    }
+
+    // 트레일러는 빈 줄이 나올 때까지 버림
+    while ((n = rio_readlineb(&server_rio, buf, MAXLINE)) > 0 && strcmp(buf, "\r\n"))
+      ;
+    if (n <= 0)
+      return -2;
+    if (rechunk && rio_writen(clientfd, "0\r\n\r\n", 5) < 0)
+      return -2;
+  }
+  else if (resp.content_length > MAX_OBJECT_SIZE && lo == NULL && ranged < 0 && (f == NULL || inflight_detach(f)))
+  {
+    // 캐시하지 않을 본문이고 따라 읽는 팔로워도 없음 -> 서버 소켓 -> 파이프 -> 클라이언트 소켓으로 복사 없이 이동
+    long remaining = resp.content_length;
+    if (server_rio.rio_cnt > 0) // 헤더와 함께 rio 버퍼로 읽힌 본문 앞부분
+    {
+      n = server_rio.rio_cnt < remaining ? server_rio.rio_cnt : remaining;
+      if (rio_writen(clientfd, server_rio.rio_bufptr, n) < 0)
+        return -2;
+      server_rio.rio_bufptr += n;
+      server_rio.rio_cnt -= n;
+      remaining -= n;
+    }
+    if (splice_body(serverfd, clientfd, remaining) < 0)
+      return -2;
+    object_len = MAX_OBJECT_SIZE + 1;
+  }
+  else if (resp.content_length >= 0)
+  {
+    long remaining = resp.content_length;
+    while (remaining > 0)
+    {
+      n = rio_readnb(&server_rio, buf, remaining < MAXLINE ? remaining : MAXLINE);
+      if (n <= 0)
+      {
+        large_abort(lo);
+        return -2;
+      }
+      if (f)
+        inflight_append(f, buf, n);
+      if (write_slice(clientfd, buf, n, resp.content_length - remaining, start, stop) < 0)
+      {
+        large_abort(lo);
+        return -2;
+      }
+      if (lo)
+        large_append(lo, buf, n);
+      else
+        object_append(object_buf, &object_len, buf, n);
+      remaining -= n;
+    }
+    if (lo)
+    {
+      large_publish(lo);
+      object_len = MAX_OBJECT_SIZE + 1;
+    }
+  }
+  else
+  {
+    // 길이 정보가 없으면 서버가 연결을 닫을 때까지 읽음 -> 연결은 재사용 불가
+    while ((n = rio_readnb(&server_rio, buf, MAXLINE)) > 0)
+    {
+      if (f)
+        inflight_append(f, buf, n);
+      if (rio_writen(clientfd, buf, n) < 0)
+        return -2;
+      object_append(object_buf, &object_len, buf, n);
+    }
+    resp.conn_close = 1;
+  }
+
+  if (object_len <= MAX_OBJECT_SIZE && expires) // 저장 정책을 통과한 응답만
+  {
+    // 헤더 끝에 (없었다면) Content-Length 와 빈 줄을 끼워 넣어 캐시 hit 도 keep-alive 로 보낼 수 있게 함
+    size_t body_len = object_len - hdr_len;
+    if (resp.content_length >= 0)
+      strcpy(buf, "\r\n");
+    else
+      sprintf(buf, "Content-Length: %zu\r\n\r\n", body_len);
+    memmove(object_buf + hdr_len + strlen(buf), object_buf + hdr_len, body_len);
+    memcpy(object_buf + hdr_len, buf, strlen(buf));
+    cache_insert(uri, object_buf, object_len + strlen(buf), hdr_len + strlen(buf), expires);
+  }
+  if (f)
+    inflight_complete(f); // 캐시에 올린 뒤 팔로워들에게 끝을 알림
+
+  // HTTP/1.0 은 keep-alive 를 명시해야 유지, 1.1 은 close 가 없으면 유지
+  // rio 버퍼에 남은 바이트가 있으면 응답 경계가 어긋난 것이므로 재사용하지 않음
+  *reusable = !resp.conn_close && (resp.major > 1 || resp.minor >= 1 || resp.keep_alive) && server_rio.rio_cnt == 0;
+  return 0;
+}
+
+/// @brief (host, port) 에 해당하는 풀 항목 탐색, 없으면 생성 (풀 락 필요)
+/// @param key "host:port" 문자열
+/// @return 풀 항목, 메모리 부족 시 NULL
+static upstream_host *upstream_lookup(char *key)
+{
+  unsigned int h = cache_hash(key) % UPSTREAM_HASH_SIZE;
+  upstream_host *u;
+
+  for (u = upstream.table[h]; u; u = u->next)
+    if (!strcmp(u->key, key))
+      return u;
+
+  if ((u = calloc(1, sizeof(upstream_host))) == NULL || (u->key = strdup(key)) == NULL)
+  {
+    free(u);
+    return NULL;
+  }
+  u->next = upstream.table[h];
+  upstream.table[h] = u;
+  return u;
+}
+
+/// @brief 유휴 시간이 지난 연결을 닫음 (풀 락 필요)
+/// @param u 풀 항목
+/// @param now 현재 시각
+static void upstream_expire(upstream_host *u, time_t now)
+{
+  int expired = 0;
+
+  // 앞쪽이 오래된 연결
+  while (expired < u->nidle && now - u->idle_since[expired] > UPSTREAM_IDLE_TIMEOUT)
+    close(u->fds[expired++]);
+  if (expired)
+  {
+    memmove(u->fds, u->fds + expired, (u->nidle - expired) * sizeof(int));
+    memmove(u->idle_since, u->idle_since + expired, (u->nidle - expired) * sizeof(time_t));
+    u->nidle -= expired;
+  }
+}
+
+/// @brief 풀 전체 정리 -> 다시 찾지 않는 호스트의 유휴 연결도 닫고, 빈 항목은 해제
+/// @param now 현재 시각
+void upstream_sweep(time_t now)
+{
+  pthread_mutex_lock(&upstream.lock);
+  for (int i = 0; i < UPSTREAM_HASH_SIZE; i++)
+  {
+    upstream_host *u, **pp;
+
+    for (pp = &upstream.table[i]; (u = *pp) != NULL;)
+    {
+      upstream_expire(u, now);
+      if (u->nidle == 0)
+      {
+        *pp = u->next;
+        free(u->key);
+        free(u);
+        continue;
+      }
+      pp = &u->next;
+    }
+  }
+  pthread_mutex_unlock(&upstream.lock);
+}
+
+/// @brief 서버 연결 획득 -> 살아 있는 유휴 연결이 있으면 재사용, 없으면 새로 연결
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param reused 풀에서 꺼낸 연결이면 1
+/// @return 연결된 소켓 디스크립터, 실패 시 -1
+int upstream_acquire(char *hostname, char *port, int *reused)
+{
+  char key[MAXLINE];
+  time_t now = time(NULL);
+  upstream_host *u;
+  int fd = -1;
+
+  snprintf(key, sizeof(key), "%s:%s", hostname, port);
+  atomic_fetch_add(&upstream.requests, 1);
+
+  pthread_mutex_lock(&upstream.lock);
+  if ((u = upstream_lookup(key)) != NULL)
+  {
+    upstream_expire(u, now);
+
+    // 가장 최근에 반납된 연결부터 -> 서버가 그 사이 닫았으면(EOF) 버리고 다음 연결
+    while (fd < 0 && u->nidle > 0)
+    {
+      char c;
+      fd = u->fds[--u->nidle];
+      if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+  }
+  pthread_mutex_unlock(&upstream.lock);
+
+  if (fd >= 0)
+  {
+    *reused = 1;
+    atomic_fetch_add(&upstream.reused, 1);
+    return fd;
+  }
+
+  *reused = 0;
+  return dns_connect(hostname, port, 0, NULL); // 서버에 연결 시도 (이름 해석은 캐시에서)
+}
+
+/// @brief 응답을 끝까지 읽은 서버 연결을 풀에 반납 -> 가득 찼으면 닫음
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param fd 반납할 소켓 디스크립터
+void upstream_release(char *hostname, char *port, int fd)
+{
+  char key[MAXLINE];
+  upstream_host *u;
+
+  snprintf(key, sizeof(key), "%s:%s", hostname, port);
+
+  pthread_mutex_lock(&upstream.lock);
+  if ((u = upstream_lookup(key)) != NULL && u->nidle < UPSTREAM_MAX_IDLE)
+  {
+    u->fds[u->nidle] = fd;
+    u->idle_since[u->nidle++] = time(NULL);
+    fd = -1;
+  }
+  pthread_mutex_unlock(&upstream.lock);
+
+  if (fd >= 0) // 호스트 당 최대 유휴 연결 수 초과
+    Close(fd);
+}
+
+/// @brief getaddrinfo 로 (hostname, port) 를 해석해 주소 목록을 채움
+/// @param host 서버 호스트 이름
+/// @param port 서버 포트
+/// @param addrs 결과를 저장할 배열 (DNS_MAX_ADDRS 개)
+/// @return 해석된 주소 수, 실패 시 0
+static int dns_resolve(char *host, char *port, dns_addr *addrs)
+{
+  struct addrinfo hints, *listp, *p;
+  int n = 0;
+
+  memset(&hints, 0, sizeof(struct addrinfo));
+  hints.ai_socktype = SOCK_STREAM; // TCP 연결 사용
+  hints.ai_flags = AI_NUMERICSERV | AI_ADDRCONFIG;
+
+  // 실패해도 프로세스를 종료하지 않도록 소문자 getaddrinfo 사용
+  if (getaddrinfo(host, port, &hints, &listp) != 0)
+    return 0;
+
+  for (p = listp; p && n < DNS_MAX_ADDRS; p = p->ai_next)
+  {
+    if (p->ai_addrlen > sizeof(struct sockaddr_storage))
+      continue;
+    addrs[n].family = p->ai_family;
+    addrs[n].socktype = p->ai_socktype;
+    addrs[n].protocol = p->ai_protocol;
+    addrs[n].addrlen = p->ai_addrlen;
+    memcpy(&addrs[n].addr, p->ai_addr, p->ai_addrlen);
+    n++;
+  }
+
+  freeaddrinfo(listp);
+  return n;
+}
+
+/// @brief 해석 결과로 캐시 항목을 갱신 (dns 락 필요)
+/// @param e 갱신할 항목
+/// @param addrs 해석된 주소 목록
+/// @param n 주소 수 (0 이면 실패 결과)
+static void dns_store(dns_entry *e, dns_addr *addrs, int n)
+{
+  memcpy(e->addrs, addrs, n * sizeof(dns_addr));
+  e->naddrs = n;
+  e->expires = time(NULL) + (n ? DNS_TTL : DNS_NEGATIVE_TTL);
+}
+
+/// @brief (hostname, port) 의 주소 목록을 캐시에서만 찾음 -> 이름 해석을 기다리지 않음
+/// @param host 서버 호스트 이름
+/// @param port 서버 포트
+/// @param addrs 결과를 저장할 배열 (DNS_MAX_ADDRS 개)
+/// @return 주소 수 (실패 결과가 캐시돼 있으면 0), 없거나 만료됐으면 -1
+static int dns_cached(char *host, char *port, dns_addr *addrs)
+{
+  char key[MAXLINE];
+  unsigned int h;
+  time_t now = time(NULL);
+  dns_entry *e;
+  int n;
+
+  snprintf(key, sizeof(key), "%s:%s", host, port);
+  h = cache_hash(key) % DNS_HASH_SIZE;
+
+  pthread_mutex_lock(&dns.lock);
+  for (e = dns.table[h]; e; e = e->next)
+  {
+    if (!strcmp(e->key, key) && e->expires > now)
+    {
+      e->last_used = now;
+      n = e->naddrs;
+      memcpy(addrs, e->addrs, n * sizeof(dns_addr));
+      pthread_mutex_unlock(&dns.lock);
+      atomic_fetch_add(&dns.hits, 1);
+      return n;
+    }
+  }
+  pthread_mutex_unlock(&dns.lock);
+  return -1;
+}
+
+/// @brief (hostname, port) 의 주소 목록을 캐시에서 찾고, 없거나 만료됐으면 해석해서 넣음
+/// @param host 서버 호스트 이름
+/// @param port 서버 포트
+/// @param addrs 결과를 저장할 배열 (DNS_MAX_ADDRS 개)
+/// @return 주소 수, 해석 실패 시 0
+static int dns_lookup(char *host, char *port, dns_addr *addrs)
+{
+  char key[MAXLINE];
+  unsigned int h;
+  time_t now = time(NULL);
+  dns_entry *e;
+  int n;
+
+  if ((n = dns_cached(host, port, addrs)) >= 0)
+    return n;
+
+  // 캐시에 없으면 락 밖에서 해석 -> 느린 해석이 다른 호스트 조회를 막지 않도록
+  snprintf(key, sizeof(key), "%s:%s", host, port);
+  h = cache_hash(key) % DNS_HASH_SIZE;
+  atomic_fetch_add(&dns.misses, 1);
+  n = dns_resolve(host, port, addrs);
+
+  pthread_mutex_lock(&dns.lock);
+  for (e = dns.table[h]; e; e = e->next)
+    if (!strcmp(e->key, key))
+      break;
+  if (!e && (e = calloc(1, sizeof(dns_entry))) != NULL)
+  {
+    if ((e->key = strdup(key)) && (e->host = strdup(host)) && (e->port = strdup(port)))
+    {
+      e->next = dns.table[h];
+      dns.table[h] = e;
+    }
+    else
+    {
+      free(e->key);
+      free(e->host);
+      free(e);
+      e = NULL;
+    }
+  }
+  if (e)
+  {
+    dns_store(e, addrs, n);
+    e->last_used = now;
+  }
+  pthread_mutex_unlock(&dns.lock);
+  return n;
+}
+
+/// @brief 백그라운드 갱신 쓰레드 -> 곧 만료될, 최근에 쓰인 항목을 미리 다시 해석하고 서버 연결 풀의 유휴 연결도 정리
+/// @param vargp 사용 안함
+/// @return NULL (반환하지 않음)
+static void *dns_refresher(void *vargp)
+{
+  Pthread_detach(pthread_self());
+
+  while (1)
+  {
+    Sleep(1);
+    upstream_sweep(time(NULL)); // 같은 호스트를 다시 찾지 않아도 유휴 연결이 UPSTREAM_IDLE_TIMEOUT 뒤에 닫히도록
+
+    for (int i = 0; i < DNS_HASH_SIZE; i++)
+    {
+      char host[MAXLINE], port[MAXLINE];
+      dns_addr addrs[DNS_MAX_ADDRS];
+      dns_entry *e, **pp;
+      time_t now = time(NULL);
+      int found = 0, n;
+
+      // 버킷에서 갱신할 항목 하나를 골라 이름만 복사 -> 해석은 락 밖에서
+      pthread_mutex_lock(&dns.lock);
+      for (pp = &dns.table[i]; (e = *pp) != NULL;)
+      {
+        if (now - e->last_used > 2 * DNS_TTL) // 오래 안 쓰인 항목은 정리
+        {
+          *pp = e->next;
+          free(e->key);
+          free(e->host);
+          free(e->port);
+          free(e);
+          continue;
+        }
+        if (!found && e->naddrs && e->expires - now <= DNS_REFRESH_AHEAD && now - e->last_used <= DNS_TTL)
+        {
+          strcpy(host, e->host);
+          strcpy(port, e->port);
+          found = 1;
+        }
+        pp = &e->next;
+      }
+      pthread_mutex_unlock(&dns.lock);
+
+      if (!found)
+        continue;
+
+      n = dns_resolve(host, port, addrs);
+      atomic_fetch_add(&dns.refreshes, 1);
+
+      pthread_mutex_lock(&dns.lock);
+      for (e = dns.table[i]; e; e = e->next)
+      {
+        if (!strcmp(e->host, host) && !strcmp(e->port, port))
+        {
+          // 갱신이 실패하면 기존 주소를 계속 씀 (만료 전까지)
+          if (n)
+            dns_store(e, addrs, n);
+          else
+            e->expires = now + DNS_REFRESH_AHEAD + 1;
+          break;
+        }
+      }
+      pthread_mutex_unlock(&dns.lock);
+    }
+  }
+  return NULL;
+}
+
+/// @brief 이름 해석 캐시의 백그라운드 갱신 쓰레드 시작
+void dns_init(void)
+{
+  pthread_t tid;
+  Pthread_create(&tid, NULL, dns_refresher, NULL);
+}
+
+/// @brief 캐시된 주소로 서버에 연결 (Open_clientfd 대신) -> 정상 상태에서는 이름 해석 없이 connect 만
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param nonblock 1 이면 논블로킹 소켓으로 connect 시작 (epoll 모드)
+/// @param in_progress nonblock 일 때 connect 가 아직 진행 중이면 1로 설정
+/// @return 연결된 (또는 연결 중인) 소켓 디스크립터, 실패 시 -1
+int dns_connect(char *hostname, char *port, int nonblock, int *in_progress)
+{
+  dns_addr addrs[DNS_MAX_ADDRS];
+  int n = dns_lookup(hostname, port, addrs);
+
+  return dns_open(addrs, n, nonblock, in_progress);
+}
+
+/// @brief 해석해 둔 주소 목록으로 서버에 연결 -> 이름 해석 없이 connect 만 (이벤트 루프에서도 부를 수 있음)
+/// @param addrs 주소 목록
+/// @param n 주소 수
+/// @param nonblock 1 이면 논블로킹 소켓으로 connect 시작 (epoll 모드)
+/// @param in_progress nonblock 일 때 connect 가 아직 진행 중이면 1로 설정
+/// @return 연결된 (또는 연결 중인) 소켓 디스크립터, 실패 시 -1
+static int dns_open(dns_addr *addrs, int n, int nonblock, int *in_progress)
+{
+  // 주소 리스트를 순회하며 연결을 시도
+  for (int i = 0; i < n; i++)
+  {
+    int fd = socket(addrs[i].family, addrs[i].socktype | (nonblock ? SOCK_NONBLOCK : 0), addrs[i].protocol);
+    if (fd < 0)
+      continue; // 실패하면 다음 주소로
+
+    if (connect(fd, (SA *)&addrs[i].addr, addrs[i].addrlen) == 0)
+    {
+      if (in_progress)
+        *in_progress = 0;
+      return fd;
+    }
+    if (nonblock && errno == EINPROGRESS)
+    {
+      *in_progress = 1;
+      return fd;
+    }
+
+    close(fd); // 연결 실패 시 소켓 닫기
+  }
+  return -1;
+}
+
+/// @brief URI 에 대한 진행 중인 miss 에 합류, 없으면 새로 만들어 리더가 됨
+/// @param uri 요청 URI
+/// @param follow 0 이면 이미 리더가 있을 때 합류하지 않음
+/// @param leader 서버에서 직접 가져와야 하면 1, 리더를 따라 읽으면 되면 0
+/// @return 진행 중인 miss 항목 (다 쓰면 inflight_release),
+///         follow 가 0 인데 리더가 있거나 hit-for-pass 표시가 있으면 NULL (합치지 않고 직접 가져옴)
+inflight_t *inflight_join(char *uri, int follow, int *leader)
+{
+  unsigned int hash = cache_hash(uri);
+  time_t now = time(NULL);
+  inflight_t *f, **pp, *expired = NULL;
+
+  pthread_mutex_lock(&inflight.lock);
+  for (pp = &inflight.table[hash % INFLIGHT_HASH_SIZE]; (f = *pp) != NULL;)
+  {
+    if (f->pass_until && f->pass_until <= now) // 지난 표시는 지나가며 치움 -> 해제는 락 밖에서
+    {
+      *pp = f->next;
+      f->linked = 0;
+      inflight.markers--;
+      f->next = expired;
+      expired = f;
+      continue;
+    }
+    if (f->hash == hash && !strcmp(f->uri, uri))
+      break;
+    pp = &f->next;
+  }
+
+  if (f && f->pass_until)
+  {
+    f = NULL;
+    atomic_fetch_add(&inflight.passed, 1);
+  }
+  else if (f && !follow)
+    f = NULL;
+  else if (f)
+  {
+    f->refcnt++;
+    *leader = 0;
+    atomic_fetch_add(&inflight.followers, 1);
+  }
+  else
+  {
+    f = Calloc(1, sizeof(inflight_t));
+    f->uri = strdup(uri);
+    f->hash = hash;
+    f->linked = 1;
+    f->refcnt = 1;
+    f->content_length = -1;
+    pthread_cond_init(&f->cond, NULL);
+    f->next = inflight.table[hash % INFLIGHT_HASH_SIZE];
+    inflight.table[hash % INFLIGHT_HASH_SIZE] = f;
+    *leader = 1;
+    atomic_fetch_add(&inflight.leaders, 1);
+  }
+  pthread_mutex_unlock(&inflight.lock);
+
+  while (expired)
+  {
+    inflight_t *next = expired->next;
+    inflight_release(expired); // 표시는 테이블의 참조 하나뿐
+    expired = next;
+  }
+  return f;
+}
+
+/// @brief 테이블에서 항목을 떼어 냄 -> 이후 같은 URI 요청은 캐시를 보거나 새 리더가 됨 (테이블 락 필요)
+/// @param f 진행 중인 miss 항목
+static void inflight_unlink(inflight_t *f)
+{
+  inflight_t **pp;
+
+  if (!f->linked)
+    return;
+  for (pp = &inflight.table[f->hash % INFLIGHT_HASH_SIZE]; *pp != f; pp = &(*pp)->next)
+    ;
+  *pp = f->next;
+  f->linked = 0;
+}
+
+/// @brief 리더가 받은 응답 헤더를 팔로워들에게 공개
+/// @param f 진행 중인 miss 항목
+/// @param hdr 상태 라인 + 헤더 (빈 줄 제외)
+/// @param hdr_len 헤더 길이
+/// @param content_length 본문 길이, 모르면 -1
+void inflight_headers(inflight_t *f, char *hdr, size_t hdr_len, long content_length)
+{
+  char *copy = Malloc(hdr_len);
+
+  memcpy(copy, hdr, hdr_len);
+  pthread_mutex_lock(&inflight.lock);
+  f->hdr = copy;
+  f->hdr_len = hdr_len;
+  f->content_length = content_length;
+  pthread_cond_broadcast(&f->cond);
+  pthread_mutex_unlock(&inflight.lock);
+}
+
+/// @brief 리더의 응답을 나눌 수 없음을 알림 (private, Set-Cookie 등)
+///        -> 테이블에서 떼어 내고, 기다리던 팔로워들은 각자 서버에서 받음
+/// @param f 진행 중인 miss 항목
+/// @param pass 1 이면 같은 자리에 hit-for-pass 표시를 걸어 HIT_FOR_PASS_TTL 동안 이 URI 의 miss 를 합치지 않음
+void inflight_unshared(inflight_t *f, int pass)
+{
+  inflight_t *marker = NULL;
+
+  if (pass)
+  {
+    marker = Calloc(1, sizeof(inflight_t));
+    marker->uri = strdup(f->uri);
+    marker->hash = f->hash;
+    marker->linked = 1;
+    marker->done = 1;
+    marker->refcnt = 1; // 테이블의 참조
+    marker->content_length = -1;
+    marker->pass_until = time(NULL) + HIT_FOR_PASS_TTL;
+    pthread_cond_init(&marker->cond, NULL);
+  }
+
+  pthread_mutex_lock(&inflight.lock);
+  inflight_unlink(f);
+  f->done = 1; // 헤더 없이 끝난 것으로 보여 팔로워들이 직접 가져오게 함
+  pthread_cond_broadcast(&f->cond);
+  if (marker && inflight.markers < HIT_FOR_PASS_MAX)
+  {
+    marker->next = inflight.table[f->hash % INFLIGHT_HASH_SIZE];
+    inflight.table[f->hash % INFLIGHT_HASH_SIZE] = marker;
+    inflight.markers++;
+    marker = NULL;
+  }
+  pthread_mutex_unlock(&inflight.lock);
+
+  if (marker) // 표시가 너무 많음 -> 걸지 않음
+    inflight_release(marker);
+}
+
+/// @brief 모든 팔로워가 지나간 앞쪽 조각을 해제 (테이블 락 필요)
+///        -> 버퍼가 INFLIGHT_MAX_BUFFER 를 넘으면 가장 뒤처진 팔로워들을 끊고 그 조각도 해제
+/// @param f 진행 중인 miss 항목
+static void inflight_trim(inflight_t *f)
+{
+  while (f->head != NULL && f->head != f->tail)
+  {
+    inflight_seg *seg = f->head;
+    size_t end = f->base + seg->len;
+    // 새로 합류하거나 아직 자리를 잡지 않은 팔로워는 처음부터 읽어야 함
+    int needed = f->linked || f->nreaders < f->refcnt - 1;
+
+    for (inflight_reader *r = f->readers; r != NULL && !needed; r = r->next)
+      needed = !r->cut && r->pos <= end; // 끝에 선 팔로워도 아직 이 조각을 가리키고 있을 수 있음
+    if (needed && f->body_len - f->base <= INFLIGHT_MAX_BUFFER)
+      break;
+
+    for (inflight_reader *r = f->readers; r != NULL; r = r->next)
+      if (!r->cut && r->pos <= end)
+      {
+        r->cut = 1;
+        atomic_fetch_add(&inflight.cut, 1);
+      }
+    f->head = seg->next;
+    f->base = end;
+    if (seg->pins) // 끊긴 팔로워가 아직 보내는 중
+      seg->orphan = 1;
+    else
+      Free(seg);
+  }
+}
+
+/// @brief 팔로워가 전송을 마친 조각을 내려놓음 (테이블 락 필요)
+/// @param seg 전송한 조각 (NULL 이면 무시)
+static void inflight_unpin(inflight_seg *seg)
+{
+  if (seg != NULL && --seg->pins == 0 && seg->orphan)
+    Free(seg);
+}
+
+/// @brief 리더가 받은 본문 바이트를 조각 끝에 덧붙이고 팔로워들을 깨움
+/// @param f 진행 중인 miss 항목
+/// @param data 본문 바이트 (chunked 는 풀어서)
+/// @param n 바이트 수
+void inflight_append(inflight_t *f, char *data, size_t n)
+{
+  pthread_mutex_lock(&inflight.lock);
+  while (n > 0)
+  {
+    size_t room;
+
+    if (f->tail == NULL || f->tail->len == INFLIGHT_SEG_SIZE)
+    {
+      inflight_seg *seg = Malloc(sizeof(inflight_seg));
+      seg->next = NULL;
+      seg->len = 0;
+      seg->pins = seg->orphan = 0;
+      if (f->tail)
+        f->tail->next = seg;
+      else
+        f->head = seg;
+      f->tail = seg;
+    }
+
+    room = INFLIGHT_SEG_SIZE - f->tail->len;
+    if (room > n)
+      room = n;
+    memcpy(f->tail->data + f->tail->len, data, room);
+    f->tail->len += room;
+    f->body_len += room;
+    data += room;
+    n -= room;
+  }
+
+  // 너무 커지면 새 팔로워는 받지 않고, 이미 따라 읽는 팔로워들이 지나간 앞쪽 조각부터 해제
+  if (f->body_len > INFLIGHT_MAX_BUFFER)
+    inflight_unlink(f);
+  inflight_trim(f);
+  pthread_cond_broadcast(&f->cond);
+  pthread_mutex_unlock(&inflight.lock);
+}
+
+/// @brief 아직 팔로워가 없으면 항목을 테이블에서 떼어 내 더 이상 합류하지 못하게 함
+///        -> 리더가 본문을 버퍼에 쌓지 않고 바로 넘겨도 됨
+/// @param f 진행 중인 miss 항목
+/// @return 떼어 냈으면 1, 이미 팔로워가 있으면 0
+int inflight_detach(inflight_t *f)
+{
+  int alone;
+
+  pthread_mutex_lock(&inflight.lock);
+  if ((alone = (f->refcnt == 1)))
+    inflight_unlink(f);
+  pthread_mutex_unlock(&inflight.lock);
+  return alone;
+}
+
+/// @brief 리더가 응답을 끝까지 받았음을 알림
+/// @param f 진행 중인 miss 항목
+void inflight_complete(inflight_t *f)
+{
+  pthread_mutex_lock(&inflight.lock);
+  f->complete = 1;
+  pthread_cond_broadcast(&f->cond);
+  pthread_mutex_unlock(&inflight.lock);
+}
+
+/// @brief 리더가 받는 응답을 따라 읽으며 클라이언트로 전송 -> 리더와 무관하게 클라이언트 속도대로 진행
+/// @param fd 클라이언트 소켓
+/// @param f 진행 중인 miss 항목 (참조를 잡고 있어야 함)
+/// @param me 이 팔로워의 진행 위치 (f->readers 에 등록됨)
+/// @param http11 클라이언트가 HTTP/1.1 이면 1
+/// @param keep_alive 클라이언트가 연결 유지를 원하면 1
+/// @return 연결을 유지할 수 있으면 1, 닫아야 하면 0, 리더가 헤더 전에 실패했으면 -1 (직접 가져와야 함)
+static int inflight_follow(int fd, inflight_t *f, inflight_reader *me, int http11, int keep_alive)
+{
+  char buf[MAXLINE];
+  inflight_seg *seg = NULL, *pinned = NULL;
+  size_t off = 0, n = 0;
+  int rechunk = 0;
+
+  pthread_mutex_lock(&inflight.lock);
+  while (f->hdr == NULL && !f->done)
+    pthread_cond_wait(&f->cond, &inflight.lock);
+  if (f->hdr == NULL)
+  {
+    pthread_mutex_unlock(&inflight.lock);
+    return -1;
+  }
+  pthread_mutex_unlock(&inflight.lock);
+  atomic_fetch_add(&inflight.coalesced, 1); // 서버 요청 하나를 아낌
+
+  // 본문 끝을 알리는 방법은 리더와 같음 -> Content-Length, chunked (HTTP/1.1), 연결 종료
+  if (f->content_length < 0)
+  {
+    if (keep_alive && http11)
+      rechunk = 1;
+    else
+      keep_alive = 0;
+  }
+  sprintf(buf, "%s%s\r\n", rechunk ? "Transfer-Encoding: chunked\r\n" : "",
+          keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+  struct iovec iov[2] = { { f->hdr, f->hdr_len }, { buf, strlen(buf) } };
+  if (rio_writev(fd, iov, 2) < 0)
+    return 0;
+
+  while (1)
+  {
+    char *data;
+
+    // 방금 보낸 만큼 위치를 옮기고, 아직 보내지 않은 바이트가 생기거나 리더가 끝날 때까지 대기
+    pthread_mutex_lock(&inflight.lock);
+    me->pos += n;
+    inflight_unpin(pinned);
+    pinned = NULL;
+    while (1)
+    {
+      if (me->cut || me->pos < f->base) // 너무 뒤처져 보낼 조각이 해제됨
+        break;
+      if (seg == NULL && f->head != NULL)
+        seg = f->head;
+      if (seg != NULL && off == INFLIGHT_SEG_SIZE && seg->next != NULL)
+      {
+        seg = seg->next;
+        off = 0;
+      }
+      if ((seg != NULL && off < seg->len) || f->complete || f->done)
+        break;
+      pthread_cond_wait(&f->cond, &inflight.lock);
+    }
+    if (me->cut || me->pos < f->base)
+    {
+      pthread_mutex_unlock(&inflight.lock);
+      return 0; // 잘린 응답이므로 연결을 닫아 알림
+    }
+    n = seg != NULL ? seg->len - off : 0;
+    if (n == 0)
+    {
+      int complete = f->complete;
+      pthread_mutex_unlock(&inflight.lock);
+      if (!complete) // 리더가 도중에 실패 -> 잘린 응답이므로 연결을 닫아 알림
+        return 0;
+      if (rechunk && rio_writen(fd, "0\r\n\r\n", 5) < 0)
+        return 0;
+      return keep_alive;
+    }
+    data = seg->data + off;
+    pinned = seg;
+    seg->pins++; // 보내는 동안 해제되지 않도록
+    pthread_mutex_unlock(&inflight.lock);
+
+    // 이미 채워진 조각 바이트는 바뀌지 않으므로 락 없이 전송
+    if (rechunk)
+    {
+      sprintf(buf, "%zx\r\n", n);
+      if (rio_writen(fd, buf, strlen(buf)) < 0)
+        break;
+    }
+    if (rio_writen(fd, data, n) < 0 || (rechunk && rio_writen(fd, "\r\n", 2) < 0))
+      break;
+    off += n;
+  }
+
+  pthread_mutex_lock(&inflight.lock);
+  inflight_unpin(pinned);
+  pthread_mutex_unlock(&inflight.lock);
+  return 0;
+}
+
+/// @brief 리더가 받는 응답을 따라 읽으며 클라이언트로 전송 -> 진행 위치를 등록해 두어 지나간 조각은 리더가 해제
+/// @param fd 클라이언트 소켓
+/// @param f 진행 중인 miss 항목 (참조를 잡고 있어야 함)
+/// @param http11 클라이언트가 HTTP/1.1 이면 1
+/// @param keep_alive 클라이언트가 연결 유지를 원하면 1
+/// @return 연결을 유지할 수 있으면 1, 닫아야 하면 0, 리더가 헤더 전에 실패했으면 -1 (직접 가져와야 함)
+int inflight_stream(int fd, inflight_t *f, int http11, int keep_alive)
+{
+  inflight_reader me = { 0, 0, NULL }, **pp;
+  int rc;
+
+  pthread_mutex_lock(&inflight.lock);
+  me.next = f->readers;
+  f->readers = &me;
+  f->nreaders++;
+  pthread_mutex_unlock(&inflight.lock);
+
+  rc = inflight_follow(fd, f, &me, http11, keep_alive);
+
+  pthread_mutex_lock(&inflight.lock);
+  for (pp = &f->readers; *pp != &me; pp = &(*pp)->next)
+    ;
+  *pp = me.next;
+  f->nreaders--;
+  pthread_mutex_unlock(&inflight.lock);
+  return rc;
+}
+
+/// @brief 리더가 끝났음을 알림 -> 테이블에서 빼고 기다리던 팔로워들을 깨움
+/// @param f 진행 중인 miss 항목
+void inflight_finish(inflight_t *f)
+{
+  pthread_mutex_lock(&inflight.lock);
+  inflight_unlink(f);
+  f->done = 1;
+  pthread_cond_broadcast(&f->cond);
+  pthread_mutex_unlock(&inflight.lock);
+}
+
+/// @brief 진행 중인 miss 항목의 참조를 내려놓음 -> 마지막이면 버퍼와 함께 해제
+/// @param f 진행 중인 miss 항목
+void inflight_release(inflight_t *f)
+{
+  int last;
+
+  pthread_mutex_lock(&inflight.lock);
+  last = (--f->refcnt == 0);
+  pthread_mutex_unlock(&inflight.lock);
+
+  if (last)
+  {
+    while (f->head)
+    {
+      inflight_seg *seg = f->head;
+      f->head = seg->next;
+      Free(seg);
+    }
+    pthread_cond_destroy(&f->cond);
+    free(f->hdr);
+    free(f->uri);
+    Free(f);
+  }
+}
+
+/// @brief 워커 쓰레드 함수 -> 연결 큐에서 연결을 꺼내 처리하는 것을 반복
+/// @param vargp 사용 안함
+/// @return NULL (반환하지 않음)
+void *thread(void *vargp)
+{
+  // Pthread_detach() : 종료 시 자동으로 자원 해제
+  // pthread_self() : 현재 스레드 ID 반환
+  Pthread_detach(pthread_self()); // 현재 쓰레드를 종료시 자동 자원 해제 
+
+  while (1)
+  {
+    int connfd = sbuf_remove(&sbuf); // 처리할 연결을 큐에서 꺼냄 (없으면 대기)
+    proxy(connfd); // 클라이언터 연결
+    Close(connfd); // 클라이언트와 연결된 소켓 닫기
+  }
+  return NULL;
+}
+
+/// @brief n개의 슬롯을 가진 빈 연결 큐 생성
+/// @param sp 초기화할 큐
+/// @param n 최대 슬롯 수
+void sbuf_init(sbuf_t *sp, int n)
+{
+  sp->buf = Calloc(n, sizeof(int));
+  sp->n = n;
+  sp->front = sp->rear = 0;  // front == rear 이면 비어 있음
+  Sem_init(&sp->mutex, 0, 1); // 이진 세마포어
+  Sem_init(&sp->slots, 0, n); // 처음엔 n개의 빈 슬롯
+  Sem_init(&sp->items, 0, 0); // 처음엔 항목 없음
+}
+
+/// @brief 큐 뒤에 연결을 넣음 -> 빈 슬롯이 없으면 기다리지 않고 실패
+/// @param sp 대상 큐
+/// @param item 넣을 연결 디스크립터
+/// @return 성공 시 0, 큐가 가득 찼으면 -1
+int sbuf_tryinsert(sbuf_t *sp, int item)
+{
+  if (sem_trywait(&sp->slots) < 0) // 빈 슬롯이 없으면 바로 반환
+    return -1;
+  P(&sp->mutex);
+  sp->buf[(++sp->rear) % (sp->n)] = item;
+  V(&sp->mutex);
+  V(&sp->items); // 대기 중인 워커 하나를 깨움
+  return 0;
+}
+
+/// @brief 큐 앞에서 연결을 꺼냄 -> 비어 있으면 대기
+/// @param sp 대상 큐
+/// @return 꺼낸 연결 디스크립터
+int sbuf_remove(sbuf_t *sp)
+{
+  int item;
+  P(&sp->items);
+  P(&sp->mutex);
+  item = sp->buf[(++sp->front) % (sp->n)];
+  V(&sp->mutex);
+  V(&sp->slots);
+  return item;
+}
+
+/// @brief 워커를 기다리는 연결이 있는지 확인
+/// @param sp 대상 큐
+/// @return 대기 중인 연결 수
+int sbuf_pending(sbuf_t *sp)
+{
+  int items = 0;
+
+  sem_getvalue(&sp->items, &items);
+  return items > 0 ? items : 0;
+}
+
+/// @brief URI 문자열의 해시 값 계산 (FNV-1a)
+/// @param uri 해시할 URI
+/// @return 32비트 해시 값
+static unsigned int cache_hash(const char *uri)
+{
+  unsigned int h = 2166136261u;
+  while (*uri)
+  {
+    h ^= (unsigned char)*uri++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/// @brief 해시 테이블에서 URI에 해당하는 블록 탐색 (락은 호출자가 잡음)
+/// @param sh 대상 샤드
+/// @param uri 찾을 URI
+/// @param hash 미리 계산한 URI 해시
+/// @return 찾은 블록, 없으면 NULL
+static cache_block *cache_lookup(cache_t *sh, const char *uri, unsigned int hash)
+{
+  cache_block *b = sh->table[hash & (sh->nbuckets - 1)];
+
+  // 해시가 같은 블록만 전체 문자열 비교
+  for (; b; b = b->hnext)
+    if (b->hash == hash && strcmp(b->uri, uri) == 0)
+      return b;
+  return NULL;
+}
+
+/// @brief 객체 수가 버킷 수를 넘으면 해시 테이블을 두 배로 늘림 (쓰기 락 필요)
+/// @param sh 대상 샤드
+static void cache_grow_table(cache_t *sh)
+{
+  size_t n = sh->nbuckets * 2;
+  cache_block **table = calloc(n, sizeof(cache_block *));
+
+  if (!table) // 늘리지 못해도 체인이 길어질 뿐 동작은 함
+    return;
+
+  for (size_t i = 0; i < sh->nbuckets; i++)
+  {
+    cache_block *b = sh->table[i], *next;
+    for (; b; b = next)
+    {
+      next = b->hnext;
+      b->hnext = table[b->hash & (n - 1)];
+      table[b->hash & (n - 1)] = b;
+    }
+  }
+
+  Free(sh->table);
+  sh->table = table;
+  sh->nbuckets = n;
+}
+
+/// @brief 객체 크기에 맞는 slab 크기 클래스 계산
+/// @param size 객체 크기
+/// @return 크기 클래스 번호 (청크 크기 = 64 << 번호)
+static int slab_class(size_t size)
+{
+  int c = 0;
+  while (((size_t)1 << (SLAB_MIN_SHIFT + c)) < size)
+    c++;
+  return c;
+}
+
+/// @brief slab에서 객체 본문을 담을 청크 할당 (쓰기 락 필요)
+/// @param sh 대상 샤드
+/// @param size 객체 크기
+/// @param chunk 할당된 청크 크기를 저장할 변수
+/// @return 청크 포인터, 실패 시 NULL
+static char *slab_alloc(cache_t *sh, size_t size, size_t *chunk)
+{
+  int c = slab_class(size);
+  slab_chunk *p;
+
+  *chunk = (size_t)1 << (SLAB_MIN_SHIFT + c);
+
+  // 같은 클래스의 빈 청크가 있으면 재사용
+  if ((p = sh->slab_free[c]) != NULL)
+  {
+    sh->slab_free[c] = p->next;
+    sh->slab_free_bytes -= *chunk;
+    return (char *)p;
+  }
+
+  // 예산을 넘기지 않도록 다른 클래스의 빈 청크를 먼저 반납
+  for (int i = SLAB_NCLASSES - 1; i >= 0 && sh->reserved + sh->slab_free_bytes + *chunk > sh->budget; i--)
+  {
+    while ((p = sh->slab_free[i]) != NULL && sh->reserved + sh->slab_free_bytes + *chunk > sh->budget)
+    {
+      sh->slab_free[i] = p->next;
+      sh->slab_free_bytes -= (size_t)1 << (SLAB_MIN_SHIFT + i);
+      free(p);
+    }
+  }
+
+  return malloc(*chunk);
+}
+
+/// @brief 청크를 크기 클래스의 빈 리스트로 돌려놓음 (쓰기 락 필요)
+/// @param sh 대상 샤드
+/// @param buf 돌려놓을 청크
+/// @param chunk 청크 크기
+static void slab_free(cache_t *sh, char *buf, size_t chunk)
+{
+  int c = slab_class(chunk);
+  slab_chunk *p = (slab_chunk *)buf;
+
+  p->next = sh->slab_free[c];
+  sh->slab_free[c] = p;
+  sh->slab_free_bytes += chunk;
+}
+
+/// @brief 블록이 캐시 예산에서 차지하는 바이트 (청크 + URI + 블록 헤더)
+/// @param b 대상 블록
+/// @return 예약 바이트
+static size_t cache_block_reserved(cache_block *b)
+{
+  return b->chunk + strlen(b->uri) + 1 + sizeof(cache_block);
+}
+
+/// @brief SIEVE 큐에서 블록을 떼어냄
+/// @param sh 대상 샤드
+/// @param b 떼어낼 블록
+static void sieve_unlink(cache_t *sh, cache_block *b)
+{
+  if (b->prev)
+    b->prev->next = b->next;
+  else
+    sh->head = b->next;
+
+  if (b->next)
+    b->next->prev = b->prev;
+  else
+    sh->tail = b->prev;
+}
+
+/// @brief 블록을 SIEVE 큐 맨 앞(가장 최근에 들어온 쪽)에 붙임
+/// @param sh 대상 샤드
+/// @param b 붙일 블록
+static void sieve_push_front(cache_t *sh, cache_block *b)
+{
+  b->prev = NULL;
+  b->next = sh->head;
+  if (sh->head)
+    sh->head->prev = b;
+  sh->head = b;
+  if (!sh->tail)
+    sh->tail = b;
+}
+
+/// @brief SIEVE 정책으로 축출할 블록 선택 (쓰기 락 필요)
+///        hand 부터 head 방향으로 가며 참조 비트가 선 블록은 비트만 지우고 지나가고, 처음 만난 안 선 블록을 고름
+/// @param sh 대상 샤드 (비어 있지 않아야 함)
+/// @return 축출할 블록
+static cache_block *sieve_victim(cache_t *sh)
+{
+  cache_block *b = sh->hand ? sh->hand : sh->tail;
+
+  while (atomic_load_explicit(&b->visited, memory_order_relaxed))
+  {
+    atomic_store_explicit(&b->visited, 0, memory_order_relaxed);
+    b = b->prev ? b->prev : sh->tail; // head 를 지나면 tail 로 돌아감
+  }
+
+  sh->hand = b; // cache_evict 가 hand 를 다음 블록으로 옮김
+  return b;
+}
+
+/// @brief 참조가 모두 사라진 블록의 메모리를 돌려놓음 (쓰기 락 필요)
+/// @param sh 블록이 속한 샤드
+/// @param b 해제할 블록
+static void cache_block_free(cache_t *sh, cache_block *b)
+{
+  slab_free(sh, b->buf, b->chunk);
+  Free(b->uri);
+  Free(b);
+}
+
+/// @brief 블록을 해시 테이블과 SIEVE 큐에서 제거 (쓰기 락 필요)
+/// @param sh 대상 샤드
+/// @param b 제거할 블록
+static void cache_evict(cache_t *sh, cache_block *b)
+{
+  cache_block **pp = &sh->table[b->hash & (sh->nbuckets - 1)];
+
+  while (*pp != b)
+    pp = &(*pp)->hnext;
+  *pp = b->hnext;
+
+  if (sh->hand == b) // 축출 포인터가 가리키던 블록이면 한 칸 앞으로
+    sh->hand = b->prev;
+  sieve_unlink(sh, b);
+  sh->count--;
+  sh->total_size -= b->size + strlen(b->uri) + 1;
+  sh->reserved -= cache_block_reserved(b);
+
+  // 캐시 자신의 참조를 내려놓음 -> 전송 중인 hit가 있으면 마지막 cache_release가 해제
+  if (atomic_fetch_sub(&b->refcnt, 1) == 1)
+    cache_block_free(sh, b);
+}
+
+/// @brief URI 해시로 담당 샤드 선택 -> 버킷 선택에 쓰는 하위 비트와 겹치지 않게 상위 비트 사용
+/// @param hash URI 해시
+/// @return 담당 샤드
+static cache_t *cache_shard(unsigned int hash)
+{
+  return &cache_shards[(hash >> 16) % cache_nshards];
+}
+
+/// @brief 캐시 초기화 함수
+/// @param budget 전체 캐시 바이트 예산
+/// @param nshards 샤드 수
+void cache_init(size_t budget, int nshards) 
+{
+  // 샤드 하나가 가장 큰 객체를 최소 두 개는 담을 수 있도록 샤드 수를 제한
+  size_t max_chunk = (size_t)1 << (SLAB_MIN_SHIFT + SLAB_NCLASSES - 1);
+  if ((size_t)nshards > budget / (2 * max_chunk))
+    nshards = budget / (2 * max_chunk) > 0 ? budget / (2 * max_chunk) : 1;
+
+  cache_nshards = nshards;
+  cache_shards = Calloc(nshards, sizeof(cache_t));
+
+  for (int i = 0; i < nshards; i++)
+  {
+    cache_t *sh = &cache_shards[i];
+
+    // 전체 예산을 샤드에 나눠줌 -> 샤드 예산의 합이 항상 전체 예산과 같도록 나머지는 앞 샤드에
+    sh->budget = budget / nshards + ((size_t)i < budget % nshards);
+    sh->total_size = 0; // 전채 캐시 크기 0
+    sh->reserved = 0;
+    sh->count = 0;
+    sh->head = sh->tail = sh->hand = NULL;
+    sh->nbuckets = CACHE_HASH_SIZE;
+    sh->table = Calloc(sh->nbuckets, sizeof(cache_block *));
+    sh->slab_free_bytes = 0;
+    pthread_rwlock_init(&sh->lock, NULL); // 읽기 쓰기 락 초기화
+  }
+}
+
+/// @brief 캐시에 해당 URI 존재하는지 확인
+/// @param uri 요청된 URI
+/// @param stale stale 항목도 받아 재검증할 수 있으면 그 여부를 받을 곳, NULL 이면 stale 항목은 miss
+/// @return hit 이면 참조를 하나 잡은 블록 (다 쓰면 cache_release), miss 면 NULL
+cache_block *cache_find(char *uri, int *stale)
+{
+  unsigned int hash = cache_hash(uri); // 락 밖에서 해시 계산
+  cache_t *sh = cache_shard(hash); // 이 URI를 담당하는 샤드의 락만 잡음
+  cache_block *b;
+
+  pthread_rwlock_rdlock(&sh->lock); // 읽기 락 획득 -> 여러 스레드가 동시에 캐시를 읽을 수 있도록 허용
+  
+  if (stale)
+    *stale = 0;
+  if ((b = cache_lookup(sh, uri, hash)) != NULL && atomic_load(&b->expires) <= time(NULL))
+  {
+    atomic_fetch_add(&admission.stale, 1);
+    if (stale)
+      *stale = 1; // 호출자가 서버에 재검증한 뒤 보냄
+    else
+      b = NULL; // 검증할 수 없으면 miss -> 새 응답이 같은 키로 교체
+  }
+  if (b != NULL)
+  {
+    // 복사 대신 참조만 잡음 -> 락은 짧게, 전송은 락 밖에서 공유 버퍼로
+    atomic_fetch_add(&b->refcnt, 1);
+
+    // 최근 사용 표시 -> 리스트는 건드리지 않고 참조 비트만 세움 (공유 메타데이터 쓰기는 이것 하나)
+    atomic_store_explicit(&b->visited, 1, memory_order_relaxed);
+  }
+
+  pthread_rwlock_unlock(&sh->lock); // -> 읽기 락 해제
+  return b;
+}
+
+/// @brief 재검증된 항목의 신선도를 제자리에서 갱신 -> 본문은 복사하지 않음
+/// @param b 참조를 잡은 블록
+/// @param expires 새 신선도 끝
+void cache_refresh(cache_block *b, time_t expires)
+{
+  atomic_store(&b->expires, expires); // 락 없이 읽는 hit 도 찢어지지 않은 값을 봄
+}
+
+/// @brief cache_find로 잡은 참조를 내려놓음 -> 이미 축출된 블록이면 마지막 참조가 메모리 해제
+/// @param b 참조를 내려놓을 블록
+void cache_release(cache_block *b)
+{
+  if (atomic_fetch_sub(&b->refcnt, 1) == 1)
+  {
+    cache_t *sh = b->shard;
+    pthread_rwlock_wrlock(&sh->lock); // slab 빈 리스트는 쓰기 락으로 보호
+    cache_block_free(sh, b);
+    pthread_rwlock_unlock(&sh->lock);
+  }
+}
+
+/// @brief 새로운 데이터를 캐시에 삽입
+/// @param uri 요청된 객체의 URI
+/// @param buf 객체 버퍼
+/// @param size 객체 데이터 크기
+/// @param hdr_len 본문 시작 위치 (헤더 + 빈 줄 길이), 모르면 0
+/// @param expires 신선도가 끝나는 시각 (response_cache_until)
+void cache_insert(char *uri, char *buf, size_t size, size_t hdr_len, time_t expires)
+{
+  // 객체 크기가 너무 크면 리턴 -> 예외처리
+  if (size > MAX_OBJECT_SIZE)
+    return;
+
+  unsigned int hash = cache_hash(uri);
+  cache_t *sh = cache_shard(hash);
+  size_t urilen = strlen(uri);
+  size_t need = ((size_t)1 << (SLAB_MIN_SHIFT + slab_class(size))) + urilen + 1 + sizeof(cache_block);
+  cache_block *b;
+
+  if (need > sh->budget) // 예산보다 큰 객체는 넣지 않음
+    return;
+  
+  // 쓰기 락 획득 (다른 쓰기 / 읽기 차단)
+  pthread_rwlock_wrlock(&sh->lock);
+
+  // 다른 스레드가 먼저 같은 URI를 넣었다면 기존 블록을 교체
+  if ((b = cache_lookup(sh, uri, hash)) != NULL)
+    cache_evict(sh, b);
+
+  // 바이트 예산이 찰 때까지 SIEVE가 고른 블록을 축출 -> 객체 수 제한은 없음
+  while (sh->tail && sh->reserved + need > sh->budget)
+  {
+    cache_block *victim = sieve_victim(sh);
+    disk_demote(victim); // 디스크 캐시가 켜져 있으면 버리지 않고 세그먼트 파일로 내림
+    cache_evict(sh, victim);
+  }
+
+  b = malloc(sizeof(cache_block));
+  if (b && (b->uri = malloc(urilen + 1)) != NULL && (b->buf = slab_alloc(sh, size, &b->chunk)) != NULL)
+  {
+    // 선택된 블록에 새 데이터 저장
+    memcpy(b->uri, uri, urilen + 1); // URI 저장
+    memcpy(b->buf, buf, size);       // 데이터 복사
+    b->size = size;                  // 크기 저장
+    b->hdr_len = hdr_len;
+    b->expires = expires;
+    b->hash = hash;
+    b->shard = sh;
+    atomic_init(&b->refcnt, 1);      // 캐시 자신의 참조
+    atomic_init(&b->visited, 0);
+
+    if (sh->count >= sh->nbuckets) // 평균 체인 길이를 1 이하로 유지
+      cache_grow_table(sh);
+    b->hnext = sh->table[hash & (sh->nbuckets - 1)]; // 해시 버킷에 연결
+    sh->table[hash & (sh->nbuckets - 1)] = b;
+    sieve_push_front(sh, b);         // SIEVE 큐 맨 앞에 넣음
+    sh->count++;
+    sh->total_size += size + urilen + 1; // 총 캐시 크기 증가
+    sh->reserved += cache_block_reserved(b);
+  }
+  else if (b) // 메모리 부족 -> 넣지 않음
+  {
+    if (b->uri)
+      free(b->uri);
+    free(b);
+  }
+
+  // 쓰기 락 해제
+  pthread_rwlock_unlock(&sh->lock);
+}
+
+/// @brief 큰 객체 캐시 초기화
+/// @param budget 큰 객체 캐시 바이트 예산 (0 이면 사용하지 않음)
+void large_init(size_t budget)
+{
+  large.budget = budget;
+}
+
+/// @brief 큰 객체 해시 테이블에서 URI 탐색 (락 필요)
+/// @param uri 찾을 URI
+/// @param hash 미리 계산한 URI 해시
+/// @return 찾은 객체, 없으면 NULL
+static large_object *large_lookup(const char *uri, unsigned int hash)
+{
+  large_object *lo;
+
+  for (lo = large.table[hash % LARGE_HASH_SIZE]; lo; lo = lo->hnext)
+    if (lo->hash == hash && !strcmp(lo->uri, uri))
+      return lo;
+  return NULL;
+}
+
+/// @brief 조각의 참조를 내려놓음 -> 마지막이면 해제 (이미 큐와 슬롯에서 빠져 있으므로 락 불필요)
+/// @param seg 참조를 내려놓을 조각
+static void large_seg_release(large_seg *seg)
+{
+  if (atomic_fetch_sub(&seg->refcnt, 1) == 1)
+    Free(seg);
+}
+
+/// @brief 모든 참조가 사라진 객체 해제 (슬롯은 모두 비어 있어야 함)
+/// @param lo 해제할 객체
+static void large_object_free(large_object *lo)
+{
+  for (size_t i = 0; i < lo->nsegs; i++) // 만드는 도중 버린 객체는 큐에 없는 조각을 들고 있음
+    if (lo->segs[i])
+      large_seg_release(lo->segs[i]);
+  Free(lo->segs);
+  Free(lo->hdr);
+  Free(lo->etag);
+  Free(lo->last_modified);
+  Free(lo->uri);
+  Free(lo);
+}
+
+/// @brief 객체를 해시 테이블에서 떼어 내고 캐시의 참조를 내려놓음 (락 필요)
+/// @param lo 떼어 낼 객체
+static void large_unlink(large_object *lo)
+{
+  large_object **pp = &large.table[lo->hash % LARGE_HASH_SIZE];
+
+  while (*pp != lo)
+    pp = &(*pp)->hnext;
+  *pp = lo->hnext;
+  lo->linked = 0;
+  large.count--;
+
+  if (atomic_fetch_sub(&lo->refcnt, 1) == 1)
+    large_object_free(lo);
+}
+
+/// @brief 조각 하나를 SIEVE 큐와 객체 슬롯에서 빼냄 -> 남은 조각이 없으면 객체도 제거 (락 필요)
+/// @param seg 축출할 조각
+static void large_evict(large_seg *seg)
+{
+  large_object *lo = seg->obj;
+
+  if (large.hand == seg)
+    large.hand = seg->prev;
+  if (seg->prev)
+    seg->prev->next = seg->next;
+  else
+    large.head = seg->next;
+  if (seg->next)
+    seg->next->prev = seg->prev;
+  else
+    large.tail = seg->prev;
+
+  lo->segs[seg->index] = NULL;
+  lo->resident--;
+  large.used -= seg->len;
+  large.nsegs--;
+  large_seg_release(seg); // 슬롯의 참조 -> 전송 중인 hit 가 있으면 그쪽이 해제
+
+  if (lo->resident == 0 && lo->linked)
+    large_unlink(lo);
+}
+
+/// @brief SIEVE 정책으로 조각 하나를 축출 -> 자주 읽히는 앞부분 조각은 참조 비트 덕분에 남음 (락 필요)
+static void large_evict_one(void)
+{
+  large_seg *seg = large.hand ? large.hand : large.tail;
+
+  while (atomic_load_explicit(&seg->visited, memory_order_relaxed))
+  {
+    atomic_store_explicit(&seg->visited, 0, memory_order_relaxed);
+    seg = seg->prev ? seg->prev : large.tail;
+  }
+  large.hand = seg;
+  large_evict(seg);
+}
+
+/// @brief len 바이트가 예산 안에 들어오도록 조각을 축출 (락 필요)
+/// @param len 새로 넣을 바이트 수
+static void large_make_room(size_t len)
+{
+  while (large.tail && large.used + len > large.budget)
+    large_evict_one();
+}
+
+/// @brief 조각을 SIEVE 큐 맨 앞과 객체 슬롯에 넣음 -> 먼저 large_make_room 으로 자리를 만들어 둠 (락 필요)
+/// @param seg 넣을 조각 (슬롯의 참조 1 을 들고 있어야 함)
+static void large_admit(large_seg *seg)
+{
+  large_object *lo = seg->obj;
+
+  seg->prev = NULL;
+  seg->next = large.head;
+  if (large.head)
+    large.head->prev = seg;
+  large.head = seg;
+  if (!large.tail)
+    large.tail = seg;
+
+  lo->segs[seg->index] = seg;
+  lo->resident++;
+  large.used += seg->len;
+  large.nsegs++;
+}
+
+/// @brief 조각 하나를 새로 만듦
+/// @param lo 조각이 속할 객체
+/// @param index 객체 안에서의 조각 번호
+/// @return 비어 있는 조각 (참조 1)
+static large_seg *large_seg_new(large_object *lo, size_t index)
+{
+  size_t len = lo->body_len - index * LARGE_SEG_SIZE;
+  large_seg *seg = Malloc(sizeof(large_seg) + (len < LARGE_SEG_SIZE ? len : LARGE_SEG_SIZE));
+
+  seg->obj = lo;
+  seg->index = index;
+  seg->len = 0;
+  atomic_init(&seg->refcnt, 1);
+  atomic_init(&seg->visited, 0);
+  return seg;
+}
+
+/// @brief 본문 길이가 content_length 인 객체를 큰 객체 캐시에 넣을 수 있는지 확인
+///        -> 한 객체가 예산의 절반을 넘으면 다른 객체들을 모두 밀어내므로 넣지 않음
+/// @param content_length 본문 길이
+/// @return 넣을 수 있으면 1
+int large_admits(long content_length)
+{
+  return content_length > 0 && (size_t)content_length <= large.budget / 2;
+}
+
+/// @brief MAX_OBJECT_SIZE 보다 큰 응답을 조각으로 모으기 시작
+/// @param uri 캐시 키
+/// @param hdr 상태 줄 + 헤더 (빈 줄 제외, Content-Length 포함)
+/// @param hdr_len 헤더 길이
+/// @param content_length 본문 길이
+/// @param expires 신선도가 끝나는 시각
+/// @return 아직 캐시에 보이지 않는 객체 (large_append 후 large_publish), 넣을 수 없으면 NULL
+large_object *large_begin(char *uri, char *hdr, size_t hdr_len, long content_length, time_t expires)
+{
+  char value[MAXLINE];
+  large_object *lo;
+
+  if (!large_admits(content_length))
+    return NULL;
+
+  lo = Calloc(1, sizeof(large_object));
+  lo->uri = strdup(uri);
+  lo->hash = cache_hash(uri);
+  lo->hdr = Malloc(hdr_len + 2);
+  memcpy(lo->hdr, hdr, hdr_len);
+  memcpy(lo->hdr + hdr_len, "\r\n", 2);
+  lo->hdr_len = hdr_len + 2;
+  lo->body_len = content_length;
+  if (header_value(hdr, hdr_len, "ETag:", value))
+    lo->etag = strdup(value);
+  if (header_value(hdr, hdr_len, "Last-Modified:", value))
+    lo->last_modified = strdup(value);
+  lo->expires = expires;
+  lo->nsegs = (content_length + LARGE_SEG_SIZE - 1) / LARGE_SEG_SIZE;
+  lo->segs = Calloc(lo->nsegs, sizeof(large_seg *));
+  atomic_init(&lo->refcnt, 1); // 캐시에 들어가면 캐시의 참조가 됨
+  return lo;
+}
+
+/// @brief 모으는 중인 객체 끝에 본문 바이트를 덧붙임 (아직 다른 쓰레드에 보이지 않으므로 락 불필요)
+/// @param lo large_begin 으로 만든 객체
+/// @param data 본문 바이트
+/// @param n 바이트 수
+void large_append(large_object *lo, char *data, size_t n)
+{
+  while (n > 0 && lo->filled < lo->body_len)
+  {
+    size_t index = lo->filled / LARGE_SEG_SIZE, k;
+    large_seg *seg;
+
+    if ((seg = lo->segs[index]) == NULL)
+      seg = lo->segs[index] = large_seg_new(lo, index);
+
+    k = LARGE_SEG_SIZE - seg->len;
+    if (k > n)
+      k = n;
+    if (k > lo->body_len - lo->filled)
+      k = lo->body_len - lo->filled;
+    memcpy(seg->data + seg->len, data, k);
+    seg->len += k;
+    lo->filled += k;
+    data += k;
+    n -= k;
+  }
+}
+
+/// @brief 객체의 조각을 모두 빼고 해시 테이블에서 떼어 냄 (락 필요, 호출자가 참조를 잡고 있어야 함)
+/// @param lo 뺄 객체
+static void large_remove(large_object *lo)
+{
+  for (size_t i = 0; i < lo->nsegs; i++)
+    if (lo->segs[i])
+      large_evict(lo->segs[i]);
+  if (lo->linked)
+    large_unlink(lo);
+}
+
+/// @brief 모으던 객체를 버림 (응답이 도중에 끊김)
+/// @param lo large_begin 으로 만든 객체 (NULL 이면 무시)
+void large_abort(large_object *lo)
+{
+  if (lo)
+    large_object_free(lo);
+}
+
+/// @brief 본문을 끝까지 모은 객체를 큰 객체 캐시에 넣음 -> 같은 URI 의 이전 객체는 교체
+/// @param lo large_begin 으로 만든 객체 (이후 호출자는 쓰지 않음)
+void large_publish(large_object *lo)
+{
+  large_object *old;
+
+  if (lo->filled != lo->body_len)
+  {
+    large_object_free(lo);
+    return;
+  }
+
+  pthread_mutex_lock(&large.lock);
+  if ((old = large_lookup(lo->uri, lo->hash)) != NULL)
+  {
+    atomic_fetch_add(&old->refcnt, 1); // 마지막 조각을 빼는 순간 해제되지 않도록
+    large_remove(old);
+    if (atomic_fetch_sub(&old->refcnt, 1) == 1)
+      large_object_free(old);
+  }
+
+  large_make_room(lo->body_len); // 다른 객체의 조각을 먼저 밀어냄 -> 넣는 도중 자기 조각이 밀려나지 않음
+  lo->linked = 1;
+  lo->hnext = large.table[lo->hash % LARGE_HASH_SIZE];
+  large.table[lo->hash % LARGE_HASH_SIZE] = lo;
+  large.count++;
+
+  // 조각들을 슬롯에서 꺼내 예산 안에서 다시 넣음 -> 앞 조각부터
+  for (size_t i = 0; i < lo->nsegs; i++)
+  {
+    large_seg *seg = lo->segs[i];
+    lo->segs[i] = NULL;
+    large_admit(seg);
+  }
+  pthread_mutex_unlock(&large.lock);
+}
+
+/// @brief 큰 객체 캐시에서 URI 탐색
+/// @param uri 요청 URI
+/// @param stale stale 객체도 받아 재검증할 수 있으면 그 여부를 받을 곳, NULL 이면 stale 객체는 miss
+/// @return 참조를 하나 잡은 객체 (다 쓰면 large_release), 없으면 NULL
+large_object *large_find(char *uri, int *stale)
+{
+  unsigned int hash = cache_hash(uri);
+  large_object *lo;
+
+  if (large.budget == 0)
+    return NULL;
+
+  if (stale)
+    *stale = 0;
+  pthread_mutex_lock(&large.lock);
+  if ((lo = large_lookup(uri, hash)) != NULL && atomic_load(&lo->expires) <= time(NULL))
+  {
+    atomic_fetch_add(&admission.stale, 1);
+    if (stale)
+      *stale = 1;
+    else
+      lo = NULL;
+  }
+  if (lo != NULL)
+    atomic_fetch_add(&lo->refcnt, 1);
+  pthread_mutex_unlock(&large.lock);
+  return lo;
+}
+
+/// @brief 재검증된 객체의 신선도를 제자리에서 갱신
+/// @param lo 참조를 잡은 객체
+/// @param expires 새 신선도 끝
+void large_refresh(large_object *lo, time_t expires)
+{
+  atomic_store(&lo->expires, expires);
+}
+
+/// @brief large_find 로 잡은 참조를 내려놓음
+/// @param lo 참조를 내려놓을 객체
+void large_release(large_object *lo)
+{
+  if (atomic_fetch_sub(&lo->refcnt, 1) == 1)
+    large_object_free(lo);
+}
+
+/// @brief 디스크 캐시 초기화 -> 디렉터리를 만들고 이전 실행이 남긴 세그먼트 파일을 지움
+/// @param dir 세그먼트 파일을 둘 디렉터리
+/// @param budget 세그먼트 파일들이 차지할 최대 바이트
+void disk_init(char *dir, size_t budget)
+{
+  DIR *d;
+  struct dirent *de;
+  pthread_t tid;
+
+  if (mkdir(dir, 0700) < 0 && errno != EEXIST)
+  {
+    fprintf(stderr, "disk cache: cannot create %s: %s\n", dir, strerror(errno));
+    return;
+  }
+  if ((d = opendir(dir)) != NULL)
+  {
+    while ((de = readdir(d)) != NULL)
+    {
+      char path[MAXLINE];
+      if (strncmp(de->d_name, "seg-", 4))
+        continue;
+      snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+      unlink(path);
+    }
+    closedir(d);
+  }
+
+  // 예산이 작으면 세그먼트도 작게 -> 가장 오래된 세그먼트 하나를 버려도 예산의 1/4 이하만 잃음
+  disk.seg_size = budget / 4 < DISK_SEG_SIZE ? budget / 4 : DISK_SEG_SIZE;
+  if (disk.seg_size < 4 * (MAX_OBJECT_SIZE + MAXLINE))
+    disk.seg_size = 4 * (MAX_OBJECT_SIZE + MAXLINE);
+  disk.dir = strdup(dir);
+  disk.budget = budget;
+  Pthread_create(&tid, NULL, disk_writer, NULL);
+}
+
+/// @brief 디스크 색인에서 URI 탐색 (락 필요)
+/// @param uri 찾을 URI
+/// @param hash 미리 계산한 URI 해시
+/// @return 색인 항목을 가리키는 포인터의 주소 (없으면 NULL 을 가리킴)
+static disk_entry **disk_lookup(const char *uri, unsigned int hash)
+{
+  disk_entry **pp;
+
+  for (pp = &disk.table[hash % DISK_HASH_SIZE]; *pp; pp = &(*pp)->hnext)
+    if ((*pp)->hash == hash && !strcmp((*pp)->uri, uri))
+      break;
+  return pp;
+}
+
+/// @brief 색인 항목 제거 (락 필요)
+/// @param pp 제거할 항목을 가리키는 포인터의 주소
+static void disk_remove(disk_entry **pp)
+{
+  disk_entry *e = *pp;
+
+  *pp = e->hnext;
+  disk.count--;
+  disk.live -= e->size;
+  Free(e->uri);
+  Free(e);
+}
+
+/// @brief 세그먼트에 대한 참조를 내려놓음 -> 버려진 세그먼트의 마지막 참조면 매핑 해제 (락 필요)
+/// @param seg 대상 세그먼트
+static void disk_segment_put(disk_segment *seg)
+{
+  if (--seg->refcnt == 0)
+  {
+    munmap(seg->map, disk.seg_size);
+    close(seg->fd);
+    Free(seg);
+  }
+}
+
+/// @brief 가장 오래된 세그먼트를 버림 -> 그 안의 객체들은 색인에서 빠지고 파일은 바로 지움 (락 필요)
+static void disk_drop_oldest(void)
+{
+  disk_segment *seg = disk.oldest;
+  char path[MAXLINE];
+
+  for (int i = 0; i < DISK_HASH_SIZE; i++)
+  {
+    disk_entry **pp = &disk.table[i];
+    while (*pp)
+    {
+      if ((*pp)->seg == seg)
+        disk_remove(pp);
+      else
+        pp = &(*pp)->hnext;
+    }
+  }
+
+  if ((disk.oldest = seg->next) == NULL)
+    disk.current = NULL;
+  disk.nsegs--;
+  atomic_fetch_add(&disk.dropped, 1);
+  snprintf(path, sizeof(path), "%s/seg-%06u", disk.dir, seg->id);
+  unlink(path); // 전송 중인 hit 이 있으면 매핑은 마지막 참조까지 유지
+  disk_segment_put(seg);
+}
+
+/// @brief 새 세그먼트 파일을 만들어 쓰기 대상으로 삼음 -> 예산을 넘으면 가장 오래된 세그먼트부터 버림
+/// @return 성공 0, 실패 -1
+static int disk_segment_new(void)
+{
+  disk_segment *seg = Calloc(1, sizeof(disk_segment));
+  char path[MAXLINE];
+
+  snprintf(path, sizeof(path), "%s/seg-%06u", disk.dir, disk.next_id);
+  if ((seg->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+      ftruncate(seg->fd, disk.seg_size) < 0 ||
+      (seg->map = mmap(NULL, disk.seg_size, PROT_READ, MAP_SHARED, seg->fd, 0)) == MAP_FAILED)
+  {
+    if (seg->fd >= 0)
+    {
+      close(seg->fd);
+      unlink(path);
+    }
+    Free(seg);
+    return -1;
+  }
+  seg->id = disk.next_id++;
+  seg->refcnt = 1; // 세그먼트 목록의 참조
+
+  pthread_mutex_lock(&disk.lock);
+  while (disk.oldest && (disk.nsegs + 1) * disk.seg_size > disk.budget)
+    disk_drop_oldest();
+  if (disk.current)
+    disk.current->next = seg;
+  else
+    disk.oldest = seg;
+  disk.current = seg;
+  disk.nsegs++;
+  pthread_mutex_unlock(&disk.lock);
+  return 0;
+}
+
+/// @brief 메모리 캐시에서 축출된 블록 하나를 현재 세그먼트 끝에 덧붙이고 색인에 등록 (쓰기 쓰레드 전용)
+///        기록 형식: disk_record -> URI -> 저장된 응답 (상태 줄 + 헤더 + 본문), 8 바이트 정렬
+/// @param b 참조를 잡은 블록
+static void disk_append(cache_block *b)
+{
+  disk_record rec = { DISK_MAGIC, strlen(b->uri), b->size, b->hdr_len, atomic_load(&b->expires) };
+  size_t len = (sizeof(rec) + rec.uri_len + b->size + 7) & ~(size_t)7;
+  unsigned int hash = b->hash;
+  disk_segment *seg = disk.current;
+  disk_entry **pp, *e;
+  size_t off;
+
+  if (seg == NULL || seg->used + len > disk.seg_size)
+  {
+    if (disk_segment_new() < 0)
+      return;
+    seg = disk.current;
+  }
+
+  off = seg->used;
+  if (pwrite(seg->fd, &rec, sizeof(rec), off) != sizeof(rec) ||
+      pwrite(seg->fd, b->uri, rec.uri_len, off + sizeof(rec)) != (ssize_t)rec.uri_len ||
+      pwrite(seg->fd, b->buf, b->size, off + sizeof(rec) + rec.uri_len) != (ssize_t)b->size)
+    return; // 디스크 오류 -> 이 객체만 버림
+  seg->used += len; // 쓰기 쓰레드만 바꾸므로 락 밖에서 갱신
+
+  e = Malloc(sizeof(disk_entry));
+  e->uri = strdup(b->uri);
+  e->hash = hash;
+  e->seg = seg;
+  e->off = off + sizeof(rec) + rec.uri_len;
+  e->size = b->size;
+  e->hdr_len = b->hdr_len;
+  e->expires = atomic_load(&b->expires);
+  e->hits = 0;
+
+  // 쓰기가 끝난 뒤에 색인에 올림 -> 읽는 쪽은 항상 완전히 기록된 영역만 봄
+  pthread_mutex_lock(&disk.lock);
+  if (*(pp = disk_lookup(e->uri, hash)) != NULL) // 같은 URI 의 이전 사본은 세그먼트에 쓰레기로 남음
+    disk_remove(pp);
+  e->hnext = disk.table[hash % DISK_HASH_SIZE];
+  disk.table[hash % DISK_HASH_SIZE] = e;
+  disk.count++;
+  disk.live += e->size;
+  pthread_mutex_unlock(&disk.lock);
+  atomic_fetch_add(&disk.demoted, 1);
+}
+
+/// @brief 디스크 쓰기 쓰레드 -> 축출된 블록을 차례로 세그먼트에 기록 (요청 경로는 디스크 I/O 를 기다리지 않음)
+static void *disk_writer(void *vargp)
+{
+  Pthread_detach(pthread_self());
+
+  while (1)
+  {
+    disk_job *j;
+
+    pthread_mutex_lock(&disk.qlock);
+    while (disk.qhead == NULL)
+      pthread_cond_wait(&disk.qcond, &disk.qlock);
+    j = disk.qhead;
+    if ((disk.qhead = j->next) == NULL)
+      disk.qtail = NULL;
+    disk.qbytes -= j->b->size;
+    pthread_mutex_unlock(&disk.qlock);
+
+    disk_append(j->b);
+    cache_release(j->b);
+    Free(j);
+  }
+  return NULL;
+}
+
+/// @brief 메모리 캐시에서 축출되는 블록을 디스크 쓰기 대기열에 넣음 (샤드 쓰기 락 안에서 호출)
+///        -> 블록 참조를 하나 잡아 두므로 축출 후에도 쓰기 쓰레드가 기록할 때까지 유지
+/// @param b 축출될 블록
+void disk_demote(cache_block *b)
+{
+  disk_job *j;
+
+  if (disk.dir == NULL || b->hdr_len == 0 || atomic_load(&b->expires) <= time(NULL))
+    return;
+
+  pthread_mutex_lock(&disk.qlock);
+  if (disk.qbytes + b->size > DISK_QUEUE_MAX) // 디스크가 못 따라오면 축출된 객체는 그냥 버림
+  {
+    pthread_mutex_unlock(&disk.qlock);
+    atomic_fetch_add(&disk.skipped, 1);
+    return;
+  }
+  j = Malloc(sizeof(disk_job));
+  j->b = b;
+  j->next = NULL;
+  atomic_fetch_add(&b->refcnt, 1);
+  if (disk.qtail)
+    disk.qtail->next = j;
+  else
+    disk.qhead = j;
+  disk.qtail = j;
+  disk.qbytes += b->size;
+  pthread_cond_signal(&disk.qcond);
+  pthread_mutex_unlock(&disk.qlock);
+}
+
+/// @brief 디스크 캐시에서 URI 탐색 -> 찾으면 세그먼트 참조를 잡고 매핑된 영역을 돌려줌
+///        stale 이거나 DISK_PROMOTE_HITS 번째 hit 이면 색인에서 빼고 promote 를 세움 (호출자가 메모리 캐시로 올림)
+/// @param uri 요청 URI
+/// @param h 찾은 객체 정보를 받을 곳 (다 쓰면 disk_release)
+/// @param promote hit 수와 관계없이 메모리 캐시로 올리려면 1
+/// @return 찾으면 1, 없으면 0
+int disk_find(char *uri, disk_hit *h, int promote)
+{
+  unsigned int hash = cache_hash(uri);
+  disk_entry **pp, *e;
+
+  if (disk.dir == NULL)
+    return 0;
+
+  pthread_mutex_lock(&disk.lock);
+  if ((e = *(pp = disk_lookup(uri, hash))) == NULL)
+  {
+    pthread_mutex_unlock(&disk.lock);
+    return 0;
+  }
+  h->seg = e->seg;
+  h->seg->refcnt++;
+  h->data = e->seg->map + e->off;
+  h->size = e->size;
+  h->hdr_len = e->hdr_len;
+  h->expires = e->expires;
+  h->promote = promote || ++e->hits >= DISK_PROMOTE_HITS || e->expires <= time(NULL);
+  if (h->promote)
+    disk_remove(pp);
+  pthread_mutex_unlock(&disk.lock);
+
+  atomic_fetch_add(h->promote ? &disk.promoted : &disk.hits, 1);
+  return 1;
+}
+
+/// @brief 디스크 캐시 색인에 URI 가 있는지만 확인 -> 매핑된 영역은 읽지 않으므로 디스크 I/O 없음
+/// @param uri 요청 URI
+/// @return 있으면 1
+int disk_has(char *uri)
+{
+  int found;
+
+  if (disk.dir == NULL)
+    return 0;
+  pthread_mutex_lock(&disk.lock);
+  found = *disk_lookup(uri, cache_hash(uri)) != NULL;
+  pthread_mutex_unlock(&disk.lock);
+  return found;
+}
+
+/// @brief disk_find 로 잡은 세그먼트 참조를 내려놓음
+/// @param h 찾은 객체 정보
+void disk_release(disk_hit *h)
+{
+  pthread_mutex_lock(&disk.lock);
+  disk_segment_put(h->seg);
+  pthread_mutex_unlock(&disk.lock);
+}
+
+/// @brief 디스크 캐시의 객체를 메모리 캐시로 올림
+/// @param uri 요청 URI
+/// @return 올렸으면 1 (cache_find 로 찾을 수 있음), 없으면 0
+int disk_promote(char *uri)
+{
+  disk_hit h;
+
+  if (!disk_find(uri, &h, 1))
+    return 0;
+  cache_insert(uri, h.data, h.size, h.hdr_len, h.expires);
+  disk_release(&h);
+  return 1;
+}
+
+/// @brief 스냅숏 파일을 읽어 신선한 항목만 메모리 캐시에 다시 넣음 -> 파일을 통째로 매핑해 복사 한 번으로 적재
+/// @param path 스냅숏 파일 경로 (없으면 빈 캐시로 시작)
+void snapshot_load(char *path)
+{
+  struct stat st;
+  snapshot_header *h;
+  snapshot_entry *idx;
+  char *map;
+  int fd;
+  time_t now = time(NULL);
+  struct timeval t0, t1;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    return;
+  gettimeofday(&t0, NULL);
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(snapshot_header) ||
+      (map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+  {
+    close(fd);
+    return;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL); // 앞에서부터 한 번만 읽음 -> 미리 읽기를 크게
+
+  // 다른 버전이나 잘린 파일은 통째로 무시
+  h = (snapshot_header *)map;
+  if (memcmp(h->magic, SNAPSHOT_MAGIC, sizeof(h->magic)) || h->version != SNAPSHOT_VERSION ||
+      h->entry_size != sizeof(snapshot_entry) || h->index_off > (size_t)st.st_size ||
+      h->count > ((size_t)st.st_size - h->index_off) / sizeof(snapshot_entry))
+  {
+    fprintf(stderr, "snapshot: ignoring %s (unknown version or truncated)\n", path);
+    munmap(map, st.st_size);
+    close(fd);
+    return;
+  }
+
+  idx = (snapshot_entry *)(map + h->index_off);
+  for (size_t i = 0; i < h->count; i++)
+  {
+    snapshot_entry *e = &idx[i];
+
+    if (e->uri_off + e->uri_len >= h->index_off || map[e->uri_off + e->uri_len] != '\0' ||
+        e->off + e->size > h->index_off || e->hdr_len > e->size)
+      continue; // 망가진 항목
+    if (e->expires <= now) // 내려가 있던 동안 신선도가 지난 항목은 버림
+    {
+      atomic_fetch_add(&snapshot.expired, 1);
+      continue;
+    }
+    cache_insert(map + e->uri_off, map + e->off, e->size, e->hdr_len, e->expires);
+    atomic_fetch_add(&snapshot.loaded, 1);
+  }
+
+  munmap(map, st.st_size);
+  close(fd);
+  gettimeofday(&t1, NULL);
+  fprintf(stderr, "snapshot: loaded %ld objects, dropped %ld stale from %s in %ld ms\n",
+          atomic_load(&snapshot.loaded), atomic_load(&snapshot.expired), path,
+          (t1.tv_sec - t0.tv_sec) * 1000 + (t1.tv_usec - t0.tv_usec) / 1000);
+}
+
+/// @brief 메모리 캐시 전체를 스냅숏 파일로 기록 -> 임시 파일에 쓰고 rename 으로 교체
+///        형식: snapshot_header -> 기록들 (URI + NUL, 저장된 응답, 8 바이트 정렬) -> snapshot_entry 색인
+///        샤드마다 읽기 락 안에서는 블록 참조만 모으고, 파일 쓰기는 락 밖에서
+/// @param path 스냅숏 파일 경로
+/// @return 성공 0, 실패 -1
+int snapshot_save(char *path)
+{
+  char tmp[MAXLINE];
+  static const char pad[8];
+  snapshot_header h;
+  snapshot_entry *idx = NULL;
+  size_t count = 0, cap = 0, off = sizeof(snapshot_header);
+  time_t now = time(NULL);
+  int fd, rc = 0;
+
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+  {
+    fprintf(stderr, "snapshot: cannot create %s: %s\n", tmp, strerror(errno));
+    return -1;
+  }
+  memset(&h, 0, sizeof(h));
+  if (rio_writen(fd, (char *)&h, sizeof(h)) < 0) // 머리 자리만 비워 둠
+    rc = -1;
+
+  for (int i = 0; i < cache_nshards && rc == 0; i++)
+  {
+    cache_t *sh = &cache_shards[i];
+    cache_block **blocks;
+    size_t n = 0;
+
+    // 가장 먼저 들어온 블록부터 -> 다시 읽을 때 같은 순서로 넣어 SIEVE 큐 순서를 유지
+    pthread_rwlock_rdlock(&sh->lock);
+    blocks = Malloc((sh->count + 1) * sizeof(cache_block *));
+    for (cache_block *b = sh->tail; b; b = b->prev)
+    {
+      if (b->hdr_len == 0 || atomic_load(&b->expires) <= now)
+        continue;
+      atomic_fetch_add(&b->refcnt, 1);
+      blocks[n++] = b;
+    }
+    pthread_rwlock_unlock(&sh->lock);
+
+    for (size_t j = 0; j < n; j++)
+    {
+      cache_block *b = blocks[j];
+      size_t uri_len = strlen(b->uri);
+      size_t len = uri_len + 1 + b->size;
+
+      if (rc == 0)
+      {
+        if (count == cap)
+          idx = Realloc(idx, (cap = cap ? 2 * cap : 1024) * sizeof(snapshot_entry));
+        idx[count].uri_off = off;
+        idx[count].uri_len = uri_len;
+        idx[count].off = off + uri_len + 1;
+        idx[count].size = b->size;
+        idx[count].hdr_len = b->hdr_len;
+        idx[count].expires = atomic_load(&b->expires);
+        if (rio_writen(fd, b->uri, uri_len + 1) < 0 || rio_writen(fd, b->buf, b->size) < 0 ||
+            rio_writen(fd, (char *)pad, -len & 7) < 0)
+          rc = -1;
+        off += (len + 7) & ~(size_t)7;
+        count++;
+      }
+      cache_release(b);
+    }
+    Free(blocks);
+  }
+
+  // 색인은 맨 뒤, 머리는 마지막에 채워 씀 -> 중간에 멈춘 파일은 magic 이 없어 읽지 않음
+  memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+  h.version = SNAPSHOT_VERSION;
+  h.entry_size = sizeof(snapshot_entry);
+  h.count = count;
+  h.index_off = off;
+  h.saved = now;
+  if (rc == 0 && (rio_writen(fd, (char *)idx, count * sizeof(snapshot_entry)) < 0 ||
+                  pwrite(fd, &h, sizeof(h), 0) != sizeof(h) || fsync(fd) < 0))
+    rc = -1;
+  Free(idx);
+  close(fd);
+
+  if (rc == 0 && rename(tmp, path) == 0)
+    fprintf(stderr, "snapshot: saved %zu objects (%zu bytes) to %s\n", count, off, path);
+  else
+  {
+    fprintf(stderr, "snapshot: cannot write %s: %s\n", path, strerror(errno));
+    unlink(tmp);
+    rc = -1;
+  }
+  return rc;
+}
+
+/// @brief 종료 시그널 대기 쓰레드 -> SIGTERM / SIGINT 를 받으면 캐시를 기록하고 프로세스 종료
+///        시그널 핸들러 대신 sigwait 으로 받으므로 락과 malloc 을 그대로 쓸 수 있음
+static void *snapshot_waiter(void *vargp)
+{
+  int sig;
+
+  Pthread_detach(pthread_self());
+  sigwait(&snapshot.sigs, &sig);
+  snapshot_save(snapshot.path);
+  exit(0);
+}
+
+/// @brief 스냅숏 사용 준비 -> 다른 쓰레드를 만들기 전에 호출해야 모든 쓰레드가 종료 시그널을 막은 채로 시작
+/// @param path 스냅숏 파일 경로
+void snapshot_init(char *path)
+{
+  snapshot.path = path;
+  sigemptyset(&snapshot.sigs);
+  sigaddset(&snapshot.sigs, SIGTERM);
+  sigaddset(&snapshot.sigs, SIGINT);
+  pthread_sigmask(SIG_BLOCK, &snapshot.sigs, NULL);
+}
+
+/// @brief 스냅숏을 적재하고 종료 시그널 대기 쓰레드 시작 (캐시 초기화 이후)
+void snapshot_start(void)
+{
+  pthread_t tid;
+
+  snapshot_load(snapshot.path);
+  Pthread_create(&tid, NULL, snapshot_waiter, NULL); // 적재 중에 온 시그널은 막혀 있다가 여기서 받음
+}
+
+/// @brief 조각 하나에 대한 참조를 얻음 -> 읽는 동안 축출되어도 메모리는 유지
+/// @param lo 참조를 잡은 객체
+/// @param index 조각 번호
+/// @return 조각 (다 쓰면 large_seg_release), 축출되었으면 NULL
+static large_seg *large_get_seg(large_object *lo, size_t index)
+{
+  large_seg *seg;
+
+  pthread_mutex_lock(&large.lock);
+  if ((seg = lo->segs[index]) != NULL)
+  {
+    atomic_fetch_add(&seg->refcnt, 1);
+    atomic_store_explicit(&seg->visited, 1, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&large.lock);
+  return seg;
+}
+
+/// @brief 다시 받아 온 본문 조각을 비어 있는 슬롯에 채움
+/// @param lo 참조를 잡은 객체
+/// @param index 조각 번호
+/// @param data 조각 데이터 (조각 전체)
+/// @param len 조각 길이
+static void large_refill(large_object *lo, size_t index, char *data, size_t len)
+{
+  large_seg *seg;
+
+  pthread_mutex_lock(&large.lock);
+  large_make_room(len); // 이 객체의 마지막 조각이 밀려나 객체가 빠질 수 있으므로 그 뒤에 확인
+  if (lo->linked && lo->segs[index] == NULL)
+  {
+    seg = large_seg_new(lo, index);
+    memcpy(seg->data, data, len);
+    seg->len = len;
+    large_admit(seg);
+    atomic_fetch_add(&large.refills, 1);
+  }
+  pthread_mutex_unlock(&large.lock);
+}
+
+/// @brief 큰 객체를 조각 단위로 클라이언트에 전송 -> Range 요청이면 해당 구간만 206 으로
+/// @param fd 클라이언트 소켓
+/// @param lo 참조를 잡은 객체
+/// @param keep_alive 클라이언트 연결을 유지하려면 1
+/// @param range 클라이언트 Range 헤더 값 (없으면 빈 문자열)
+/// @param sent 축출된 조각을 만났을 때 이어서 보내야 할 본문 위치
+/// @param stop 클라이언트에게 보낼 본문 끝 위치 (미포함)
+/// @return 연결을 유지할 수 있으면 1, 닫아야 하면 0, 축출된 조각이 있으면 -1 (sent 부터 서버에서 받아야 함)
+int send_large(int fd, large_object *lo, int keep_alive, char *range, size_t *sent, size_t *stop)
+{
+  char *conn_hdr = keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+  size_t start = 0, end = lo->body_len;
+  int ranged = -1;
+
+  if (*range && response_status(lo->hdr) == 200)
+    ranged = parse_range(range, lo->body_len, &start, &end);
+
+  if (ranged < 0)
+  {
+    struct iovec iov[2] = { { lo->hdr, lo->hdr_len - 2 }, { conn_hdr, strlen(conn_hdr) } };
+    if (rio_writev(fd, iov, 2) < 0)
+      return 0;
+  }
+  else if (send_range_headers(fd, lo->hdr, lo->hdr_len - 2, ranged, start, end, lo->body_len, conn_hdr, NULL) < 0)
+    return 0;
+  if (ranged == 0) // 416 은 본문 없음
+    return keep_alive;
+
+  for (size_t i = start / LARGE_SEG_SIZE; i * LARGE_SEG_SIZE < end; i++)
+  {
+    large_seg *seg = large_get_seg(lo, i);
+    int rc;
+
+    if (seg == NULL)
+    {
+      *sent = i * LARGE_SEG_SIZE > start ? i * LARGE_SEG_SIZE : start;
+      *stop = end;
+      atomic_fetch_add(&large.partial_hits, 1);
+      return -1;
+    }
+    rc = write_slice(fd, seg->data, seg->len, i * LARGE_SEG_SIZE, start, end);
+    large_seg_release(seg);
+    if (rc < 0)
+      return 0;
+  }
+  atomic_fetch_add(&large.hits, 1);
+  return keep_alive;
+}
+
+/// @brief 이어 받을 때 If-Range 로 보낼 검증자 -> If-Range 는 강한 비교라서 약한 ETag 대신 Last-Modified
+/// @param lo 큰 객체
+/// @param name 검증자를 담은 응답 헤더 이름을 받을 곳 ("ETag:" 또는 "Last-Modified:")
+/// @return 검증자 값, 없으면 NULL
+static char *large_validator(large_object *lo, char **name)
+{
+  if (lo->etag && strncmp(lo->etag, "W/", 2))
+  {
+    *name = "ETag:";
+    return lo->etag;
+  }
+  *name = "Last-Modified:";
+  return lo->last_modified;
+}
+
+/// @brief 서버에 조각 경계 from 부터의 본문을 요청해 [offset, stop) 을 클라이언트로 보내고 빠진 조각을 채움
+///        -> 클라이언트가 일부만 원해도 객체 끝까지 받아 캐시를 채움
+/// @param fd 클라이언트 소켓
+/// @param serverfd 서버 소켓
+/// @param request Range (와 If-Range) 헤더를 붙인 요청 메시지
+/// @param lo 참조를 잡은 객체
+/// @param from 서버에 요청한 본문 위치 (조각 경계)
+/// @param offset 클라이언트에게 이어서 보낼 본문 위치
+/// @param stop 클라이언트에게 보낼 본문 끝 위치 (미포함)
+/// @param reusable 응답을 정확히 다 읽었고 서버가 연결을 유지하면 1
+/// @return 성공 0, 클라이언트에 아무것도 보내기 전 서버 쪽 실패 -1 (재시도 가능), 그 외 실패 -2
+///         (서버의 객체가 바뀌었으면 캐시에서도 버림)
+static int large_relay_tail(int fd, int serverfd, char *request, large_object *lo, size_t from,
+                            size_t offset, size_t stop, int *reusable)
+{
+  char buf[MAXLINE], *line, value[MAXLINE];
+  char *segbuf, *name, *validator = large_validator(lo, &name);
+  rio_t server_rio;
+  ssize_t n;
+  http_response resp;
+  size_t pos = from, seglen = 0;
+  size_t first = 0, last = 0, total = 0; // Content-Range: bytes first-last/total
+  int has_range = 0, same = 0; // same -> 응답의 검증자가 저장된 것과 같음
+
+  *reusable = 0;
+  if (rio_writen(serverfd, request, strlen(request)) < 0)
+    return -1;
+  rio_readinitb(&server_rio, serverfd);
+  if (response_getline(&server_rio, &line) <= 0)
+    return -1;
+  response_init(&resp);
+  response_status_line(&resp, line);
+
+  while ((n = response_getline(&server_rio, &line)) > 0 && strcmp(line, "\r"))
+  {
+    response_header(&resp, line);
+    if (!strncasecmp(line, "Content-Range:", 14))
+      has_range = sscanf(line + 14, " bytes %zu-%zu/%zu", &first, &last, &total) == 3;
+    else if (validator && header_value(line, strlen(line), name, value))
+      same = !strcmp(value, validator);
+  }
+  if (n <= 0)
+    return -2;
+
+  // Range 를 모르는 서버의 200 -> 검증자가 같으면 같은 객체이므로 처음부터 받으며 앞부분은 조각만 채움
+  if (resp.status == 200 && same && resp.content_length >= 0 && (size_t)resp.content_length == lo->body_len)
+    pos = 0;
+  // If-Range 가 맞지 않아 200 으로 온 새 객체, 또는 다른 위치 / 다른 길이의 206 -> 서버의 객체가 바뀜
+  //   이미 보낸 앞부분과도, 남아 있는 조각과도 이어 붙일 수 없으므로 객체를 캐시에서 버림
+  else if (resp.status == 200 || (resp.status == 206 && (!has_range || first != from || total != lo->body_len)))
+  {
+    pthread_mutex_lock(&large.lock);
+    large_remove(lo);
+    pthread_mutex_unlock(&large.lock);
+    return -2;
+  }
+  else if (resp.status != 206 || last + 1 != lo->body_len || resp.content_length < 0 ||
+           (size_t)resp.content_length != lo->body_len - from)
+    return -2;
+
+  segbuf = Malloc(LARGE_SEG_SIZE);
+  while (pos < lo->body_len)
+  {
+    size_t want = lo->body_len - pos, done = 0;
+
+    if ((n = rio_readnb(&server_rio, buf, want < MAXLINE ? want : MAXLINE)) <= 0)
+      break;
+    if (write_slice(fd, buf, n, pos, offset, stop) < 0)
+      break;
+
+    while (done < (size_t)n) // 조각 경계마다 빈 슬롯을 채움
+    {
+      size_t k = LARGE_SEG_SIZE - seglen;
+      if (k > n - done)
+        k = n - done;
+      memcpy(segbuf + seglen, buf + done, k);
+      seglen += k;
+      done += k;
+      if (seglen == LARGE_SEG_SIZE || pos + done == lo->body_len)
+      {
+        large_refill(lo, (pos + done - 1) / LARGE_SEG_SIZE, segbuf, seglen);
+        seglen = 0;
+      }
+    }
+    pos += n;
+  }
+  Free(segbuf);
+
+  if (pos < lo->body_len)
+    return -2;
+  *reusable = !resp.conn_close && (resp.major > 1 || resp.minor >= 1 || resp.keep_alive) && server_rio.rio_cnt == 0;
+  return 0;
+}
+
+/// @brief 일부 조각이 축출된 큰 객체의 나머지를 서버에서 받아 이어서 전송
+/// @param fd 클라이언트 소켓 (헤더와 offset 까지의 본문은 이미 보냄)
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param request 서버로 보낼 요청 메시지
+/// @param lo 참조를 잡은 객체
+/// @param offset 이어서 보낼 본문 위치
+/// @param stop 클라이언트에게 보낼 본문 끝 위치 (미포함)
+/// @param keep_alive 클라이언트 연결을 유지하려면 1
+/// @return 연결을 유지할 수 있으면 1, 닫아야 하면 0
+int large_refetch(int fd, char *hostname, char *port, upstream_request *request, large_object *lo,
+                  size_t offset, size_t stop, int keep_alive)
+{
+  char http_request[MAXLINE], ranged[3 * MAXLINE], range[2 * MAXLINE];
+  char *name, *validator = large_validator(lo, &name);
+  size_t from = offset - offset % LARGE_SEG_SIZE; // 조각을 통째로 채울 수 있도록 조각 경계부터
+  int serverfd, rc, reused, reusable;
+
+  // 서버의 객체가 그대로일 때만 206 -> 바뀌었으면 200 으로 전체가 와서 large_relay_tail 이 객체를 버림
+  if (validator)
+    snprintf(range, sizeof(range), "Range: bytes=%zu-\r\nIf-Range: %s\r\n", from, validator);
+  else
+    snprintf(range, sizeof(range), "Range: bytes=%zu-\r\n", from);
+  request_flatten(request, http_request, sizeof(http_request));
+  add_request_header(ranged, http_request, range);
+
+  for (int attempt = 0; attempt < 2; attempt++)
+  {
+    if ((serverfd = upstream_acquire(hostname, port, &reused)) < 0)
+      return 0; // 이미 헤더를 보냈으므로 연결을 닫아 잘린 응답임을 알림
+
+    rc = large_relay_tail(fd, serverfd, ranged, lo, from, offset, stop, &reusable);
+    if (rc == 0 && reusable)
+      upstream_release(hostname, port, serverfd);
+    else
+      Close(serverfd);
+
+    if (rc == 0)
+      return keep_alive;
+    if (rc != -1 || !reused)
+      return 0;
+  }
+  return 0;
+}
+
+/// @brief 로그 수준 이름을 값으로 바꿈
+/// @param name "off", "error", "info", "debug"
+/// @return 로그 수준, 알 수 없는 이름이면 -1
+int log_parse_level(const char *name)
+{
+  for (int i = LOG_OFF; i <= LOG_DEBUG; i++)
+    if (!strcasecmp(name, log_level_names[i]))
+      return i;
+  return -1;
+}
+
+/// @brief 처음 기록하는 쓰레드의 링을 만들어 목록 앞에 끼워 넣음 (CAS, 락 없음)
+/// @return 이 쓰레드의 링
+static log_ring *log_attach(void)
+{
+  log_ring *r = Calloc(1, sizeof(log_ring));
+
+  r->next = atomic_load(&logger.rings);
+  while (!atomic_compare_exchange_weak(&logger.rings, &r->next, r))
+    ;
+  pthread_setspecific(logger.key, r); // 쓰레드가 끝나면 log_detach
+  return log_self = r;
+}
+
+/// @brief 쓰레드 종료 시 그 쓰레드의 링을 dead 로 표시 (pthread 키 소멸자) -> 해제는 남은 줄을 내보낸 쓰기 쓰레드가 함
+/// @param vargp 끝나는 쓰레드의 링
+static void log_detach(void *vargp)
+{
+  log_ring *r = vargp;
+
+  atomic_store_explicit(&r->dead, 1, memory_order_release);
+}
+
+/// @brief 로그 한 줄을 이 쓰레드의 링에 채움 -> 출력은 쓰기 쓰레드가 하므로 요청 경로는 I/O 를 기다리지 않음
+///        링이 가득 차 있으면 기다리지 않고 그 줄을 버림
+/// @param level 로그 수준
+/// @param fmt printf 형식 (줄바꿈으로 끝남)
+void log_printf(int level, const char *fmt, ...)
+{
+  log_ring *r;
+  size_t head, slot;
+  va_list ap;
+  int n;
+
+  if (!log_enabled(level))
+    return;
+  r = log_self ? log_self : log_attach();
+  head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == LOG_RING_SIZE)
+  {
+    atomic_fetch_add(&logger.dropped, 1);
+    return;
+  }
+
+  slot = head % LOG_RING_SIZE;
+  va_start(ap, fmt);
+  n = vsnprintf(r->lines[slot], LOG_LINE_MAX, fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return;
+  if (n >= LOG_LINE_MAX) // 잘린 줄도 줄바꿈으로 끝나도록
+  {
+    n = LOG_LINE_MAX - 1;
+    r->lines[slot][n - 1] = '\n';
+  }
+  r->lens[slot] = n;
+  atomic_store_explicit(&r->head, head + 1, memory_order_release); // 줄 내용이 먼저 보이도록
+}
+
+/// @brief 로그 쓰기 쓰레드 -> 각 쓰레드의 링에 쌓인 줄들을 링 안에서 바로 writev 로 내보냄
+///        모든 링이 비어 있으면 LOG_FLUSH_MS 동안 쉼
+static void *log_writer(void *vargp)
+{
+  struct iovec iov[LOG_RING_SIZE];
+
+  Pthread_detach(pthread_self());
+
+  while (1)
+  {
+    int idle = 1;
+
+    log_ring *prev = NULL, *r = atomic_load(&logger.rings);
+
+    while (r != NULL)
+    {
+      int dead = atomic_load_explicit(&r->dead, memory_order_acquire); // head 보다 먼저 읽음 -> dead 뒤에 채운 줄은 없음
+      size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+      size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+      int cnt = 0;
+
+      if (head == tail)
       {
-        max_lru = cache.blocks[i].lru;
-        del_index = i;
+        log_ring *next = r->next, *expected = r;
+        int unlinked = 1;
+
+        // 끝난 쓰레드의 빈 링은 목록에서 빼서 해제 -> 맨 앞이면 그 사이 새 링이 끼어들지 않았을 때만 (아니면 다음 바퀴에)
+        if (dead)
+        {
+          if (prev)
+            prev->next = next;
+          else
+            unlinked = atomic_compare_exchange_strong(&logger.rings, &expected, next);
+          if (unlinked)
+          {
+            free(r);
+            r = next;
+            continue;
+          }
+        }
+        prev = r;
+        r = next;
+        continue;
       }
+      for (size_t i = tail; i != head; i++)
+        iov[cnt++] = (struct iovec){ r->lines[i % LOG_RING_SIZE], r->lens[i % LOG_RING_SIZE] };
+      rio_writev(logger.fd, iov, cnt); // 출력이 실패해도 줄은 버리고 계속
+      atomic_fetch_add(&logger.written, cnt);
+      atomic_store_explicit(&r->tail, head, memory_order_release); // 내보낸 칸을 쓰레드에게 돌려줌
+      idle = 0;
+      prev = r; // dead 링이면 다음 바퀴에 비어 있는 것을 보고 해제
+      r = r->next;
     }
-    
-    // 삭제할 블록이 없으면 종료
-    if (del_index == -1)
+    if (idle)
+      usleep(LOG_FLUSH_MS * 1000);
+  }
+  return NULL;
+}
+
+/// @brief 로거 초기화 -> 실행 중에 수준을 올릴 수 있도록 꺼져 있어도 쓰기 쓰레드는 만듦
+/// @param level 시작 로그 수준
+void log_init(int level)
+{
+  pthread_t tid;
+
+  atomic_store(&logger.level, level);
+  pthread_key_create(&logger.key, log_detach); // 로그를 남길 쓰레드들을 만들기 전에
+  Pthread_create(&tid, NULL, log_writer, NULL);
+}
+
+/// @brief 연결 상대가 같은 호스트 (루프백 주소) 인지 확인
+/// @param fd 클라이언트 소켓
+/// @return 루프백이면 1
+static int peer_is_loopback(int fd)
+{
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof(addr);
+
+  if (getpeername(fd, (struct sockaddr *)&addr, &len) < 0)
+    return 0;
+  if (addr.ss_family == AF_INET)
+    return (ntohl(((struct sockaddr_in *)&addr)->sin_addr.s_addr) >> 24) == 127;
+  if (addr.ss_family == AF_INET6)
+  {
+    struct in6_addr *a = &((struct sockaddr_in6 *)&addr)->sin6_addr;
+    return IN6_IS_ADDR_LOOPBACK(a) || (IN6_IS_ADDR_V4MAPPED(a) && a->s6_addr[12] == 127);
+  }
+  return 0;
+}
+
+/// @brief 프록시 통계 요청인지 확인 -> "?log-level=NAME" 이 붙어 있으면 실행 중에 로그 수준도 바꿈
+///        통계와 로그 수준 변경은 프록시가 도는 호스트 (루프백) 에서 온 연결에만 허용
+/// @param fd 클라이언트 소켓
+/// @param uri 요청 URI
+/// @return 통계 요청이면 1, 다른 호스트에서 온 통계 요청이면 -1 (403), 아니면 0
+int stats_request(int fd, const char *uri)
+{
+  size_t len = sizeof(STATS_PATH) - 1;
+  int level;
+
+  if (strncmp(uri, STATS_PATH, len) || (uri[len] && uri[len] != '?'))
+    return 0;
+  if (!peer_is_loopback(fd))
+    return -1;
+  if (!strncmp(uri + len, "?log-level=", 11) && (level = log_parse_level(uri + len + 11)) >= 0)
+    atomic_store(&logger.level, level);
+  return 1;
+}
+
+/// @brief 프록시 통계를 text/plain HTTP 응답으로 작성
+/// @param buf 응답을 쓸 버퍼
+/// @param maxlen 버퍼 크기
+/// @return 응답 길이
+int proxy_stats(char *buf, size_t maxlen)
+{
+  char body[MAXBUF];
+  int len = 0;
+
+  size_t count = 0, budget = 0, used = 0, reserved = 0, slab_free_bytes = 0;
+
+  // 샤드 별로 잠깐씩 읽기 락을 잡고 합산
+  for (int i = 0; i < cache_nshards; i++)
+  {
+    cache_t *sh = &cache_shards[i];
+    pthread_rwlock_rdlock(&sh->lock);
+    count += sh->count;
+    budget += sh->budget;
+    used += sh->total_size;
+    reserved += sh->reserved;
+    slab_free_bytes += sh->slab_free_bytes;
+    pthread_rwlock_unlock(&sh->lock);
+  }
+
+  len += snprintf(body + len, sizeof(body) - len, "cache_shards: %d\n", cache_nshards);
+  len += snprintf(body + len, sizeof(body) - len, "cache_objects: %zu\n", count);
+  len += snprintf(body + len, sizeof(body) - len, "cache_budget_bytes: %zu\n", budget);
+  len += snprintf(body + len, sizeof(body) - len, "cache_used_bytes: %zu\n", used);
+  len += snprintf(body + len, sizeof(body) - len, "cache_reserved_bytes: %zu\n", reserved);
+  len += snprintf(body + len, sizeof(body) - len, "cache_slab_free_bytes: %zu\n", slab_free_bytes);
+  len += snprintf(body + len, sizeof(body) - len, "cache_memory_efficiency: %.1f%%\n",
+                  reserved + slab_free_bytes ? 100.0 * used / (reserved + slab_free_bytes) : 100.0);
+
+  long revalidations = atomic_load(&admission.revalidations), not_modified = atomic_load(&admission.not_modified);
+  len += snprintf(body + len, sizeof(body) - len, "cache_admitted: %ld\n", atomic_load(&admission.stored));
+  len += snprintf(body + len, sizeof(body) - len, "cache_refused: %ld\n", atomic_load(&admission.refused));
+  len += snprintf(body + len, sizeof(body) - len, "cache_stale_hits: %ld\n", atomic_load(&admission.stale));
+  len += snprintf(body + len, sizeof(body) - len, "cache_client_not_modified: %ld\n", atomic_load(&admission.client_304));
+  len += snprintf(body + len, sizeof(body) - len, "cache_head_hits: %ld\n", atomic_load(&admission.head_hits));
+  len += snprintf(body + len, sizeof(body) - len, "cache_revalidations: %ld\n", revalidations);
+  len += snprintf(body + len, sizeof(body) - len, "cache_revalidated_not_modified: %ld\n", not_modified);
+  len += snprintf(body + len, sizeof(body) - len, "cache_revalidation_success: %.1f%%\n",
+                  revalidations ? 100.0 * not_modified / revalidations : 0.0);
+
+  len += snprintf(body + len, sizeof(body) - len, "log_level: %s\n", log_level_names[atomic_load(&logger.level)]);
+  len += snprintf(body + len, sizeof(body) - len, "log_lines_written: %ld\n", atomic_load(&logger.written));
+  len += snprintf(body + len, sizeof(body) - len, "log_lines_dropped: %ld\n", atomic_load(&logger.dropped));
+
+  len += snprintf(body + len, sizeof(body) - len, "stale_grace_seconds: %d\n", stale_grace);
+  len += snprintf(body + len, sizeof(body) - len, "stale_if_error_seconds: %d\n", stale_if_error);
+  len += snprintf(body + len, sizeof(body) - len, "stale_served_while_revalidating: %ld\n", atomic_load(&refresh.served));
+  len += snprintf(body + len, sizeof(body) - len, "stale_refreshes_scheduled: %ld\n", atomic_load(&refresh.scheduled));
+  len += snprintf(body + len, sizeof(body) - len, "stale_refreshes_deduplicated: %ld\n", atomic_load(&refresh.deduped));
+  len += snprintf(body + len, sizeof(body) - len, "stale_served_on_error: %ld\n", atomic_load(&refresh.on_error));
+
+  long requests = atomic_load(&upstream.requests), reused = atomic_load(&upstream.reused);
+
+  pthread_mutex_lock(&disk.lock);
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_budget_bytes: %zu\n", disk.dir ? disk.budget : 0);
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_segments: %zu\n", disk.nsegs);
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_objects: %zu\n", disk.count);
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_live_bytes: %zu\n", disk.live);
+  pthread_mutex_unlock(&disk.lock);
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_demoted: %ld\n", atomic_load(&disk.demoted));
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_demotions_skipped: %ld\n", atomic_load(&disk.skipped));
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_hits: %ld\n", atomic_load(&disk.hits));
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_promoted: %ld\n", atomic_load(&disk.promoted));
+  len += snprintf(body + len, sizeof(body) - len, "disk_cache_segments_dropped: %ld\n", atomic_load(&disk.dropped));
+  len += snprintf(body + len, sizeof(body) - len, "snapshot_loaded: %ld\n", atomic_load(&snapshot.loaded));
+  len += snprintf(body + len, sizeof(body) - len, "snapshot_expired: %ld\n", atomic_load(&snapshot.expired));
+
+  pthread_mutex_lock(&large.lock);
+  len += snprintf(body + len, sizeof(body) - len, "large_cache_budget_bytes: %zu\n", large.budget);
+  len += snprintf(body + len, sizeof(body) - len, "large_cache_used_bytes: %zu\n", large.used);
+  len += snprintf(body + len, sizeof(body) - len, "large_cache_objects: %zu\n", large.count);
+  len += snprintf(body + len, sizeof(body) - len, "large_cache_segments: %zu\n", large.nsegs);
+  pthread_mutex_unlock(&large.lock);
+  len += snprintf(body + len, sizeof(body) - len, "large_cache_hits: %ld\n", atomic_load(&large.hits));
+  len += snprintf(body + len, sizeof(body) - len, "large_cache_partial_hits: %ld\n", atomic_load(&large.partial_hits));
+  len += snprintf(body + len, sizeof(body) - len, "large_cache_refilled_segments: %ld\n", atomic_load(&large.refills));
+
+  len += snprintf(body + len, sizeof(body) - len, "upstream_requests: %ld\n", requests);
+  len += snprintf(body + len, sizeof(body) - len, "upstream_reused: %ld\n", reused);
+  len += snprintf(body + len, sizeof(body) - len, "upstream_reuse_ratio: %.1f%%\n", requests ? 100.0 * reused / requests : 0.0);
+  len += snprintf(body + len, sizeof(body) - len, "upstream_spliced_bytes: %ld\n", atomic_load(&upstream.spliced));
+  len += snprintf(body + len, sizeof(body) - len, "inflight_leaders: %ld\n", atomic_load(&inflight.leaders));
+  len += snprintf(body + len, sizeof(body) - len, "inflight_followers: %ld\n", atomic_load(&inflight.followers));
+  len += snprintf(body + len, sizeof(body) - len, "origin_requests_saved: %ld\n", atomic_load(&inflight.coalesced));
+  len += snprintf(body + len, sizeof(body) - len, "inflight_followers_cut: %ld\n", atomic_load(&inflight.cut));
+  len += snprintf(body + len, sizeof(body) - len, "inflight_hit_for_pass: %ld\n", atomic_load(&inflight.passed));
+  len += snprintf(body + len, sizeof(body) - len, "client_idle_yielded: %ld\n", atomic_load(&idle_yielded));
+  len += snprintf(body + len, sizeof(body) - len, "dns_hits: %ld\n", atomic_load(&dns.hits));
+  len += snprintf(body + len, sizeof(body) - len, "dns_misses: %ld\n", atomic_load(&dns.misses));
+  len += snprintf(body + len, sizeof(body) - len, "dns_refreshes: %ld\n", atomic_load(&dns.refreshes));
+  len += snprintf(body + len, sizeof(body) - len, "epoll_lookups_offloaded: %ld\n", atomic_load(&lookups.jobs));
+
+  // no-store -> 다른 프록시 (또는 절대 URI 로 요청받은 자기 자신) 가 멈춘 카운터를 캐시하지 않도록
+  return snprintf(buf, maxlen, "HTTP/1.0 200 OK\r\nContent-type: text/plain\r\nCache-Control: no-store\r\nContent-length: %d\r\n\r\n%s",
+                  len, body);
+}
+
+/*
+ * epoll 모드 -> 코어 당 하나의 edge-triggered 이벤트 루프
+ *   연결 하나를 쓰레드 하나가 블로킹으로 처리하는 대신, 모든 소켓을 논블로킹으로 두고
+ *   클라이언트 요청 읽기 -> 서버 connect -> 요청 전송 -> 응답 중계 를 상태 머신으로 진행한다.
+ */
+
+// 연결 하나의 진행 상태
+typedef enum {
+  CONN_READ_REQUEST, // 클라이언트 요청 헤더를 모으는 중
+  CONN_LOOKUP,       // 조회 쓰레드가 이름 해석 / 디스크 캐시 읽기 중 -> 루프는 이 연결을 건드리지 않음
+  CONN_CONNECTING,   // 서버에 논블로킹 connect 진행 중
+  CONN_SEND_REQUEST, // 서버로 HTTP 요청 전송 중
+  CONN_RELAY,        // 서버 응답을 읽어 클라이언트로 중계 중
+  CONN_SEND_CLIENT,  // 캐시 hit / 에러 메시지를 클라이언트로 전송 후 종료
+  CONN_CLOSED        // 종료됨 -> 이번 epoll_wait 배치가 끝나면 해제
+} conn_state;
+
+// 이벤트 루프가 관리하는 연결 하나
+typedef struct conn {
+  conn_state state;
+  int clientfd;              // 클라이언트 소켓
+  int serverfd;              // 서버 소켓 (연결 전 -1)
+  char req[MAXLINE];         // 클라이언트 요청 헤더 누적 버퍼
+  size_t req_len;
+  http_request_view view;    // 요청 헤더 해석 상태 -> 읽을 때마다 새로 온 바이트만 이어서 해석
+  char *uri;                 // 캐시 키로 쓸 요청 URI (req 안을 가리킴)
+  char http_request[MAXLINE];// 서버로 보낼 요청 줄과 프록시가 채우는 헤더
+  struct iovec request_iov[REQUEST_MAX_HEADERS + 2]; // 서버로 보낼 요청 -> http_request, req 안의 헤더 줄들, 빈 줄
+  int request_iovcnt;        // 보낼 것이 남은 항목 수 (다 보낸 항목은 길이 0)
+  char buf[MAXLINE];         // 서버 -> 클라이언트 중계 버퍼
+  char *wbuf;                // 클라이언트로 쓸 데이터 (buf, hit->buf 또는 cache_buf)
+  size_t wlen, wpos;
+  struct cache_block *hit;   // 전송 중인 캐시 hit 블록 (참조 보유)
+  char *cache_buf;           // 캐시에 넣을 응답 사본 / 통계 응답
+  size_t object_len;         // 캐시에 넣을 응답 크기 (MAX_OBJECT_SIZE 초과 시 캐시 안함)
+  struct lookup_job *lookup; // 조회 쓰레드에 맡긴 작업과 그 결과 (맡긴 적 없으면 NULL)
+  struct conn *next_closed;  // 해제 대기 리스트
+} conn;
+
+// 코어 하나에 대응하는 이벤트 루프
+typedef struct event_loop {
+  int epfd;       // 루프 전용 epoll 인스턴스
+  int listenfd;   // 모든 루프가 공유하는 리슨 소켓
+  conn *closed;   // 이번 배치에서 닫힌 연결 리스트
+  int wakefd;     // 조회 쓰레드가 작업을 끝냈음을 알리는 eventfd
+  struct lookup_job *done; // 끝난 조회 작업 (lock 보호)
+  pthread_mutex_t lock;
+} event_loop_t;
+
+// 이벤트 루프 대신 조회 쓰레드가 하는 블로킹 작업 하나 -> 캐시에 없는 이름 해석, 디스크 캐시에서 메모리로 올리기
+typedef struct lookup_job {
+  conn *c;                      // 작업이 끝나면 이어서 진행할 연결
+  event_loop_t *loop;           // 그 연결이 속한 루프
+  char *uri, *hostname, *port;
+  int disk;                     // 1 이면 디스크 캐시의 객체를 먼저 메모리로 올려 봄
+  int naddrs;                   // 해석한 주소 수 (실패 0), 디스크에서 올렸거나 해석하지 않았으면 -1
+  dns_addr addrs[DNS_MAX_ADDRS];
+  struct lookup_job *next;
+} lookup_job;
+
+static void conn_dispatch(event_loop_t *loop, conn *c);
+
+#define MAX_EVENTS 64
+
+/// @brief 파일 디스크립터를 논블로킹으로 설정
+/// @param fd 설정할 파일 디스크립터
+/// @return 성공 시 0, 실패 시 -1
+static int set_nonblocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0)
+    return -1;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/// @brief 연결을 닫고 해제 대기 리스트에 넣음 -> 같은 배치의 다른 이벤트가 해제된 메모리를 보지 않도록
+/// @param loop 연결이 속한 이벤트 루프
+/// @param c 닫을 연결
+static void conn_close(event_loop_t *loop, conn *c)
+{
+  if (c->state == CONN_CLOSED)
+    return;
+
+  // close()하면 epoll 관심 목록에서도 자동으로 빠진다
+  Close(c->clientfd);
+  if (c->serverfd >= 0)
+    Close(c->serverfd);
+
+  c->state = CONN_CLOSED;
+  c->next_closed = loop->closed;
+  loop->closed = c;
+}
+
+/// @brief 클라이언트에게 보낼 메시지를 설정하고 전송 후 종료 상태로 전환
+/// @param c 대상 연결
+/// @param data 보낼 데이터
+/// @param len 데이터 길이
+static void conn_reply(conn *c, char *data, size_t len)
+{
+  c->wbuf = data;
+  c->wlen = len;
+  c->wpos = 0;
+  c->state = CONN_SEND_CLIENT;
+}
+
+/// @brief 클라이언트로 대기 중인 데이터를 논블로킹으로 전송
+/// @param c 대상 연결
+/// @return 모두 보냈으면 1, EAGAIN 이면 0, 에러면 -1
+static int conn_flush_client(conn *c)
+{
+  while (c->wpos < c->wlen)
+  {
+    ssize_t n = write(c->clientfd, c->wbuf + c->wpos, c->wlen - c->wpos);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    c->wpos += n;
+  }
+  return 1;
+}
+
+/// @brief 연결의 블로킹 작업을 조회 쓰레드에 맡김 -> 끝나면 루프가 conn_dispatch 부터 다시 진행
+/// @param loop 연결이 속한 이벤트 루프
+/// @param c 대상 연결
+/// @param hostname 서버 호스트 이름
+/// @param port 서버 포트
+/// @param disk 1 이면 디스크 캐시의 객체를 메모리로 올려 봄
+static void lookup_schedule(event_loop_t *loop, conn *c, char *hostname, char *port, int disk)
+{
+  lookup_job *j = c->lookup;
+
+  if (j == NULL)
+  {
+    j = c->lookup = Calloc(1, sizeof(lookup_job));
+    j->c = c;
+    j->loop = loop;
+    j->uri = strdup(c->uri);
+    j->hostname = strdup(hostname);
+    j->port = strdup(port);
+  }
+  j->disk = disk;
+  j->naddrs = -1;
+  j->next = NULL;
+  c->state = CONN_LOOKUP;
+  atomic_fetch_add(&lookups.jobs, 1);
+
+  pthread_mutex_lock(&lookups.lock);
+  if (lookups.tail)
+    lookups.tail->next = j;
+  else
+    lookups.head = j;
+  lookups.tail = j;
+  pthread_cond_signal(&lookups.cond);
+  pthread_mutex_unlock(&lookups.lock);
+}
+
+/// @brief 조회 쓰레드 -> 디스크 캐시의 객체를 메모리로 올리거나 이름을 해석한 뒤 연결의 루프를 깨움
+/// @param vargp 사용 안함
+/// @return NULL (반환하지 않음)
+static void *lookup_worker(void *vargp)
+{
+  uint64_t one = 1;
+
+  Pthread_detach(pthread_self());
+
+  while (1)
+  {
+    lookup_job *j;
+    event_loop_t *loop;
+
+    pthread_mutex_lock(&lookups.lock);
+    while (lookups.head == NULL)
+      pthread_cond_wait(&lookups.cond, &lookups.lock);
+    j = lookups.head;
+    if ((lookups.head = j->next) == NULL)
+      lookups.tail = NULL;
+    pthread_mutex_unlock(&lookups.lock);
+
+    // 디스크에서 올렸으면 루프가 메모리 캐시 hit 으로 보냄 -> 이름 해석은 필요할 때 다시 맡김
+    if (!(j->disk && disk_promote(j->uri)))
+      j->naddrs = dns_lookup(j->hostname, j->port, j->addrs);
+
+    loop = j->loop;
+    pthread_mutex_lock(&loop->lock);
+    j->next = loop->done;
+    loop->done = j;
+    pthread_mutex_unlock(&loop->lock);
+    if (write(loop->wakefd, &one, sizeof(one)) < 0) // 카운터가 넘칠 일은 없음 -> 실패해도 다음 작업이 다시 깨움
+      continue;
+  }
+  return NULL;
+}
+
+/// @brief 요청 헤더가 모두 도착한 연결을 처리 -> 메소드와 통계 요청을 확인하고 conn_dispatch 로 넘김
+/// @param loop 연결이 속한 이벤트 루프
+/// @param c 대상 연결
+static void conn_start_request(event_loop_t *loop, conn *c)
+{
+  char *method;
+  int rc;
+
+  // 요청 라인의 메소드와 URI 를 제자리에서 문자열로
+  method = span_cstr(c->req, c->view.method);
+  c->uri = span_cstr(c->req, c->view.uri);
+  log_printf(LOG_INFO, "Request: %s %s %s\n", method, c->uri, span_cstr(c->req, c->view.version));
+
+  if (strcasecmp(method, "GET") && strcasecmp(method, "HEAD")) // GET, HEAD 가 아니라면
+  {
+    snprintf(c->buf, MAXLINE, "Proxy does not implement this method: %s\r\n", method);
+    conn_reply(c, c->buf, strlen(c->buf));
+    return;
+  }
+
+  if ((rc = stats_request(c->clientfd, c->uri)) != 0) // 프록시 자신의 통계 요청
+  {
+    if (rc < 0)
+      conn_reply(c, stats_forbidden, sizeof(stats_forbidden) - 1);
+    else
+      conn_reply(c, c->buf, proxy_stats(c->buf, MAXLINE));
+    return;
+  }
+
+  conn_dispatch(loop, c);
+}
+
+/// @brief 캐시 확인 또는 서버 connect 시작 -> 블로킹 작업 (디스크 캐시, 캐시에 없는 이름 해석) 은 조회 쓰레드에 맡기고
+///        그 작업이 끝나면 루프가 여기부터 다시 부름
+/// @param loop 연결이 속한 이벤트 루프
+/// @param c 대상 연결
+static void conn_dispatch(event_loop_t *loop, conn *c)
+{
+  char hostname[MAXLINE], path[MAXLINE], port[MAXLINE] = "80";
+  char request[MAXLINE]; // 백그라운드 재검증용 요청 메시지
+  upstream_request refresh_request;
+  dns_addr addrs[DNS_MAX_ADDRS];
+  size_t len;
+  int in_progress, ranged, stale, head, naddrs = -1;
+  struct epoll_event ev;
+
+  if (parse_uri(c->uri, hostname, path, port) < 0) // URI를 파싱
+  {
+    snprintf(c->buf, MAXLINE, "Proxy could not parse URI: %s\r\n", c->uri);
+    conn_reply(c, c->buf, strlen(c->buf));
+    return;
+  }
+
+  // Range 요청은 그대로 서버에 전달하고 캐시는 쓰지 않음 (부분 응답이 전체 URI 키로 캐시되지 않도록)
+  ranged = request_header(&c->view, c->req, "Range") != NULL;
+  head = !strcasecmp(span_cstr(c->req, c->view.method), "HEAD");
+
+  // 디스크 캐시의 객체는 조회 쓰레드가 메모리로 올린 뒤 여기서 hit 으로 보냄 (이벤트 루프는 세그먼트 참조를 들고 있지 않음)
+  if (!ranged && (c->hit = cache_find(c->uri, &stale)) != NULL)
+  {
+    // 유예 시간이 지난 stale 항목과 헤더 경계를 모르는 객체의 HEAD 는 miss 로 서버에 전달
+    if ((!stale || time(NULL) < atomic_load(&c->hit->expires) + stale_grace) && (!head || c->hit->hdr_len))
+    {
+      if (stale) // 유예 시간 안의 stale hit -> 백그라운드 쓰레드가 HTTP/1.1 조건부 요청으로 재검증
+      {
+        // 요청이 버퍼에 다 들어가지 않으면 (아주 긴 경로) 재검증 없이 stale 본문만 보냄
+        if (snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n%sConnection: keep-alive\r\n\r\n",
+                     path, hostname, user_agent_hdr) < (int)sizeof(request))
+        {
+          request_wrap(&refresh_request, request);
+          refresh_schedule(hostname, port, &refresh_request, c->uri, c->hit->buf, c->hit->hdr_len);
+        }
+      }
+      if (c->hit->hdr_len && client_not_modified(c->req + c->view.hdr_off, c->view.len - c->view.hdr_off, c->hit->buf, c->hit->hdr_len)) // 클라이언트 사본이 유효 -> 304
+      {
+        atomic_fetch_add(&admission.client_304, 1);
+        conn_reply(c, c->buf, build_not_modified(c->buf, MAXLINE, c->hit->buf, c->hit->hdr_len, 0));
+      }
+      else if (head) // HEAD -> 저장된 헤더만
+      {
+        atomic_fetch_add(&admission.head_hits, 1);
+        conn_reply(c, c->hit->buf, c->hit->hdr_len);
+      }
+      else
+        conn_reply(c, c->hit->buf, c->hit->size); // 공유 버퍼에서 바로 전송
+      return;
+    }
+    cache_release(c->hit); // 새 응답이 같은 키로 교체
+    c->hit = NULL;
+  }
+
+  // 루프에서 블로킹하지 않도록 -> 디스크 캐시에 있으면 올리기를, 이름 해석 결과가 캐시에 없으면 해석을 조회 쓰레드에 맡김
+  if (c->lookup && c->lookup->naddrs >= 0)
+    memcpy(addrs, c->lookup->addrs, (naddrs = c->lookup->naddrs) * sizeof(dns_addr));
+  else if (c->lookup == NULL && !ranged && disk_has(c->uri))
+  {
+    lookup_schedule(loop, c, hostname, port, 1);
+    return;
+  }
+  if (naddrs < 0 && (naddrs = dns_cached(hostname, port, addrs)) < 0)
+  {
+    lookup_schedule(loop, c, hostname, port, 0);
+    return;
+  }
+
+  // 서버에 보낼 HTTP 요청 메시지 구성 -> build_http_request와 같은 규칙
+  // 헤더 줄은 복사하지 않고 해석한 구간을 그대로 가리켜 한 번의 writev 로 보냄
+  len = snprintf(c->http_request, MAXLINE, "%s %s HTTP/1.0\r\nHost: %s\r\n%sConnection: close\r\nProxy-Connection: close\r\n",
+                 head ? "HEAD" : "GET", path, hostname, user_agent_hdr);
+  if (len > MAXLINE - 1)
+    len = MAXLINE - 1;
+  c->request_iov[0] = (struct iovec){ c->http_request, len };
+  c->request_iovcnt = 1;
+  for (int i = 0; i < c->view.nheaders; i++)
+  {
+    http_header *h = &c->view.headers[i];
+    if (!skip_request_header(c->req + h->line.off))
+      c->request_iov[c->request_iovcnt++] = (struct iovec){ c->req + h->line.off, h->line.len };
+  }
+  c->request_iov[c->request_iovcnt++] = (struct iovec){ "\r\n", 2 };
+
+  if ((c->serverfd = dns_open(addrs, naddrs, 1, &in_progress)) < 0)
+  {
+    snprintf(c->buf, MAXLINE, "Connection failed to %s\r\n", c->uri);
+    conn_reply(c, c->buf, strlen(c->buf));
+    return;
+  }
+
+  ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+  ev.data.ptr = c;
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, c->serverfd, &ev) < 0)
+  {
+    conn_close(loop, c);
+    return;
+  }
+
+  c->cache_buf = Malloc(MAX_OBJECT_SIZE + MAXLINE); // miss 일 때만 응답 사본 버퍼 할당 (뒤쪽 여유는 Content-Length 를 끼워 넣을 자리)
+  c->object_len = ranged || head ? MAX_OBJECT_SIZE + 1 : 0; // 구간 응답과 HEAD 응답은 캐시하지 않음
+  c->state = in_progress ? CONN_CONNECTING : CONN_SEND_REQUEST;
+}
+
+/// @brief 연결의 상태 머신을 진행 -> 더 진행할 수 없을 때(EAGAIN)까지 반복
+/// @param loop 연결이 속한 이벤트 루프
+/// @param c 대상 연결
+static void conn_run(event_loop_t *loop, conn *c)
+{
+  ssize_t n;
+  int rc;
+
+  while (1)
+  {
+    switch (c->state)
+    {
+    case CONN_READ_REQUEST:
+      // edge-triggered 이므로 EAGAIN이 나올 때까지 읽는다
+      n = read(c->clientfd, c->req + c->req_len, MAXLINE - 1 - c->req_len);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+      {
+        conn_close(loop, c);
+        return;
+      }
+      c->req_len += n;
+      c->req[c->req_len] = '\0';
+
+      // 새로 받은 바이트만 이어서 해석 -> 빈 줄까지 오면 처리 시작
+      if ((rc = request_parse(&c->view, c->req, c->req_len)) > 0)
+        conn_start_request(loop, c);
+      else if (rc < 0 || c->req_len == MAXLINE - 1) // 요청이 아니거나 헤더가 버퍼보다 큼
+        conn_close(loop, c);
       break;
-    
-    // 선택된 블록 제거
-    cache.total_size -= cache.blocks[del_index].size;
-    cache.blocks[del_index].used = 0;
+
+    case CONN_CONNECTING:
+    {
+      // 서버 소켓이 쓰기 가능해졌는지 즉시 확인 (대기하지 않음)
+      struct pollfd pfd = { .fd = c->serverfd, .events = POLLOUT };
+      int err = 0;
+      socklen_t len = sizeof(err);
+
+      if (poll(&pfd, 1, 0) == 0)
+        return;
+      if (getsockopt(c->serverfd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err)
+      {
+        snprintf(c->buf, MAXLINE, "Connection failed to %s\r\n", c->uri);
+        conn_reply(c, c->buf, strlen(c->buf));
+        break;
+      }
+      c->state = CONN_SEND_REQUEST;
+      break;
+    }
+
+    case CONN_LOOKUP: // 조회 쓰레드가 끝내면 loop_lookup_done 이 이어서 진행
+      return;
+
+    case CONN_SEND_REQUEST:
+      // 소켓 버퍼가 차면 request_iov 에 남은 부분이 기록되어 있으므로 다음 EPOLLOUT 에 이어서 보냄
+      if (rio_writev(c->serverfd, c->request_iov, c->request_iovcnt) < 0)
+      {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+          return;
+        conn_close(loop, c);
+        return;
+      }
+      c->wbuf = c->buf;
+      c->wlen = c->wpos = 0;
+      c->state = CONN_RELAY;
+      break;
+
+    case CONN_RELAY:
+    {
+      // 먼저 이전 조각을 클라이언트로 다 보낸 뒤에만 서버에서 더 읽는다 (역압)
+      int rc = conn_flush_client(c);
+      if (rc < 0)
+      {
+        conn_close(loop, c);
+        return;
+      }
+      if (rc == 0)
+        return;
+
+      n = read(c->serverfd, c->buf, MAXLINE);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0) // 서버가 응답을 다 보냄
+      {
+        if (n == 0 && c->object_len <= MAX_OBJECT_SIZE)
+        {
+          char *body = memmem(c->cache_buf, c->object_len, "\r\n\r\n", 4);
+          http_response resp;
+          time_t expires = 0;
+
+          // 쓰레드 모드와 같은 저장 정책 -> 헤더 경계를 모르는 응답과 chunked 본문은 저장하지 않음
+          if (body && response_parse(&resp, c->cache_buf, body + 4 - c->cache_buf) == 0 && !resp.chunked)
+            expires = response_cache_until(&resp, c->uri, time(NULL));
+          if (expires)
+          {
+            // 서버의 Connection: close 같은 hop-by-hop 헤더를 빼고 Content-Length 를 채워 저장
+            // -> 스냅숏 / 디스크 캐시로 쓰레드 모드에 다시 올라가도 keep-alive 응답의 끝을 알 수 있음
+            size_t hdr_len = body + 4 - c->cache_buf;
+            size_t object_len = response_normalize(c->cache_buf, c->object_len, &hdr_len, resp.content_length >= 0);
+            atomic_fetch_add(&admission.stored, 1);
+            cache_insert(c->uri, c->cache_buf, object_len, hdr_len, expires);
+          }
+          else
+            atomic_fetch_add(&admission.refused, 1);
+        }
+        conn_close(loop, c);
+        return;
+      }
+
+      if (c->object_len + n <= MAX_OBJECT_SIZE)
+      {
+        memcpy(c->cache_buf + c->object_len, c->buf, n);
+        c->object_len += n;
+      }
+      else
+      {
+        c->object_len = MAX_OBJECT_SIZE + 1;
+      }
+
+      c->wlen = n;
+      c->wpos = 0;
+      break;
+    }
+
+    case CONN_SEND_CLIENT:
+    {
+      int rc = conn_flush_client(c);
+      if (rc == 0)
+        return;
+      conn_close(loop, c); // 다 보냈거나 에러 -> 종료
+      return;
+    }
+
+    case CONN_CLOSED:
+      return;
+    }
   }
+}
 
-  // 쓰기 락 해제
-  pthread_rwlock_unlock(&cache.lock);
-}
\ No newline at end of file
+/// @brief 조회 쓰레드가 끝낸 작업들의 연결을 이어서 진행 (eventfd 가 읽기 가능해졌을 때)
+/// @param loop 깨어난 이벤트 루프
+static void loop_lookup_done(event_loop_t *loop)
+{
+  uint64_t count;
+  lookup_job *j;
+
+  if (read(loop->wakefd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    return;
+  pthread_mutex_lock(&loop->lock);
+  j = loop->done;
+  loop->done = NULL;
+  pthread_mutex_unlock(&loop->lock);
+
+  while (j)
+  {
+    lookup_job *next = j->next;
+    conn *c = j->c;
+
+    conn_dispatch(loop, c);
+    conn_run(loop, c); // edge-triggered 이벤트는 조회 중에 이미 지나갔을 수 있으므로 직접 진행
+    j = next;
+  }
+}
+
+/// @brief 조회 쓰레드 시작
+void lookup_init(void)
+{
+  pthread_t tid;
+
+  for (int i = 0; i < LOOKUP_THREADS; i++)
+    Pthread_create(&tid, NULL, lookup_worker, NULL);
+}
+
+/// @brief 리슨 소켓에서 대기 중인 연결을 모두 수락해 루프에 등록
+/// @param loop 수락한 연결을 담당할 이벤트 루프
+static void loop_accept(event_loop_t *loop)
+{
+  struct sockaddr_storage clientaddr;
+  socklen_t clientlen;
+  struct epoll_event ev;
+  int connfd;
+
+  while (1)
+  {
+    clientlen = sizeof(clientaddr);
+    connfd = accept4(loop->listenfd, (SA *)&clientaddr, &clientlen, SOCK_NONBLOCK);
+    if (connfd < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      return; // EAGAIN 또는 다른 루프가 먼저 가져감
+    }
+    if (log_enabled(LOG_INFO)) // 숫자 주소만 -> 이벤트 루프가 역방향 DNS 조회를 기다리지 않음
+    {
+      char hostname[NI_MAXHOST], port[NI_MAXSERV];
+      if (getnameinfo((SA *)&clientaddr, clientlen, hostname, sizeof(hostname), port, sizeof(port),
+                      NI_NUMERICHOST | NI_NUMERICSERV) == 0)
+        log_printf(LOG_INFO, "Accepted connection from (%s, %s)\n", hostname, port);
+    }
+
+    conn *c = Malloc(sizeof(conn));
+    c->state = CONN_READ_REQUEST;
+    c->clientfd = connfd;
+    c->serverfd = -1;
+    c->req_len = 0;
+    request_view_init(&c->view);
+    c->uri = NULL;
+    c->wbuf = NULL;
+    c->wlen = c->wpos = 0;
+    c->cache_buf = NULL;
+    c->hit = NULL;
+    c->object_len = 0;
+    c->lookup = NULL;
+    c->next_closed = NULL;
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    ev.data.ptr = c;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, connfd, &ev) < 0)
+    {
+      Close(connfd);
+      Free(c);
+      continue;
+    }
+  }
+}
+
+/// @brief 이벤트 루프 쓰레드 함수 -> epoll_wait로 준비된 연결의 상태 머신을 진행
+/// @param vargp 이 쓰레드가 담당할 event_loop_t 포인터
+/// @return NULL (반환하지 않음)
+void *event_loop(void *vargp)
+{
+  event_loop_t *loop = vargp;
+  struct epoll_event events[MAX_EVENTS];
+
+  while (1)
+  {
+    int nready = epoll_wait(loop->epfd, events, MAX_EVENTS, -1);
+    if (nready < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      unix_error("epoll_wait error");
+    }
+
+    for (int i = 0; i < nready; i++)
+    {
+      if (events[i].data.ptr == NULL) // 리슨 소켓
+        loop_accept(loop);
+      else if (events[i].data.ptr == loop) // 조회 쓰레드가 끝낸 작업
+        loop_lookup_done(loop);
+      else
+        conn_run(loop, events[i].data.ptr);
+    }
+
+    // 이번 배치에서 닫힌 연결 해제
+    while (loop->closed)
+    {
+      conn *c = loop->closed;
+      loop->closed = c->next_closed;
+      if (c->cache_buf)
+        Free(c->cache_buf);
+      if (c->hit)
+        cache_release(c->hit);
+      if (c->lookup)
+      {
+        free(c->lookup->uri);
+        free(c->lookup->hostname);
+        free(c->lookup->port);
+        Free(c->lookup);
+      }
+      Free(c);
+    }
+  }
+  return NULL;
+}
+
+/// @brief epoll 모드 진입점 -> 코어 수만큼 이벤트 루프 쓰레드를 만들어 실행
+/// @param listenfd 모든 루프가 공유할 리슨 소켓
+void epoll_main(int listenfd)
+{
+  long nloops = sysconf(_SC_NPROCESSORS_ONLN);
+  pthread_t tid;
+  struct epoll_event ev;
+
+  if (nloops < 1)
+    nloops = 1;
+
+  set_nonblocking(listenfd);
+  lookup_init();
+
+  for (long i = 0; i < nloops; i++)
+  {
+    event_loop_t *loop = Malloc(sizeof(event_loop_t));
+    loop->listenfd = listenfd;
+    loop->closed = NULL;
+    loop->done = NULL;
+    pthread_mutex_init(&loop->lock, NULL);
+    if ((loop->epfd = epoll_create1(0)) < 0)
+      unix_error("epoll_create1 error");
+    if ((loop->wakefd = eventfd(0, EFD_NONBLOCK)) < 0)
+      unix_error("eventfd error");
+
+    // 조회 쓰레드가 작업을 끝내면 루프를 깨움 -> data.ptr 로 루프 자신을 넣어 연결과 구분
+    ev.events = EPOLLIN;
+    ev.data.ptr = loop;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wakefd, &ev) < 0)
+      unix_error("epoll_ctl error");
+
+    // EPOLLEXCLUSIVE -> 새 연결 하나에 모든 루프가 깨어나지 않도록
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listenfd, &ev) < 0)
+      unix_error("epoll_ctl error");
+
+    if (i < nloops - 1)
+      Pthread_create(&tid, NULL, event_loop, loop);
+    else
+      event_loop(loop); // 마지막 루프는 메인 쓰레드에서 실행
+
+  }
+}
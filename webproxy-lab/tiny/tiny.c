@@ -8,10 +8,13 @@
  */
 #include "csapp.h"
 
+/* Freshness (seconds) advertised for static files; CGI output gets none */
+#define STATIC_MAX_AGE 60
+
 void doit(int fd);
 void read_requesthdrs(rio_t *rp);
 int parse_uri(char *uri, char *filename, char *cgiargs);
-void serve_static(int fd, char *filename, int filesize, char *method);
+void serve_static(int fd, char *filename, int filesize, time_t mtime, char *method);
 void get_filetype(char *filename, char *filetype);
 void serve_dynamic(int fd, char *filename, char *cgiargs);
 void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longmsg);
@@ -42,7 +45,7 @@ int main(int argc, char **argv)
   {
     clientlen = sizeof(clientaddr); // 클라이언트 주소 구조체 크기 초기화
     connfd = Accept(listenfd, (SA *)&clientaddr, &clientlen); // 클라리언트의 연결을 수락하고 새 연결 소켓 생성
-    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, 0); // 접속한 클라이언트 정보 확인
+    Getnameinfo((SA *)&clientaddr, clientlen, hostname, MAXLINE, port, MAXLINE, NI_NUMERICHOST | NI_NUMERICSERV); // 접속한 클라이언트 주소 (역방향 DNS 조회 없이 숫자로)
     printf("Accepted connection from (%s, %s)\n", hostname, port); // 접속한 클라이언트 정보 출력
     doit(connfd); 
     Close(connfd); // 요청 처리가 끝난 후 연결 종료
@@ -98,7 +101,7 @@ void doit(int fd)
     }
 
     // 정적 파일을 클라이언트에게 전송
-    serve_static(fd, filename, sbuf.st_size, method);
+    serve_static(fd, filename, sbuf.st_size, sbuf.st_mtime, method);
   }
 
   // 동적 컨텐츠 요청인 경우
@@ -134,35 +137,25 @@ void clienterror(int fd, char *cause, char *errnum, char *shortmsg, char *longms
   sprintf(body, "%s<p>%s: %s\r\n", body, longmsg, cause);        // 에러 원인
   sprintf(body, "%s<hr><em>The Tiny Web server</em>\r\n", body); // 서버 서명
 
-  // HTTP 상태 줄 작성
-  sprintf(buf, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-  Rio_writen(fd, buf, strlen(buf));
+  // HTTP 상태 줄과 응답 헤더 작성
+  sprintf(buf, "HTTP/1.0 %s %s\r\nContent-type: text/html\r\nContent-length: %d\r\n\r\n",
+          errnum, shortmsg, (int)strlen(body));
 
-  // 응답 헤더 작성
-  printf(buf, "Content-type: text/html\r\n");
-  Rio_writen(fd, buf, strlen(buf));
-
-  // 응답 헤더 작성
-  sprintf(buf, "Content-length: %d\r\n\r\n", (int)strlen(body));
-  Rio_writen(fd, buf, strlen(buf));
-
-  // HTML 형식 본문 작성
-  Rio_writen(fd, body, strlen(body));
+  // 헤더와 HTML 형식 본문을 한 번의 writev 로 전송
+  struct iovec iov[2] = { { buf, strlen(buf) }, { body, strlen(body) } };
+  Rio_writev(fd, iov, 2);
 }
 
-/// @brief 요청 헤더를 한 줄씩 읽어 출력하는 함수 (첫 헤더 출력x)
+/// @brief 요청 헤더를 빈 줄까지 한 줄씩 읽어 모두 출력하는 함수
 /// @param rp RIO 버퍼 구조체 포인터
 void read_requesthdrs(rio_t *rp)
 {
-  char buf[MAXLINE]; // 읽은 데이터를 저장할 버퍼
-
-  rio_readlineb(rp, buf, MAXLINE); // 첫 헤더 라인 읽기
+  char *line; // rio 버퍼 안의 헤더 라인 (복사 없음)
+  ssize_t n;
 
-  while (strcmp(buf, "\r\n")) // 빈 줄이 나올 때까지 반복
-  {
-    rio_readlineb(rp, buf, MAXLINE); // 다음 헤더 라인 읽기
-    printf("%s", buf); // 읽은 헤더 라인 출력
-  }
+  // 빈 줄이나 EOF 가 나올 때까지 반복
+  while ((n = rio_getlineb(rp, &line)) > 0 && !(n == 2 && !memcmp(line, "\r\n", 2)))
+    printf("%.*s", (int)n, line); // 읽은 헤더 라인 출력
 }
 
 /// @brief URI를 파싱하여 정적 / 동적 요청 구분 및 파일 이름과 CGI 인자 분리
@@ -239,23 +232,34 @@ int parse_uri(char *uri, char *filename, char *cgiargs)
 //   Munmap(srcp, filesize); // 메모리 매핑 해제
 // }
 
-void serve_static(int fd, char *filename, int filesize, char *method)
+/// @brief 클라이언트에게 정적 파일을 HTTP 응답으로 보내는 함수
+/// @param fd 클라이언트와 연결된 파일 디스크립터
+/// @param filename 전송할 파일 이름
+/// @param filesize 전송할 파일 크기
+/// @param mtime 파일 수정 시각 -> Last-Modified 로 보내 캐시가 검증할 수 있게 함
+/// @param method GET 또는 HEAD (HEAD 면 헤더만 보냄)
+void serve_static(int fd, char *filename, int filesize, time_t mtime, char *method)
 {
   int srcfd;  // 파일 디스크립터
-  char *srcp, filetype[MAXLINE], buf[MAXBUF]; 
+  char *srcp, filetype[MAXLINE], buf[MAXBUF], modified[64]; 
+  struct tm tm;
+  
+  struct iovec iov[2];
   
   get_filetype(filename, filetype);
+  strftime(modified, sizeof(modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&mtime, &tm));
 
-  sprintf(buf, "HTTP/1.0 200 OK\r\n");                 
-  sprintf(buf, "%sServer: Tiny Web Server\r\n", buf);  
-  sprintf(buf, "%sConnection: close\r\n", buf);         
-  sprintf(buf, "%sContent-length: %d\r\n", buf, filesize); 
-  sprintf(buf, "%sContent-type: %s\r\n\r\n", buf, filetype);
-  
-  Rio_writen(fd, buf, strlen(buf)); 
+  // 응답 헤더는 한 번에 작성 (sprintf 로 자기 자신에 이어 붙이면 매번 처음부터 다시 복사)
+  iov[0].iov_base = buf;
+  iov[0].iov_len = snprintf(buf, MAXBUF, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\nConnection: close\r\n"
+                            "Content-length: %d\r\nContent-type: %s\r\nLast-Modified: %s\r\n"
+                            "Cache-Control: max-age=%d\r\n\r\n", filesize, filetype, modified, STATIC_MAX_AGE);
  
   if (strcasecmp(method, "HEAD") == 0)
+  {
+    Rio_writen(fd, buf, iov[0].iov_len);
     return;
+  }
 
   srcfd = Open(filename, O_RDONLY, 0); 
   srcp = malloc(filesize); // 파일 크기만큼 동적 할당
@@ -270,7 +274,9 @@ void serve_static(int fd, char *filename, int filesize, char *method)
 
   Rio_readn(srcfd, srcp, filesize); // 파일 내용 메모리 버퍼에 읽어옴
   Close(srcfd); 
-  Rio_writen(fd, srcp, filesize);  // 파일 내용 클라이언트에게 전송
+  iov[1].iov_base = srcp;
+  iov[1].iov_len = filesize;
+  Rio_writev(fd, iov, 2);  // 헤더와 파일 내용을 한 번의 writev 로 클라이언트에게 전송
   free(srcp); // 동적 메모리 해제
 }
 
@@ -283,11 +289,9 @@ void serve_dynamic(int fd, char *filename, char *cgiargs)
   // HTTP 응답 헤더 버퍼, 인자가 없는 execve 인자 배열
   char buf[MAXLINE], *emptylist[] = { NULL }; 
 
-  // HTTP 응답 헤더 작성 및 전송
-  sprintf(buf, "HTTP/1.0 200 OK\r\n"); // 상태 라인
-  Rio_writen(fd, buf, strlen(buf));    // 클라이언트로 전송
-  sprintf(buf, "Server: Tiny Web Server\r\n");  // 서버 정보
-  Rio_writen(fd, buf, strlen(buf));             // 클라이언트로 전송
+  // HTTP 응답 헤더 작성 및 전송 (상태 라인과 서버 정보를 한 번에)
+  sprintf(buf, "HTTP/1.0 200 OK\r\nServer: Tiny Web Server\r\n");
+  Rio_writen(fd, buf, strlen(buf));
 
   // 자식 프로세스 생성
   if (Fork() == 0) // 자식 프로세스만 실행